@@ -0,0 +1,315 @@
+#include <functional>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "TROOT.h"
+#include "TString.h"
+
+#include "../spectrometer_kinetec_hist/benchmark.h"
+#include "../spectrometer_kinetec_hist/spectrometer_kinetic_hist.h"
+
+// The setups compiled with the tracker instead of interpreted, run in the directory they are
+// started in like the macros, e.g. where mfield.root is:
+//   cd spectrometer_kinetec_hist && ../build/runge spectrometer_kinetic_hist 8 65539 rk45
+//   ../build/runge spectrometer_kinetic_hist n_threads=8 importance_sampling=true
+// The arguments are those of the macro of the same name, in order or by name; the ones left out
+// take the macro's defaults. ROOT runs in batch mode, so the canvases only go to their files.
+
+// the entry points of the macros, each compiled into runge_setups
+void runge_kutta(const bool boris, const int step_scale);
+void runge_kutta_spectro();
+void spectrometer_prototype();
+void spectrometer_prototype_momentum();
+bool merge_shards(const int shard_count, const int events);
+void backward_acceptance(const int n_threads);
+void make_field_cache();
+void spectrometer_sweep(const char* sweep_file, const int n_threads, const unsigned int seed, const int n_setup_events, const TString integrator);
+void build_hist(const int n_threads, const int bins, const double all_max, const double detected_max, const char* fit);
+void draw_track(const long long first_event, const long long n_tracks);
+
+// The command line after the setup name: values in the order of the parameters, then any as
+// name=value. A setup reads its parameters with next, which also lists them for the usage.
+class Arguments {
+  public:
+    Arguments(const int argc, char** argv, const int first);
+    // no values; next only records the parameters, see usage
+    Arguments();
+
+    // the value of the parameter called name, or fallback if it is not given
+    template <class T>
+    T next(const char* name, const T fallback);
+    // a parameter without a default
+    template <class T>
+    T required(const char* name);
+
+    // the parameters asked for so far, with their defaults
+    const std::string& usage() const;
+    // throws unless every value given went to a parameter
+    void check() const;
+
+  private:
+    const std::string* value(const char* name);
+    void describe(const char* name, const std::string& fallback);
+
+    std::vector<std::string> values; // positional
+    std::map<std::string, std::string> named;
+    std::size_t used = 0;
+    std::size_t n_parameters = 0;
+    std::set<std::string> parameter_names;
+    std::string parameters;
+};
+
+Arguments::Arguments(const int argc, char** argv, const int first){
+  for(int i = first; i < argc; i++){
+    const std::string argument = argv[i];
+    const std::size_t equals = argument.find('=');
+    if(equals != std::string::npos && equals > 0 && argument.find_first_not_of("abcdefghijklmnopqrstuvwxyz_0123456789") == equals){
+      named[argument.substr(0, equals)] = argument.substr(equals + 1);
+    }else if(named.empty()){
+      values.push_back(argument);
+    }else{
+      throw std::invalid_argument(argument + " follows a named argument");
+    }
+  }
+}
+
+Arguments::Arguments(){}
+
+// the value for name: by name if given so, else the next positional one
+const std::string* Arguments::value(const char* name){
+  n_parameters++;
+  parameter_names.insert(name);
+  const auto found = named.find(name);
+  if(found != named.end()){
+    if(n_parameters <= values.size()){
+      throw std::invalid_argument(std::string(name) + " is given twice");
+    }
+    return &found->second;
+  }
+  return used < values.size() ? &values[used++] : nullptr;
+}
+
+void Arguments::describe(const char* name, const std::string& fallback){
+  parameters += (parameters.empty() ? "[" : " [") + std::string(name) + " = " + fallback + "]";
+}
+
+int parse(const std::string& value, int){
+  return std::stoi(value);
+}
+
+unsigned int parse(const std::string& value, unsigned int){
+  return std::stoul(value);
+}
+
+long long parse(const std::string& value, long long){
+  return std::stoll(value);
+}
+
+double parse(const std::string& value, double){
+  return std::stod(value);
+}
+
+// true / false or 1 / 0, as ROOT takes them on its command line
+bool parse(const std::string& value, bool){
+  if(value == "true" || value == "1"){
+    return true;
+  }
+  if(value == "false" || value == "0"){
+    return false;
+  }
+  throw std::invalid_argument(value + " is neither true nor false");
+}
+
+const char* parse(const std::string& value, const char*){
+  return value.c_str();
+}
+
+TString parse(const std::string& value, const TString&){
+  return value.c_str();
+}
+
+std::string show(const int value){
+  return std::to_string(value);
+}
+
+std::string show(const unsigned int value){
+  return std::to_string(value);
+}
+
+std::string show(const long long value){
+  return std::to_string(value);
+}
+
+std::string show(const double value){
+  std::ostringstream text;
+  text << value;
+  return text.str();
+}
+
+std::string show(const bool value){
+  return value ? "true" : "false";
+}
+
+std::string show(const char* value){
+  return value[0] == 0 ? "\"\"" : value;
+}
+
+std::string show(const TString& value){
+  return show(value.Data());
+}
+
+template <class T>
+T Arguments::next(const char* name, const T fallback){
+  describe(name, show(fallback));
+  const std::string* given = value(name);
+  return given != nullptr ? parse(*given, fallback) : fallback;
+}
+
+template <class T>
+T Arguments::required(const char* name){
+  parameters += (parameters.empty() ? "" : " ") + std::string(name);
+  const std::string* given = value(name);
+  return given != nullptr ? parse(*given, T()) : T();
+}
+
+const std::string& Arguments::usage() const {
+  return parameters;
+}
+
+void Arguments::check() const {
+  if(values.size() > n_parameters){
+    throw std::invalid_argument("takes " + std::to_string(n_parameters) + " arguments at most");
+  }
+  for(auto& argument:named){
+    if(parameter_names.count(argument.first) == 0){
+      throw std::invalid_argument("has no parameter " + argument.first);
+    }
+  }
+}
+
+// a setup ready to run with the arguments it was given
+using Run = std::function<void()>;
+
+struct Setup {
+  const char* name;
+  // reads the parameters from the arguments, checking nothing yet
+  std::function<Run(Arguments&)> parse;
+};
+
+// spectrometer_kinetic_hist and benchmark take their names and defaults from their option
+// structs; the other setups repeat the default arguments of their macros here, so a default
+// changed in a macro is to be changed here as well
+const std::vector<Setup> setups = {
+  {"runge_kutta", [](Arguments& arguments) -> Run {
+    const bool boris = arguments.next("boris", false);
+    const int step_scale = arguments.next("step_scale", 1);
+    return [=](){runge_kutta(boris, step_scale);};
+  }},
+  {"runge_kutta_spectro", [](Arguments&) -> Run {return runge_kutta_spectro;}},
+  {"spectrometer_prototype", [](Arguments&) -> Run {return spectrometer_prototype;}},
+  {"spectrometer_prototype_momentum", [](Arguments&) -> Run {return spectrometer_prototype_momentum;}},
+  {"spectrometer_kinetic_hist", [](Arguments& arguments) -> Run {
+    KineticHistOptions options;
+    options.visit([&](const char* name, auto& member){
+      member = arguments.next(name, member);
+    });
+    return [=](){spectrometer_kinetic_hist(options);};
+  }},
+  {"merge_shards", [](Arguments& arguments) -> Run {
+    const int shard_count = arguments.required<int>("shard_count");
+    const int events = arguments.next("events", n_events);
+    return [=](){
+      if(shard_count < 1){
+        throw std::invalid_argument("merge_shards needs the number of shards");
+      }
+      if(!merge_shards(shard_count, events)){
+        throw std::runtime_error("the shards were not merged; the shard files are kept");
+      }
+    };
+  }},
+  {"backward_acceptance", [](Arguments& arguments) -> Run {
+    const int n_threads = arguments.next("n_threads", 1);
+    return [=](){backward_acceptance(n_threads);};
+  }},
+  {"make_field_cache", [](Arguments&) -> Run {return make_field_cache;}},
+  {"spectrometer_sweep", [](Arguments& arguments) -> Run {
+    const char* sweep_file = arguments.next("sweep_file", "sweep.txt");
+    const int n_threads = arguments.next("n_threads", 1);
+    const unsigned int seed = arguments.next("seed", 65539u);
+    const int n_setup_events = arguments.next("n_setup_events", 100000);
+    const TString integrator = arguments.next("integrator", TString("rk4"));
+    return [=](){spectrometer_sweep(sweep_file, n_threads, seed, n_setup_events, integrator);};
+  }},
+  {"benchmark", [](Arguments& arguments) -> Run {
+    BenchmarkOptions options;
+    options.visit([&](const char* name, auto& member){
+      member = arguments.next(name, member);
+    });
+    return [=](){
+      Integrator integrator;
+      bool batch;
+      if(!parse_integrator(options.integrator, integrator, batch)){
+        throw std::invalid_argument("unknown integrator " + std::string(options.integrator.Data()));
+      }
+      benchmark(options);
+    };
+  }},
+  {"build_hist", [](Arguments& arguments) -> Run {
+    const int n_threads = arguments.next("n_threads", 1);
+    const int bins = arguments.next("bins", 100);
+    const double all_max = arguments.next("all_max", 5e6);
+    const double detected_max = arguments.next("detected_max", 3e6);
+    const char* fit = arguments.next("fit", "gaus");
+    return [=](){build_hist(n_threads, bins, all_max, detected_max, fit);};
+  }},
+  {"draw_track", [](Arguments& arguments) -> Run {
+    const long long first_event = arguments.next("first_event", 0LL);
+    const long long n_tracks = arguments.next("n_tracks", 1LL);
+    return [=](){draw_track(first_event, n_tracks);};
+  }},
+};
+
+void print_usage(const char* program){
+  std::cerr << "usage: " << program << " setup [arguments] [name=value ...]" << std::endl << "setups:" << std::endl;
+  for(auto& setup:setups){
+    Arguments parameters;
+    setup.parse(parameters);
+    std::cerr << "  " << setup.name << " " << parameters.usage() << std::endl;
+  }
+}
+
+int main(int argc, char** argv){
+  if(argc < 2){
+    print_usage(argv[0]);
+    return 1;
+  }
+  const std::string name = argv[1];
+  for(auto& setup:setups){
+    if(name != setup.name){
+      continue;
+    }
+    try{
+      Arguments arguments(argc, argv, 2);
+      const Run run = setup.parse(arguments);
+      arguments.check();
+      gROOT->SetBatch(kTRUE);
+      run();
+    }catch(const std::invalid_argument& error){
+      std::cerr << name << ": " << error.what() << std::endl;
+      print_usage(argv[0]);
+      return 1;
+    }catch(const std::exception& error){
+      std::cerr << name << ": " << error.what() << std::endl;
+      return 1;
+    }
+    return 0;
+  }
+  std::cerr << "unknown setup " << name << std::endl;
+  print_usage(argv[0]);
+  return 1;
+}
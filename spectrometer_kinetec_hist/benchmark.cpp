@@ -0,0 +1,322 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "TROOT.h"
+#include "TString.h"
+
+#include "../tracker/batch_rk4.h"
+#include "../tracker/beam_rk4.h"
+#include "../tracker/counter_random.h"
+#include "../tracker/field_grid_3d.h"
+#include "../tracker/obstacle_grid.h"
+
+#include "benchmark.h"
+#include "spectrometer_kinetic_hist.h"
+
+using std::vector;
+
+// Timings of the tracker hot paths and of whole blocks of events, written as JSON so runs on the
+// same machine can be compared between versions. Every timing is repeated and reported as its
+// median with the fastest and slowest repetition, so a change is only read into differences
+// larger than that spread. Run where mfield.root is, with the macro it times loaded first:
+// root -l
+// .L spectrometer_kinetic_hist.cpp
+// .x benchmark.cpp({"benchmark.json", "rk4", "my change"})
+
+// seconds of the repetitions of one timing
+struct Timing {
+  double median;
+  double min;
+  double max;
+};
+
+Timing timing_of(vector<double> seconds){
+  std::sort(seconds.begin(), seconds.end());
+  const size_t n = seconds.size();
+  return {(seconds[(n - 1) / 2] + seconds[n / 2]) / 2, seconds.front(), seconds.back()};
+}
+
+struct BenchmarkResult {
+  std::string name;
+  long long operations;
+  Timing seconds;
+};
+
+struct ThroughputResult {
+  int n_events;
+  int n_threads;
+  Timing seconds;
+  long long steps;
+};
+
+// the state of a BeamRK4 after one step, see the is_anihilated benchmark
+struct ProbeState {
+  SpaceVector<2> x, p, x_previous, p_previous;
+  double tau;
+  int tau_index;
+};
+
+// text as a JSON string, quotes included
+std::string json_string(const char* text){
+  std::string quoted = "\"";
+  for(const char* character = text; *character != 0; character++){
+    if(*character == '"' || *character == '\\'){
+      quoted += '\\';
+    }
+    if((unsigned char)*character >= 0x20){
+      quoted += *character;
+    }
+  }
+  return quoted + "\"";
+}
+
+// times run() repetitions times; it does `operations` operations and returns something that
+// depends on them
+template <class Run>
+BenchmarkResult benchmark_operation(const char* name, const long long operations, const int repetitions, Run run){
+  volatile double sink = 0;
+  vector<double> seconds;
+  for(int repetition = 0; repetition < repetitions; repetition++){
+    const auto start = std::chrono::steady_clock::now();
+    sink = sink + run();
+    seconds.push_back(seconds_since(start));
+  }
+  const BenchmarkResult result = {name, operations, timing_of(seconds)};
+  const double ns = 1e9 / operations;
+  std::cout << name << ": " << result.seconds.median * ns << " ns per operation, " << result.seconds.min * ns << " to " << result.seconds.max * ns << std::endl;
+  return result;
+}
+
+// n_events events of seed in blocks on n_threads workers, as spectrometer_kinetic_hist simulates
+// them, without the merge into beta_tree and the drawing, repetitions times
+template <class Simulate>
+ThroughputResult benchmark_throughput(const int n_events, const int n_threads, const unsigned int seed, const int repetitions, Simulate simulate){
+  const int n_blocks = (n_events + events_per_block - 1) / events_per_block;
+  vector<double> seconds;
+  long long steps = 0;
+  for(int repetition = 0; repetition < repetitions; repetition++){
+    std::atomic<int> next_block(0);
+    std::atomic<long long> run_steps(0);
+    auto worker = [&](){
+      for(int block = next_block++; block < n_blocks; block = next_block++){
+        EventBlock event_block;
+        simulate(source_events(block, std::min(events_per_block, n_events - block * events_per_block), seed), event_block);
+        long long block_steps = 0;
+        for(auto& record:event_block.records){
+          block_steps += record.steps;
+        }
+        run_steps += block_steps;
+      }
+    };
+    const auto start = std::chrono::steady_clock::now();
+    vector<std::thread> workers;
+    for(int i = 0; i < n_threads; i++){
+      workers.emplace_back(worker);
+    }
+    for(auto& worker_thread:workers){
+      worker_thread.join();
+    }
+    seconds.push_back(seconds_since(start));
+    steps = run_steps;
+  }
+  const ThroughputResult result = {n_events, n_threads, timing_of(seconds), steps};
+  std::cout << n_events << " events on " << n_threads << " threads: " << n_events / result.seconds.median << " events/s ("
+            << n_events / result.seconds.max << " to " << n_events / result.seconds.min << "), " << steps / result.seconds.median << " steps/s" << std::endl;
+  return result;
+}
+
+// The options are the members of BenchmarkOptions. integrator is as for spectrometer_kinetic_hist
+// and seed draws the source electrons of every timing. The end-to-end runs go from 1000 events up
+// to max_events, ten times more each, on 1, 2, 4, ... up to max_threads (0: every hardware thread).
+// Every timing is taken repetitions times. label goes into the output to tell the runs apart,
+// e.g. a commit
+void benchmark(const BenchmarkOptions& options){
+  const TString integrator = options.integrator;
+  const unsigned int seed = options.seed;
+  const int repetitions = options.repetitions;
+  bool batch;
+  Integrator beam_integrator;
+  if(!parse_integrator(integrator, beam_integrator, batch)){
+    std::cerr << "unknown integrator " << integrator << std::endl;
+    return;
+  }
+  if(repetitions < 1){
+    std::cerr << "every timing needs a repetition" << std::endl;
+    return;
+  }
+  const int hardware_threads = std::max((int)std::thread::hardware_concurrency(), 1);
+  const int thread_limit = options.max_threads > 0 ? options.max_threads : hardware_threads;
+
+  const MagneticFieldGrid* magnetic_field_grid = open_magnetic_field();
+  ObstacleGrid obstacle_grid(magnetic_field_grid->x_min, magnetic_field_grid->x_max, magnetic_field_grid->y_min, magnetic_field_grid->y_max, magnetic_field_grid->nx, magnetic_field_grid->ny);
+  for(auto& drain_rectangle:spectrometer_drain_rectangles()){
+    obstacle_grid.add_rectangle(drain_rectangle->x1, drain_rectangle->x2, drain_rectangle->y1, drain_rectangle->y2, drain_rectangle->anihilation_type);
+  }
+  const SpaceVector<2> source = {{source_x, source_y}};
+  const double integrator_dtau = beam_integrator == Integrator::Boris && !batch ? boris_step<2>(magnetic_field_grid, momentum) : dtau;
+  const vector<SourceEvent> events = source_events(0, events_per_block, seed);
+
+  vector<BenchmarkResult> micro;
+
+  // random points over the map, the same for every repetition
+  const int n_points = 1 << 20;
+  vector<double> points(2 * n_points);
+  CounterUniform uniform(seed, 0);
+  for(int point = 0; point < n_points; point++){
+    points[2 * point] = magnetic_field_grid->x_min + uniform() * (magnetic_field_grid->x_max - magnetic_field_grid->x_min);
+    points[2 * point + 1] = magnetic_field_grid->y_min + uniform() * (magnetic_field_grid->y_max - magnetic_field_grid->y_min);
+  }
+  micro.push_back(benchmark_operation("field_lookup", n_points, repetitions, [&](){
+    double sum = 0;
+    for(int point = 0; point < n_points; point++){
+      sum += magnetic_field_grid->field(points[2 * point], points[2 * point + 1]);
+    }
+    return sum;
+  }));
+
+  // the same points through the 3D map made from the midplane, spread over its height
+  const FieldGrid3D field_grid_3d(*magnetic_field_grid, -field_half_height, field_half_height, field_nz);
+  vector<double> heights(n_points);
+  for(int point = 0; point < n_points; point++){
+    heights[point] = (2 * uniform() - 1) * field_half_height;
+  }
+  micro.push_back(benchmark_operation("field_lookup_3d", n_points, repetitions, [&](){
+    double sum = 0;
+    for(int point = 0; point < n_points; point++){
+      const SpaceVector<3> b = field_grid_3d.field(points[2 * point], points[2 * point + 1], heights[point]);
+      sum += b.X() + b.Y() + b.Z();
+    }
+    return sum;
+  }));
+
+  // source electrons for 1000 steps each, wherever that takes them
+  const int steps_per_track = 1000, n_step_tracks = 200;
+  micro.push_back(benchmark_operation("step_RK4", (long long)steps_per_track * n_step_tracks, repetitions, [&](){
+    double sum = 0;
+    for(int track = 0; track < n_step_tracks; track++){
+      BeamRK4 beam_RK4(source, events[track].momentum, mass_e, charge_e, magnetic_field_grid, dtau, 2 * steps_per_track * dtau);
+      for(int step = 0; step < steps_per_track; step++){
+        beam_RK4.step_RK4();
+      }
+      sum += beam_RK4.x.X();
+    }
+    return sum;
+  }));
+
+  const vector<SourceEvent> events_3d = source_events(0, events_per_block, seed, nullptr, momentum, source_vertical_angle);
+  micro.push_back(benchmark_operation("step_RK4_3d", (long long)steps_per_track * n_step_tracks, repetitions, [&](){
+    double sum = 0;
+    for(int track = 0; track < n_step_tracks; track++){
+      const SourceEvent& event = events_3d[track];
+      BeamRK4_3D beam_RK4({{source_x, source_y, 0}}, {{event.momentum.X(), event.momentum.Y(), event.momentum_z}}, mass_e, charge_e, &field_grid_3d, dtau, 2 * steps_per_track * dtau);
+      for(int step = 0; step < steps_per_track; step++){
+        beam_RK4.step_RK4();
+      }
+      sum += beam_RK4.x.X();
+    }
+    return sum;
+  }));
+
+  // the steps of real tracks against the five collimator and detector rectangles; the probe is
+  // put in the state of each step in full, since is_anihilated moves an electron that hit back
+  // to where it entered
+  vector<ProbeState> segments;
+  for(int track = 0; track < 100; track++){
+    BeamRK4 beam_RK4(source, events[track].momentum, mass_e, charge_e, magnetic_field_grid, dtau, tau_final);
+    beam_RK4.set_obstacles(&obstacle_grid);
+    while(!beam_RK4.is_anihilated()){
+      beam_RK4.step();
+      segments.push_back({beam_RK4.x, beam_RK4.p, beam_RK4.x_previous, beam_RK4.p_previous, beam_RK4.tau, beam_RK4.tau_index});
+    }
+  }
+  BeamRK4 probe(source, events[0].momentum, mass_e, charge_e, magnetic_field_grid, dtau, tau_final);
+  probe.set_obstacles(&obstacle_grid);
+  micro.push_back(benchmark_operation("is_anihilated", segments.size(), repetitions, [&](){
+    double sum = 0;
+    for(auto& segment:segments){
+      probe.x = segment.x;
+      probe.p = segment.p;
+      probe.x_previous = segment.x_previous;
+      probe.p_previous = segment.p_previous;
+      probe.tau = segment.tau;
+      probe.tau_index = segment.tau_index;
+      probe.anihilation_type = 0;
+      probe.obstacle = -1;
+      sum += probe.is_anihilated();
+    }
+    return sum;
+  }));
+
+  const int n_source_blocks = 100;
+  micro.push_back(benchmark_operation("source_events", (long long)n_source_blocks * events_per_block, repetitions, [&](){
+    double sum = 0;
+    for(int block = 0; block < n_source_blocks; block++){
+      sum += source_events(block, events_per_block, seed).back().momentum_amount;
+    }
+    return sum;
+  }));
+
+  ROOT::EnableThreadSafety();
+
+  auto simulate = [&](const vector<SourceEvent>& block_events, EventBlock& event_block){
+    if(batch){
+      simulate_block_batch(block_events, magnetic_field_grid, &obstacle_grid, true, event_block);
+    }else{
+      simulate_block(block_events, magnetic_field_grid, nullptr, &obstacle_grid, beam_integrator, rk45_tolerance, integrator_dtau, event_block);
+    }
+  };
+  vector<int> thread_counts;
+  for(int n_threads = 1; n_threads < thread_limit; n_threads *= 2){
+    thread_counts.push_back(n_threads);
+  }
+  thread_counts.push_back(thread_limit);
+  vector<ThroughputResult> macro;
+  for(int n_events = 1000; n_events <= options.max_events; n_events *= 10){
+    for(auto n_threads:thread_counts){
+      macro.push_back(benchmark_throughput(n_events, n_threads, seed, repetitions, simulate));
+    }
+  }
+
+  char host[256] = "";
+  gethostname(host, sizeof(host) - 1);
+  char date[32];
+  const std::time_t now = std::time(nullptr);
+  std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+  std::FILE* json = std::fopen(options.output, "w");
+  if(json == nullptr){
+    std::cerr << "cannot write " << options.output << std::endl;
+    delete magnetic_field_grid;
+    return;
+  }
+  std::fprintf(json, "{\n  \"label\": %s,\n  \"date\": \"%s\",\n  \"host\": %s,\n", json_string(options.label).c_str(), date, json_string(host).c_str());
+  const BatchRK4::Gathers gathers = BatchRK4::available_gathers();
+  const char* batch_gathers = gathers == BatchRK4::Gathers::AVX512 ? "avx512" : gathers == BatchRK4::Gathers::AVX2 ? "avx2" : "none";
+  std::fprintf(json, "  \"hardware_threads\": %d,\n  \"batch_gathers\": \"%s\",\n  \"integrator\": \"%s\",\n  \"seed\": %u,\n  \"events_per_block\": %d,\n  \"repetitions\": %d,\n",
+               hardware_threads, batch_gathers, integrator.Data(), seed, events_per_block, repetitions);
+  std::fprintf(json, "  \"micro\": [\n");
+  for(size_t i = 0; i < micro.size(); i++){
+    const double ns = 1e9 / micro[i].operations;
+    std::fprintf(json, "    {\"name\": \"%s\", \"operations\": %lld, \"median_ns_per_operation\": %.4g, \"min_ns_per_operation\": %.4g, \"max_ns_per_operation\": %.4g}%s\n",
+                 micro[i].name.c_str(), micro[i].operations, micro[i].seconds.median * ns, micro[i].seconds.min * ns, micro[i].seconds.max * ns, i + 1 < micro.size() ? "," : "");
+  }
+  std::fprintf(json, "  ],\n  \"throughput\": [\n");
+  for(size_t i = 0; i < macro.size(); i++){
+    const Timing& seconds = macro[i].seconds;
+    std::fprintf(json, "    {\"events\": %d, \"threads\": %d, \"median_seconds\": %.4g, \"min_seconds\": %.4g, \"max_seconds\": %.4g, \"steps\": %lld, \"events_per_second\": %.4g, \"steps_per_second\": %.4g}%s\n",
+                 macro[i].n_events, macro[i].n_threads, seconds.median, seconds.min, seconds.max, macro[i].steps, macro[i].n_events / seconds.median, macro[i].steps / seconds.median, i + 1 < macro.size() ? "," : "");
+  }
+  std::fprintf(json, "  ]\n}\n");
+  std::fclose(json);
+  std::cout << "written to " << options.output << std::endl;
+
+  delete magnetic_field_grid;
+}
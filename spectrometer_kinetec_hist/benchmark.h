@@ -0,0 +1,33 @@
+#ifndef RUNGE_BENCHMARK_H
+#define RUNGE_BENCHMARK_H
+
+#include "TString.h"
+
+// What benchmark is asked to do, see there; as with KineticHistOptions these are the only
+// defaults, e.g. in ROOT
+//   benchmark({"benchmark.json", "rk4", "my change"})
+struct BenchmarkOptions {
+  TString output = "benchmark.json";
+  TString integrator = "rk4"; // as for spectrometer_kinetic_hist
+  TString label = "";
+  unsigned int seed = 65539;
+  int max_events = 10000;
+  int max_threads = 0;
+  int repetitions = 5;
+
+  // visit(name, member) for every member, in order
+  template <class Visit>
+  void visit(Visit&& visit){
+    visit("output", output);
+    visit("integrator", integrator);
+    visit("label", label);
+    visit("seed", seed);
+    visit("max_events", max_events);
+    visit("max_threads", max_threads);
+    visit("repetitions", repetitions);
+  }
+};
+
+void benchmark(const BenchmarkOptions& options = BenchmarkOptions());
+
+#endif
@@ -1,23 +1,254 @@
-void build_hist(){
-  TFile* beta_file = TFile::Open("beta_file.root");
-  auto beta_tree = beta_file->Get<TTree>("beta_tree");
+#include <atomic>
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
 
-  //create image of all event
-  TCanvas* c_all = new TCanvas("c_all", "All");
+#include "TCanvas.h"
+#include "TFile.h"
+#include "TH1D.h"
+#include "TLegend.h"
+#include "TROOT.h"
+#include "TString.h"
+#include "TStyle.h"
+#include "TTree.h"
 
-  TH1F* e_KE_all = new TH1F("e_KE_all", "e_E;Energy [eV];event/bin", 100, 0, 5000000);
-  beta_tree->Draw("e_KE>>e_KE_all");
+#include "../tracker/units.h"
 
-  c_all->SaveAs("all_histogram.png");
+using std::vector;
 
-  delete c_all;
+const long long hist_task_entries = 1 << 18; // most entries of beta_tree a worker reads at a time
+const char* spectra_file_name = "spectra.root"; // beta_file.root may link into the cache and is only read
+const int any_anihilation_type = -1;
 
-  //create image of detected event
-  TCanvas* c_detected = new TCanvas("c_detected", "Detected");
-  
-  TH1F* e_KE_detected = new TH1F("e_KE_detected", "e_KE detected;Energy [eV];event/bin", 100, 0, 3000000);
-  beta_tree->Draw("e_KE>>e_KE_detected", "e_anihilation_type == 1", "same");
-  e_KE_detected->Fit("gaus");
+// one spectrum of beta_tree: the weighted events of one anihilation_type, or of all, in bins of
+// e_KE or e_E
+struct Spectrum {
+  TString name;
+  TString title;
+  bool kinetic; // e_KE, or e_E
+  int anihilation_type; // any_anihilation_type for all events
+  int bins;
+  double min, max; // eV
+};
+
+// sums of the weights and of their squares per bin, underflow and overflow included
+struct SpectrumSums {
+  vector<double> weights, squares;
+
+  void fill(const Spectrum& spectrum, const double value, const double weight);
+  void add(const SpectrumSums& other);
+};
+
+void SpectrumSums::fill(const Spectrum& spectrum, const double value, const double weight){
+  if(weights.empty()){
+    weights.assign(spectrum.bins + 2, 0);
+    squares.assign(spectrum.bins + 2, 0);
+  }
+  // as TAxis::FindFixBin
+  int bin = 0;
+  if(!(value < spectrum.max)){
+    bin = spectrum.bins + 1;
+  }else if(value >= spectrum.min){
+    bin = 1 + std::min(static_cast<int>(spectrum.bins * (value - spectrum.min) / (spectrum.max - spectrum.min)), spectrum.bins - 1);
+  }
+  weights[bin] += weight;
+  squares[bin] += weight * weight;
+}
+
+void SpectrumSums::add(const SpectrumSums& other){
+  if(weights.empty()){
+    *this = other;
+    return;
+  }
+  for(size_t bin = 0; bin < other.weights.size(); bin++){
+    weights[bin] += other.weights[bin];
+    squares[bin] += other.squares[bin];
+  }
+}
+
+// what one worker found in a range of entries
+struct PassSums {
+  vector<SpectrumSums> spectra; // as the spectra given to the pass
+  std::map<int, SpectrumSums> by_type; // e_KE per anihilation_type met
+  std::map<int, long long> entries_by_type;
+  long long entries = 0;
+  bool done = false;
+
+  void add(const PassSums& other);
+};
+
+void PassSums::add(const PassSums& other){
+  spectra.resize(std::max(spectra.size(), other.spectra.size()));
+  for(size_t spectrum = 0; spectrum < other.spectra.size(); spectrum++){
+    spectra[spectrum].add(other.spectra[spectrum]);
+  }
+  for(auto& type:other.by_type){
+    by_type[type.first].add(type.second);
+  }
+  for(auto& type:other.entries_by_type){
+    entries_by_type[type.first] += type.second;
+  }
+  entries += other.entries;
+}
+
+// entry ranges of at most hist_task_entries, cut at the clusters of the tree so that two workers
+// rarely read the same basket
+vector<std::pair<long long, long long>> entry_tasks(TTree* tree){
+  vector<std::pair<long long, long long>> tasks;
+  const long long n_entries = tree->GetEntries();
+  auto clusters = tree->GetClusterIterator(0);
+  for(long long start = clusters.Next(); start < n_entries; start = clusters.Next()){
+    const long long end = std::min(clusters.GetNextEntry(), n_entries);
+    for(long long first = start; first < end; first += hist_task_entries){
+      tasks.push_back({first, std::min(first + hist_task_entries, end)});
+    }
+  }
+  return tasks;
+}
+
+// Reads beta_tree of file_name once, on n_threads workers each with a file of its own, and sums
+// spectra and the e_KE of every anihilation_type, bins as spectrum_type gives them. The ranges are
+// added up in entry order, so the sums do not depend on n_threads
+PassSums fill_spectra(const char* file_name, const vector<Spectrum>& spectra, const Spectrum& spectrum_type, const int n_threads){
+  TFile* file = TFile::Open(file_name);
+  if(file == nullptr || file->Get<TTree>("beta_tree") == nullptr){
+    std::cerr << "no beta_tree in " << file_name << std::endl;
+    delete file;
+    return PassSums();
+  }
+  const vector<std::pair<long long, long long>> tasks = entry_tasks(file->Get<TTree>("beta_tree"));
+  // trees written before importance sampling have no weights
+  const bool weighted = file->Get<TTree>("beta_tree")->GetBranch("e_weight") != nullptr;
+  file->Close();
+  delete file;
+
+  ROOT::EnableThreadSafety();
+
+  vector<PassSums> task_sums(tasks.size());
+  PassSums total;
+  size_t merged_tasks = 0;
+  std::mutex merge_mutex;
+  std::atomic<size_t> next_task(0);
+  auto worker = [&](){
+    TFile* worker_file = TFile::Open(file_name);
+    TTree* beta_tree = worker_file->Get<TTree>("beta_tree");
+    double e_E = 0, e_KE = 0, e_weight = 1;
+    int e_anihilation_type = 0;
+    beta_tree->SetBranchStatus("*", false);
+    for(auto branch:{"e_E", "e_KE", "e_anihilation_type"}){
+      beta_tree->SetBranchStatus(branch, true);
+    }
+    beta_tree->SetBranchAddress("e_E", &e_E);
+    beta_tree->SetBranchAddress("e_KE", &e_KE);
+    beta_tree->SetBranchAddress("e_anihilation_type", &e_anihilation_type);
+    if(weighted){
+      beta_tree->SetBranchStatus("e_weight", true);
+      beta_tree->SetBranchAddress("e_weight", &e_weight);
+    }
+
+    for(size_t task = next_task++; task < tasks.size(); task = next_task++){
+      PassSums& sums = task_sums[task];
+      sums.spectra.resize(spectra.size());
+      for(long long entry = tasks[task].first; entry < tasks[task].second; entry++){
+        beta_tree->GetEntry(entry);
+        for(size_t spectrum = 0; spectrum < spectra.size(); spectrum++){
+          if(spectra[spectrum].anihilation_type == any_anihilation_type || spectra[spectrum].anihilation_type == e_anihilation_type){
+            sums.spectra[spectrum].fill(spectra[spectrum], spectra[spectrum].kinetic ? e_KE : e_E, e_weight);
+          }
+        }
+        sums.by_type[e_anihilation_type].fill(spectrum_type, e_KE, e_weight);
+        sums.entries_by_type[e_anihilation_type]++;
+        sums.entries++;
+      }
+      // every range finished in order so far goes into the total
+      std::lock_guard<std::mutex> lock(merge_mutex);
+      sums.done = true;
+      while(merged_tasks < tasks.size() && task_sums[merged_tasks].done){
+        total.add(task_sums[merged_tasks]);
+        task_sums[merged_tasks] = PassSums();
+        merged_tasks++;
+      }
+    }
+    worker_file->Close();
+    delete worker_file;
+  };
+  vector<std::thread> workers;
+  for(int i = 0; i < std::max(n_threads, 1); i++){
+    workers.emplace_back(worker);
+  }
+  for(auto& worker_thread:workers){
+    worker_thread.join();
+  }
+  total.spectra.resize(spectra.size());
+  return total;
+}
+
+TH1D* spectrum_histogram(const Spectrum& spectrum, const SpectrumSums& sums, const long long entries){
+  TH1D* histogram = new TH1D(spectrum.name, spectrum.title, spectrum.bins, spectrum.min, spectrum.max);
+  histogram->Sumw2();
+  for(size_t bin = 0; bin < sums.weights.size(); bin++){
+    histogram->SetBinContent(bin, sums.weights[bin]);
+    histogram->SetBinError(bin, std::sqrt(sums.squares[bin]));
+  }
+  histogram->ResetStats(); // mean and width from the bins
+  histogram->SetEntries(entries);
+  return histogram;
+}
+
+// The e_KE and e_E spectra of all and of detected events, and e_KE per anihilation_type, from one
+// pass over beta_tree on n_threads workers; written to spectra.root and drawn.
+// bins per spectrum, all_max and detected_max the upper ends in eV of the kinetic energy
+// spectra of all and of detected events (e_E spectra start at mass_e); fit is the function the
+// detected spectra are fitted with, none if empty.
+// events are weighted by e_weight, 1 unless the source was importance sampled or when the tree has
+// no e_weight. beta_file.root is only read: spectrometer_kinetic_hist may have linked it into its
+// cache, whose entries must stay as that run left them
+void build_hist(const int n_threads = 1, const int bins = 100, const double all_max = 5 * unit::M, const double detected_max = 3 * unit::M, const char* fit = "gaus"){
+  const int detected = 1;
+  const vector<Spectrum> spectra = {
+    {"e_KE_all", "e_KE;Energy [eV];event/bin", true, any_anihilation_type, bins, 0, all_max},
+    {"e_KE_detected", "e_KE detected;Energy [eV];event/bin", true, detected, bins, 0, detected_max},
+    {"e_E_all", "e_E;Energy [eV];event/bin", false, any_anihilation_type, bins, mass_e, mass_e + all_max},
+    {"e_E_detected", "e_E detected;Energy [eV];event/bin", false, detected, bins, mass_e, mass_e + detected_max},
+  };
+  const Spectrum spectrum_type = {"e_KE_type", "e_KE by anihilation_type;Energy [eV];event/bin", true, any_anihilation_type, bins, 0, all_max};
+
+  const PassSums sums = fill_spectra("beta_file.root", spectra, spectrum_type, n_threads);
+  if(sums.entries == 0){
+    std::cerr << "no events in beta_file.root" << std::endl;
+    return;
+  }
+
+  TFile* spectra_file = new TFile(spectra_file_name, "RECREATE");
+  vector<TH1D*> histograms;
+  for(size_t spectrum = 0; spectrum < spectra.size(); spectrum++){
+    const int type = spectra[spectrum].anihilation_type;
+    long long entries = sums.entries;
+    if(type != any_anihilation_type){
+      entries = sums.entries_by_type.count(type) != 0 ? sums.entries_by_type.at(type) : 0;
+    }
+    histograms.push_back(spectrum_histogram(spectra[spectrum], sums.spectra[spectrum], entries));
+  }
+  TH1D* e_KE_all = histograms[0];
+  TH1D* e_KE_detected = histograms[1];
+  vector<TH1D*> type_histograms;
+  for(auto& type:sums.by_type){
+    Spectrum spectrum = spectrum_type;
+    spectrum.name = Form("e_KE_type%d", type.first);
+    spectrum.title = Form("e_KE of anihilation_type %d;Energy [eV];event/bin", type.first);
+    spectrum.anihilation_type = type.first;
+    type_histograms.push_back(spectrum_histogram(spectrum, type.second, sums.entries_by_type.at(type.first)));
+  }
+  if(fit != nullptr && fit[0] != 0){
+    for(size_t spectrum = 0; spectrum < spectra.size(); spectrum++){
+      if(spectra[spectrum].anihilation_type == detected && histograms[spectrum]->GetEntries() > 0){
+        histograms[spectrum]->Fit(fit, "Q");
+      }
+    }
+  }
 
   gStyle->SetStatX(0.87);
   gStyle->SetStatY(0.87);
@@ -25,24 +256,58 @@ void build_hist(){
   gStyle->SetStatW(0.20);
   gStyle->SetOptFit();
 
+  //create image of all event
+  TCanvas* c_all = new TCanvas("c_all", "All");
+  e_KE_all->Draw("HIST");
+  c_all->SaveAs("all_histogram.png");
 
-
+  //create image of detected event
+  TCanvas* c_detected = new TCanvas("c_detected", "Detected");
+  e_KE_detected->Draw();
   c_detected->SaveAs("detected_histogram.png");
 
-  delete c_detected;
-  delete e_KE_detected;
-
-  //create image comparing histogram
+  //create image comparing histogram: all events scaled to the peak of the detected ones
   TCanvas* c_compare = new TCanvas("c_compare", "Compare");
-
-  e_KE_all->SetAxisRange(0, 3000000, "X");
-  beta_tree->Draw("e_KE>>e_KE_all");
-  e_KE_all->SetLineColor(kRed);
-  beta_tree->Draw("e_KE>>e_KE_detected", "e_anihilation_type == 1", "same");
-  e_KE_all->Scale(e_KE_detected->GetBinContent(e_KE_detected->GetMaximumBin())/e_KE_all->GetBinContent(e_KE_all->GetMaximumBin()));
-
+  TH1D* e_KE_all_scaled = static_cast<TH1D*>(e_KE_all->Clone("e_KE_all_scaled"));
+  e_KE_all_scaled->SetDirectory(nullptr);
+  e_KE_all_scaled->SetAxisRange(0, detected_max, "X");
+  const double all_peak = e_KE_all_scaled->GetBinContent(e_KE_all_scaled->GetMaximumBin());
+  if(all_peak > 0){
+    e_KE_all_scaled->Scale(e_KE_detected->GetBinContent(e_KE_detected->GetMaximumBin()) / all_peak);
+  }
+  e_KE_all_scaled->SetLineColor(kRed);
+  e_KE_all_scaled->SetStats(false);
+  e_KE_all_scaled->Draw("HIST");
+  e_KE_detected->Draw("SAME");
   c_compare->SaveAs("compare_histogram.png");
 
+  //create image of every anihilation_type
+  TCanvas* c_type = new TCanvas("c_type", "By anihilation_type");
+  TLegend* legend = new TLegend(0.65, 0.7, 0.87, 0.87);
+  for(size_t type = 0; type < type_histograms.size(); type++){
+    type_histograms[type]->SetLineColor(static_cast<Color_t>(type + 1));
+    type_histograms[type]->SetStats(false);
+    type_histograms[type]->Draw(type == 0 ? "HIST" : "HIST SAME");
+    legend->AddEntry(type_histograms[type], type_histograms[type]->GetName(), "l");
+  }
+  legend->Draw();
+  c_type->SaveAs("anihilation_type_histogram.png");
+
+  delete c_all;
+  delete c_detected;
   delete c_compare;
+  delete c_type;
+  delete e_KE_all_scaled;
 
-}
\ No newline at end of file
+  // the histograms belong to spectra_file, which deletes them on closing
+  spectra_file->cd();
+  for(auto histogram:histograms){
+    histogram->Write("", TObject::kOverwrite);
+  }
+  for(auto histogram:type_histograms){
+    histogram->Write("", TObject::kOverwrite);
+  }
+  std::cout << sums.entries << " events in " << histograms.size() + type_histograms.size() << " spectra" << std::endl;
+  spectra_file->Close();
+  delete spectra_file;
+}
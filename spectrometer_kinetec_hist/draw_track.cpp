@@ -0,0 +1,39 @@
+#include <iostream>
+#include <vector>
+
+#include "TCanvas.h"
+#include "TFile.h"
+#include "TH2D.h"
+
+#include "../tracker/track_graph.h"
+#include "../tracker/track_store.h"
+
+using std::vector;
+
+// draws n_tracks stored tracks from first_event on over the field, without re-simulating them
+void draw_track(const long long first_event = 0, const long long n_tracks = 1){
+  TrackReader track_reader("beta_tracks.trk");
+  if(!track_reader.is_open()){
+    std::cerr << "cannot read beta_tracks.trk" << std::endl;
+    return;
+  }
+
+  TCanvas* c_track = new TCanvas("c_track", "Track");
+
+  TFile* file = TFile::Open("mfield.root");
+  auto MagneticField = file->Get<TH2D>("MagneticField"); //mTesla
+  MagneticField->Draw("COLZ");
+
+  vector<double> points;
+  for(long long event = first_event; event < first_event + n_tracks; event++){
+    if(!track_reader.read(event, points)){
+      std::cerr << "no track for event " << event << std::endl;
+      continue;
+    }
+    track_graph(points)->Draw("SAME");
+  }
+
+  c_track->SaveAs(Form("track_%lld.png", first_event));
+
+  delete c_track;
+}
\ No newline at end of file
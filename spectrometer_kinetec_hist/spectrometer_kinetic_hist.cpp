@@ -1,246 +1,1519 @@
-using LorentzX = ROOT::Math::XYZTVector;
-using LorentzP = ROOT::Math::PxPyPzEVector;
-using LorentzP_M = ROOT::Math::PxPyPzMVector;
-
-const double c = 300 * 1000 * 1000; // m/s
-const double Tesla = c; // eV/m
-const double second = c; // m
-
-namespace unit {
-  const double n = 0.001 * 0.001 * 0.001;
-  const double micro = 0.001 * 0.001;
-  const double m = 0.001;
-  const double c = 0.01;
-  const double k = 1000;
-  const double M = 1000 * 1000;
-  const double G = 1000 * 1000 * 1000;
-}
-
-const double mass_e = 511 * unit::k; // eV
-const double charge_e = -1; // e = 1
-const double momentum = 1 * unit::M; // eV
-
-const double tau_final = 1 * unit::n * second; // m
-const double dtau = 0.001 * unit::n * second; // m
-
-const double edge_margin = 0.005;
-
-class DrainRectangle;
-
-class BeamRK4 {
-  public:
-    BeamRK4(const LorentzX, const LorentzP_M, const double, TH2D*, const double, const double);
-    void step_RK4();
-    void plot_orbit_point();
-    void set_magnetic_unit(const double magnetic_unit);
-    void set_length_unit(const double length_unit);
-    void add_drain_rectangle(DrainRectangle*);
-    bool is_anihilated();
-
-    LorentzX x;
-    LorentzP p;
-
-    const double charge;
-    
-    TH2D* magnetic_field;
-    double magnetic_field_unit = 1.0; //c*eV/m
-    double length_unit = 1.0; // m
-
-    vector<DrainRectangle*> drain_rectangles;
-
-    TGraph* orbit;
-    int tau_index = 0;
-    const double dtau;
-    const double tau_final;
-    int anihilation_type = 0;
-
-  private:
-    LorentzX get_dx(const LorentzP p);
-    LorentzP get_dp(const LorentzX x, const LorentzP p);
-};
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+
+#include "TCanvas.h"
+#include "TChain.h"
+#include "TFile.h"
+#include "TH2D.h"
+#include "TParameter.h"
+#include "TROOT.h"
+#include "TString.h"
+#include "TTree.h"
+
+#include "../tracker/batch_rk4.h"
+#include "../tracker/beam_rk4.h"
+#include "../tracker/bounded_queue.h"
+#include "../tracker/content_hash.h"
+#include "../tracker/counter_random.h"
+#include "../tracker/drain_rectangle.h"
+#include "../tracker/field_grid_3d.h"
+#include "../tracker/field_region_map.h"
+#include "../tracker/importance_source.h"
+#include "../tracker/magnetic_field_grid.h"
+#include "../tracker/obstacle_grid.h"
+#include "../tracker/track_graph.h"
+#include "../tracker/track_raster.h"
+#include "../tracker/track_store.h"
+#include "../tracker/units.h"
+
+#include "spectrometer_kinetic_hist.h"
+
+using std::vector;
+
+const double boris_tolerance = 1 * unit::micro; // m, how far Boris end points may be from those of RK4 at dtau, see boris_step
+const double boris_max_dtau = 16 * dtau; // the longest Boris step tried
+
+const double region_tolerance = 1e-4; // field-free / uniform cells, relative to the largest |B|
+
+const int first_track_events = 10000;
+const int blocks_in_flight_per_thread = 4; // how far workers may run ahead of the merge
+const int blocks_queued_per_thread = 1; // finished blocks a worker may leave to the writer before it waits
+const int checkpoint_interval = 50; // blocks between checkpoints of beta_file.root
+
+const int track_stride = 10; // every track_stride-th point of a track is stored and drawn
+const double track_quantum = 10 * unit::micro; // m
+const int max_graph_tracks = 100000; // tracks drawn as graphs on a canvas without density_rendering, see TrackGraphs
+const int raster_subdivision = 4; // density map pixels per field bin, each way
+
+const int pilot_events = 20000; // nominal events that map the acceptance for importance sampling
+const int pilot_first_block = 1 << 22; // the pilot events draw from block 4194304 on, beyond any main run
+const double acceptance_momentum_max = 6 * momentum; // eV
+const int acceptance_momentum_bins = 60;
+const int acceptance_angle_bins = 90;
+const int acceptance_margin = 1; // cells added around the detected ones
+const double importance_fraction = 0.9; // of the events drawn from the accepting cells
+
+const int backward_face_points = 20; // across the detector face
+const int backward_directions = 45; // over the half plane in front of the face
+const double backward_capture_radius = 1 * unit::m; // m, around the source point
+
+// e_termination, why an electron stopped: 0, 1, ... is the index of the DrainRectangle it hit,
+// in the order of spectrometer_drain_rectangles, or one of
+const int termination_time_limit = -1; // tau_final reached
+const int termination_edge = -2; // within edge_margin of the edge of the field map
+
+int termination(const int obstacle, const double tau){
+  if(obstacle >= 0){
+    return obstacle;
+  }
+  return tau >= tau_final ? termination_time_limit : termination_edge;
+}
+
+double seconds_since(const std::chrono::steady_clock::time_point start){
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// the events of one block. Every event draws from its own Philox counter, keyed by the seed,
+// so a block gives the same electrons whichever thread simulates it.
+// With importance, an event comes from the accepting cells with probability importance->fraction
+// and from the nominal source otherwise. The nominal momentum has mean and width momentum_mean.
+// With a vertical_angle (rad) the direction leaves the plane by up to that much, isotropically,
+// from a draw of its own, so the in-plane angle and the importance weight are those of the plane
+vector<SourceEvent> source_events(const int block, const int n_block_events, const unsigned int seed, const ImportanceSource* importance, const double momentum_mean, const double vertical_angle){
+  const long long first_event = (long long)block * events_per_block;
+  vector<double> momentum_amounts(n_block_events), angles(n_block_events), selectors(n_block_events), verticals(n_block_events, 0.5);
+  sample_source(seed, first_event, n_block_events, momentum_mean, momentum_mean, momentum_amounts.data(), angles.data(), importance != nullptr ? selectors.data() : nullptr);
+  if(vertical_angle > 0){
+    sample_uniform(seed, first_event, n_block_events, vertical_draw, verticals.data());
+  }
+
+  vector<SourceEvent> events;
+  events.reserve(n_block_events);
+
+  for(int i = 0; i < n_block_events; i++){
+    double momentum_amount = momentum_amounts[i];
+    double angle = angles[i];
+    if(importance != nullptr && selectors[i] < importance->fraction){
+      CounterUniform uniform(seed, first_event + i);
+      importance->sample_region(uniform, momentum_amount, angle);
+    }
+    const double weight = importance != nullptr ? importance->weight(momentum_amount, angle) : 1;
+    const double sin_vertical = TMath::Sin(vertical_angle) * (2 * verticals[i] - 1);
+    const double in_plane = momentum_amount * TMath::Sqrt(1 - sin_vertical * sin_vertical);
+    events.push_back({{{in_plane * TMath::Cos(angle), in_plane * TMath::Sin(angle)}}, weight, momentum_amount, angle, momentum_amount * sin_vertical});
+  }
+  return events;
+}
+
+// the same block pushed through BatchRK4, which gives the same electrons as BeamRK4 with RK4.
+// Without keep_orbits the records have no orbit, which spares the batch its per-lane bookkeeping
+// where only the end points are wanted.
+// The lanes run interleaved, so with timed every event gets the mean wall time of the block
+void simulate_block_batch(const vector<SourceEvent>& events, const MagneticFieldGrid* magnetic_field, const ObstacleGrid* obstacles, const bool keep_orbits, EventBlock& event_block, const bool timed){
+  const auto start = timed ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+
+  BatchRK4 batch_RK4(magnetic_field, charge_e, dtau, tau_final, edge_margin);
+  batch_RK4.set_keep_orbits(keep_orbits);
+  batch_RK4.set_obstacles(obstacles);
+
+  event_block.records.resize(events.size());
+  size_t next_event = 0;
+  auto next_particle = [&](BatchParticle& particle){
+    if(next_event == events.size()){
+      return false;
+    }
+    const SpaceVector<2>& initial_momentum = events[next_event].momentum;
+    particle = {(long long)next_event, source_x, source_y, initial_momentum.X(), initial_momentum.Y(), mass_e};
+    next_event++;
+    return true;
+  };
+  auto retire = [&](const BatchResult& result, const vector<double>& orbit){
+    const double initial_KE = kinetic_energy_of(events[result.event].momentum.mag2(), mass_e);
+    event_block.records[result.event] = {result.e_E, result.e_KE, result.anihilation_type, events[result.event].weight, orbit, (result.e_KE - initial_KE) / initial_KE,
+                                         result.steps, 0, 4LL * result.steps, termination(result.obstacle, result.tau)};
+  };
+  batch_RK4.run(next_particle, retire);
+  if(timed && !events.empty()){
+    const double wall_time = seconds_since(start) / events.size();
+    for(auto& record:event_block.records){
+      record.wall_time = wall_time;
+    }
+  }
+}
 
-class DrainRectangle{
-  public:
-    DrainRectangle(const double x1, const double x2, const double y1, const double y2, const double length_unit, const int anihilation_type)
-      : x1(x1), x2(x2), y1(y1), y2(y2), length_unit(length_unit), anihilation_type(anihilation_type){
-        tbox = new TBox(x1 / length_unit, y1 / length_unit, x2 / length_unit, y2 / length_unit);
-        tbox->SetFillStyle(3001);
-        tbox->SetFillColor(kRed);
+// The Boris push keeps |p| exactly but is of second order against the fourth of RK4: at the same
+// step it lands further off, and its error grows with the square of the step and with the
+// radius of the orbit. Its step is therefore measured on the map: the longest of boris_max_dtau,
+// half of it, ... whose end points stay within boris_tolerance of RK4 at dtau, for electrons of
+// half, once and twice source_momentum leaving the source in 16 directions through the field alone.
+// source_momentum is the nominal momentum of a run, the largest of a sweep
+template <int D>
+double boris_step(const typename TrackerSpace<D>::Field* magnetic_field, const double source_momentum){
+  SpaceVector<D> start = {};
+  start[0] = source_x;
+  start[1] = source_y;
+  vector<SpaceVector<D>> momenta, ends;
+  vector<double> end_taus;
+  for(const double scale:{0.5, 1.0, 2.0}){
+    for(int direction = 0; direction < 16; direction++){
+      const double angle = 2 * TMath::Pi() * (direction + 0.5) / 16;
+      SpaceVector<D> initial_momentum = {};
+      initial_momentum[0] = scale * source_momentum * TMath::Cos(angle);
+      initial_momentum[1] = scale * source_momentum * TMath::Sin(angle);
+      BeamTracker<D> reference(start, initial_momentum, mass_e, charge_e, magnetic_field, dtau, tau_final);
+      while(!reference.is_anihilated()){
+        reference.step();
       }
-    bool is_collided(BeamRK4* beam_RK4){
-      return (x1 <= beam_RK4->x.X() && beam_RK4->x.X() <= x2 && y1 <= beam_RK4->x.Y() && beam_RK4->x.Y() <= y2);
+      momenta.push_back(initial_momentum);
+      ends.push_back(reference.x);
+      end_taus.push_back(reference.tau);
+    }
+  }
+  double step = boris_max_dtau;
+  for(; step > dtau / 16; step /= 2){
+    double worst = 0;
+    for(size_t electron = 0; electron < momenta.size(); electron++){
+      BeamTracker<D> boris(start, momenta[electron], mass_e, charge_e, magnetic_field, step, end_taus[electron]);
+      boris.set_integrator(Integrator::Boris);
+      while(boris.tau < boris.tau_final){
+        boris.step();
+      }
+      worst = std::max(worst, (boris.x - ends[electron]).mag());
+    }
+    if(worst <= boris_tolerance){
+      break;
     }
+  }
+  return step;
+}
+// the midplane step benchmark asks for
+template double boris_step<2>(const TrackerSpace<2>::Field* magnetic_field, const double source_momentum);
+
+// integrator_dtau is the step of RK4 and Boris, see boris_step.
+// timed measures the wall time of every event; the clock is not read otherwise
+void simulate_block(const vector<SourceEvent>& events, const MagneticFieldGrid* magnetic_field, const FieldRegionMap* region_map, const ObstacleGrid* obstacles, const Integrator integrator, const double tolerance, const double integrator_dtau, EventBlock& event_block, const bool timed){
+  event_block.records.reserve(events.size());
+
+  for(auto& event:events){
+    const auto start = timed ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+    const SpaceVector<2> initial_coordinates = {{source_x, source_y}}; // m
+
+    BeamRK4 beam_RK4 = BeamRK4(initial_coordinates, event.momentum, mass_e, charge_e, magnetic_field, integrator_dtau, tau_final);
+    beam_RK4.set_integrator(integrator, tolerance);
+    beam_RK4.set_region_map(region_map);
+    beam_RK4.set_obstacles(obstacles);
+
+    beam_RK4.plot_orbit_point();
+
+    while(!beam_RK4.is_anihilated()){
+      beam_RK4.step();
+      beam_RK4.plot_orbit_point();
+    }
+    const int steps = beam_RK4.orbit.size() / 2 - 1;
+    event_block.records.push_back({beam_RK4.energy(), beam_RK4.kinetic_energy(), beam_RK4.anihilation_type, event.weight, std::move(beam_RK4.orbit), beam_RK4.energy_drift(),
+                                   steps, timed ? seconds_since(start) : 0, beam_RK4.field_evaluations, termination(beam_RK4.obstacle, beam_RK4.tau)});
+  }
+}
+
+// the same through a 3D map. The tracks are kept as their projection on the midplane, x, y pairs
+// as everywhere else, so the track store, the pictures and the step map stay as they are
+void simulate_block(const vector<SourceEvent>& events, const FieldGrid3D* magnetic_field, const ObstacleGrid* obstacles, const Integrator integrator, const double tolerance, const double integrator_dtau, EventBlock& event_block, const bool timed = false){
+  event_block.records.reserve(events.size());
+
+  for(auto& event:events){
+    const auto start = timed ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+    const SpaceVector<3> initial_coordinates = {{source_x, source_y, 0}}; // m
+    const SpaceVector<3> initial_momentum = {{event.momentum.X(), event.momentum.Y(), event.momentum_z}}; // eV/c
+
+    BeamRK4_3D beam_RK4(initial_coordinates, initial_momentum, mass_e, charge_e, magnetic_field, integrator_dtau, tau_final);
+    beam_RK4.set_integrator(integrator, tolerance);
+    beam_RK4.set_obstacles(obstacles);
+
+    beam_RK4.plot_orbit_point();
 
-    const double x1, x2, y1, y2;
-    double length_unit;
-    TBox* tbox;
-    const int anihilation_type;
+    while(!beam_RK4.is_anihilated()){
+      beam_RK4.step();
+      beam_RK4.plot_orbit_point();
+    }
+    const int steps = beam_RK4.orbit.size() / 3 - 1;
+    vector<double> orbit(2 * (steps + 1));
+    for(int point = 0; point <= steps; point++){
+      orbit[2 * point] = beam_RK4.orbit[3 * point];
+      orbit[2 * point + 1] = beam_RK4.orbit[3 * point + 1];
+    }
+    event_block.records.push_back({beam_RK4.energy(), beam_RK4.kinetic_energy(), beam_RK4.anihilation_type, event.weight, std::move(orbit), beam_RK4.energy_drift(),
+                                   steps, timed ? seconds_since(start) : 0, beam_RK4.field_evaluations, termination(beam_RK4.obstacle, beam_RK4.tau)});
+  }
+}
+
+const char* field_file_name = "mfield.root";
+const char* field_cache_name = "mfield.cache";
+const char* field_3d_file_name = "mfield3d.root"; // Bx, By and Bz over the gap, where it was measured
+
+// mfield.root converted once into mfield.cache, see MagneticFieldGrid::write_cache
+void make_field_cache(){
+  TFile* file = TFile::Open(field_file_name);
+  auto MagneticField = file->Get<TH2D>("MagneticField"); //mTesla
+  const MagneticFieldGrid magnetic_field_grid(MagneticField, unit::c, unit::m * Tesla);
+  if(!magnetic_field_grid.write_cache(field_cache_name, field_file_name)){
+    std::cerr << "cannot write " << field_cache_name << std::endl;
+  }
+  file->Close();
+  delete file;
+}
+
+// the field of mfield.root, mapped from mfield.cache. A missing or stale cache is made again first
+MagneticFieldGrid* open_magnetic_field(){
+  MagneticFieldGrid* magnetic_field_grid = new MagneticFieldGrid(field_cache_name);
+  if(magnetic_field_grid->is_open() && magnetic_field_grid->is_current(field_file_name)
+     && magnetic_field_grid->length_unit == unit::c && magnetic_field_grid->magnetic_field_unit == unit::m * Tesla){
+    return magnetic_field_grid;
+  }
+  delete magnetic_field_grid;
+  make_field_cache();
+  magnetic_field_grid = new MagneticFieldGrid(field_cache_name);
+  if(magnetic_field_grid->is_open()){
+    return magnetic_field_grid;
+  }
+  // no cache to be had, e.g. in a read-only directory
+  delete magnetic_field_grid;
+  TFile* file = TFile::Open(field_file_name);
+  magnetic_field_grid = new MagneticFieldGrid(file->Get<TH2D>("MagneticField"), unit::c, unit::m * Tesla);
+  file->Close();
+  delete file;
+  return magnetic_field_grid;
+}
+
+// Bx, By and Bz of mfield3d.root (cm, mT) if there is one, otherwise the expansion of the
+// midplane map over the gap, z from -field_half_height to field_half_height
+FieldGrid3D* open_magnetic_field_3d(const MagneticFieldGrid& midplane){
+  struct stat status;
+  if(stat(field_3d_file_name, &status) != 0){
+    return new FieldGrid3D(midplane, -field_half_height, field_half_height, field_nz);
+  }
+  TFile* file = TFile::Open(field_3d_file_name);
+  FieldGrid3D* magnetic_field_grid = new FieldGrid3D(file->Get<TH3D>("MagneticFieldX"), file->Get<TH3D>("MagneticFieldY"), file->Get<TH3D>("MagneticFieldZ"), unit::c, unit::m * Tesla);
+  file->Close();
+  delete file;
+  return magnetic_field_grid;
+}
+
+// the collimators and the detector (anihilation_type 1); gap in metres between the jaws of
+// each collimator, detector_front the x of the face of the detector in metres
+DrainRectangles spectrometer_drain_rectangles(const double gap, const double detector_front){
+  const double cm = unit::c;
+  const double gap_centre = -1 * cm;
+  DrainRectangles drain_rectangles;
+  drain_rectangles.emplace_back(new DrainRectangle(-2 * cm, gap_centre - gap / 2, 3 * cm, 4 * cm, cm, 0)); // top collimator, left
+  drain_rectangles.emplace_back(new DrainRectangle(gap_centre + gap / 2, 0 * cm, 3 * cm, 4 * cm, cm, 0)); // top collimator, right
+
+  drain_rectangles.emplace_back(new DrainRectangle(3 * cm, 4 * cm, gap_centre + gap / 2, 0 * cm, cm, 0)); // side collimator, top
+  drain_rectangles.emplace_back(new DrainRectangle(3 * cm, 4 * cm, -2 * cm, gap_centre - gap / 2, cm, 0)); // side collimator, bottom
+
+  drain_rectangles.emplace_back(new DrainRectangle(detector_front, detector_front + 0.5 * cm, -1.5 * cm, -0.5 * cm, cm, 1)); // detector
+  drain_rectangles.back()->tbox->SetFillColor(kGreen);
+
+  return drain_rectangles;
+}
+
+// Acceptance mapped backwards from the detector. Electrons leave the face of the detector
+// towards the collimators from a grid of points and directions, with charge and momentum
+// reversed: dp/dtau = q p x B / m is unchanged by tau -> -tau, p -> -p, q -> -q, so they retrace
+// forward tracks that end on the detector. The ones passing within backward_capture_radius of
+// the source give the momentum and emission angle of a detected forward electron.
+// One momentum per cell of the AcceptanceMap, written to acceptance.root
+void backward_acceptance(const int n_threads = 1){
+  const MagneticFieldGrid* magnetic_field_grid = open_magnetic_field();
+
+  // the backward electrons start on the detector, so only the collimators stop them
+  const DrainRectangles drain_rectangles = spectrometer_drain_rectangles();
+  ObstacleGrid obstacle_grid(magnetic_field_grid->x_min, magnetic_field_grid->x_max, magnetic_field_grid->y_min, magnetic_field_grid->y_max, magnetic_field_grid->nx, magnetic_field_grid->ny);
+  DrainRectangle* detector = nullptr;
+  for(auto& drain_rectangle:drain_rectangles){
+    if(drain_rectangle->anihilation_type == 1){
+      detector = drain_rectangle.get();
+    }else{
+      obstacle_grid.add_rectangle(drain_rectangle->x1, drain_rectangle->x2, drain_rectangle->y1, drain_rectangle->y2, drain_rectangle->anihilation_type);
+    }
+  }
+
+  ROOT::EnableThreadSafety();
+
+  // emission angles that reach the detector, per momentum cell
+  vector<vector<double>> emission_angles(acceptance_momentum_bins);
+  std::atomic<int> next_bin(0);
+  auto worker = [&](){
+    for(int bin = next_bin++; bin < acceptance_momentum_bins; bin = next_bin++){
+      const double momentum_amount = (bin + 0.5) * acceptance_momentum_max / acceptance_momentum_bins;
+      for(int point = 0; point < backward_face_points; point++){
+        const double y = detector->y1 + (point + 0.5) * (detector->y2 - detector->y1) / backward_face_points;
+        for(int direction = 0; direction < backward_directions; direction++){
+          // forward electrons enter the face towards +x
+          const double incoming = -TMath::Pi() / 2 + (direction + 0.5) * TMath::Pi() / backward_directions;
+          const SpaceVector<2> start = {{detector->x1, y}};
+          const SpaceVector<2> reversed_momentum = {{-momentum_amount * TMath::Cos(incoming), -momentum_amount * TMath::Sin(incoming)}};
+
+          BeamRK4 beam_RK4 = BeamRK4(start, reversed_momentum, mass_e, -charge_e, magnetic_field_grid, dtau, tau_final);
+          beam_RK4.set_obstacles(&obstacle_grid);
+          while(!beam_RK4.is_anihilated()){
+            beam_RK4.step();
+            // closest point of the last step to the source
+            const double dx = beam_RK4.x.X() - beam_RK4.x_previous.X(), dy = beam_RK4.x.Y() - beam_RK4.x_previous.Y();
+            const double t = std::min(std::max(((source_x - beam_RK4.x_previous.X()) * dx + (source_y - beam_RK4.x_previous.Y()) * dy) / (dx * dx + dy * dy), 0.0), 1.0);
+            if(TMath::Hypot(beam_RK4.x_previous.X() + t * dx - source_x, beam_RK4.x_previous.Y() + t * dy - source_y) < backward_capture_radius){
+              const double angle = TMath::ATan2(-beam_RK4.p.Y(), -beam_RK4.p.X());
+              emission_angles[bin].push_back(angle < 0 ? angle + 2 * TMath::Pi() : angle);
+              break;
+            }
+          }
+        }
+      }
+    }
+  };
+  vector<std::thread> workers;
+  for(int i = 0; i < std::max(n_threads, 1); i++){
+    workers.emplace_back(worker);
+  }
+  for(auto& worker_thread:workers){
+    worker_thread.join();
+  }
+
+  AcceptanceMap acceptance_map(acceptance_momentum_max, acceptance_momentum_bins, acceptance_angle_bins);
+  int n_reached = 0;
+  for(int bin = 0; bin < acceptance_momentum_bins; bin++){
+    for(auto angle:emission_angles[bin]){
+      acceptance_map.fill((bin + 0.5) * acceptance_momentum_max / acceptance_momentum_bins, angle, true);
+      n_reached++;
+    }
+  }
+
+  TFile* acceptance_file = new TFile("acceptance.root", "RECREATE", "beta spectrometer backward acceptance");
+  TH2D* acceptance = new TH2D("acceptance", "backward tracks reaching the source;momentum [MeV/c];emission angle [rad]", acceptance_momentum_bins, 0, acceptance_momentum_max / unit::M, acceptance_angle_bins, 0, 2 * TMath::Pi());
+  int accepting_cells = 0;
+  for(int j = 0; j < acceptance_angle_bins; j++){
+    for(int i = 0; i < acceptance_momentum_bins; i++){
+      const long long detected = acceptance_map.detected[j * acceptance_momentum_bins + i];
+      acceptance->SetBinContent(i + 1, j + 1, detected);
+      accepting_cells += detected > 0;
+    }
+  }
+  std::cout << n_reached << " of " << acceptance_momentum_bins * backward_face_points * backward_directions << " backward tracks reached the source, " << accepting_cells << " accepting cells" << std::endl;
+
+  TCanvas* c_acceptance = new TCanvas("c_acceptance", "backward acceptance");
+  acceptance->Draw("COLZ");
+  c_acceptance->SaveAs("acceptance.png");
+
+  acceptance_file->Write();
+  acceptance_file->Close();
+
+  delete acceptance_file;
+  delete c_acceptance;
+  delete magnetic_field_grid;
+}
+
+// occupancy maps of one worker, in the order they are drawn
+struct TrackLayers {
+  TrackRaster all;
+  TrackRaster first; // the first first_track_events events
+  TrackRaster detected;
 };
 
-BeamRK4::BeamRK4(const LorentzX initial_x, const LorentzP_M initial_p, const double particle_charge, TH2D* _magnetic_field, const double dtau, const double tau_final)
-: x(initial_x), p(initial_p), charge(particle_charge), magnetic_field(_magnetic_field), dtau(dtau), tau_final(tau_final){
-  orbit = new TGraph();
+void fill_track_density(TH2D* density, const TrackRaster& raster){
+  for(int j = 0; j < raster.ny; j++){
+    for(int i = 0; i < raster.nx; i++){
+      density->SetBinContent(i + 1, j + 1, raster.counts[j * raster.nx + i]);
+    }
+  }
 }
 
-void BeamRK4::plot_orbit_point(){
-  orbit->SetPoint(tau_index, x.X() / length_unit, x.Y() / length_unit);
-  tau_index++;
+// the pixels of a layer as a histogram over the field axes, in cm
+TH2D* track_density(const TH2D* magnetic_field, const TrackRaster& raster, const char* name, const char* title){
+  const TAxis* x_axis = magnetic_field->GetXaxis();
+  const TAxis* y_axis = magnetic_field->GetYaxis();
+  TH2D* density = new TH2D(name, title, raster.nx, x_axis->GetXmin(), x_axis->GetXmax(), raster.ny, y_axis->GetXmin(), y_axis->GetXmax());
+  fill_track_density(density, raster);
+  return density;
 }
 
-LorentzX BeamRK4::get_dx(const LorentzP p){
-  return p / this->p.M() * dtau;
+// the counts of a layer saved by a checkpoint
+void load_track_density(const TH2D* density, TrackRaster& raster){
+  for(int j = 0; j < raster.ny; j++){
+    for(int i = 0; i < raster.nx; i++){
+      raster.counts[j * raster.nx + i] = density->GetBinContent(i + 1, j + 1);
+    }
+  }
 }
 
-LorentzP BeamRK4::get_dp(const LorentzX x, const LorentzP p){
-  auto dp = charge * magnetic_field->Interpolate(x.X() / length_unit, x.Y() / length_unit) * magnetic_field_unit * LorentzP(p.Y(), -p.X(), 0, 0) / this->p.M() * dtau;
-  return dp;
+// a layer over the field map, with the collimators and the detector on top
+void save_track_density(TH2D* magnetic_field, TH2D* density, const DrainRectangles& drain_rectangles, const char* file_name){
+  TCanvas* c_density = new TCanvas("c_density", density->GetTitle());
+  magnetic_field->Draw("COLZ");
+  density->Draw("BOX SAME");
+  for(auto& drain_rectangle:drain_rectangles){
+    drain_rectangle->tbox->Draw();
+  }
+  c_density->SaveAs(file_name);
+  delete c_density;
 }
 
-void BeamRK4::set_magnetic_unit(const double magnetic_field_unit){
-  this->magnetic_field_unit = magnetic_field_unit;
+// integration steps of a track by the field bin they ended in; the starting point is not a step
+void add_steps(const vector<double>& orbit, const MagneticFieldGrid& grid, vector<double>& step_counts){
+  for(size_t point = 1; point < orbit.size() / 2; point++){
+    const int i = std::floor((orbit[2 * point] - grid.x_min) * grid.inv_dx);
+    const int j = std::floor((orbit[2 * point + 1] - grid.y_min) * grid.inv_dy);
+    if(0 <= i && i < grid.nx && 0 <= j && j < grid.ny){
+      step_counts[j * grid.nx + i]++;
+    }
+  }
 }
 
-void BeamRK4::set_length_unit(const double length_unit){
-  this->length_unit = length_unit;
+// the step counts over the bins of the field map, in cm
+TH2D* step_density_histogram(const TH2D* magnetic_field){
+  const TAxis* x_axis = magnetic_field->GetXaxis();
+  const TAxis* y_axis = magnetic_field->GetYaxis();
+  return new TH2D("step_density", "integration steps;x [cm];y [cm]", x_axis->GetNbins(), x_axis->GetXmin(), x_axis->GetXmax(), y_axis->GetNbins(), y_axis->GetXmin(), y_axis->GetXmax());
 }
 
-void BeamRK4::add_drain_rectangle(DrainRectangle* drain_rectangle){
-  drain_rectangles.emplace_back(drain_rectangle);
+void fill_step_density(TH2D* density, const vector<double>& step_counts){
+  const int nx = density->GetNbinsX();
+  for(size_t bin = 0; bin < step_counts.size(); bin++){
+    density->SetBinContent(bin % nx + 1, bin / nx + 1, step_counts[bin]);
+  }
 }
 
-bool BeamRK4::is_anihilated(){
-  if(tau_index * dtau > tau_final){
-    return true;
+// the step counts saved by a checkpoint; all 0 from a new histogram
+void load_step_density(const TH2D* density, vector<double>& step_counts){
+  const int nx = density->GetNbinsX(), ny = density->GetNbinsY();
+  step_counts.assign(nx * ny, 0);
+  for(int j = 0; j < ny; j++){
+    for(int i = 0; i < nx; i++){
+      step_counts[j * nx + i] = density->GetBinContent(i + 1, j + 1);
+    }
   }
-  if(x.X() - edge_margin <= magnetic_field->GetXaxis()->GetXmin() * length_unit || magnetic_field->GetXaxis()->GetXmax() * length_unit <= x.X() + edge_margin || x.Y() - edge_margin <= magnetic_field->GetYaxis()->GetXmin() * length_unit || magnetic_field->GetYaxis()->GetXmax() * length_unit <= x.Y() + edge_margin){
-    return true;
+}
+
+// what a shard adds to the setup record of the unsharded run: the events the shards split
+// between them and which shard it is, so merge_shards can take it off again
+TString shard_setup_suffix(const int n_run_events, const int shard_index, const int shard_count){
+  return Form(", n_events %d, shard %d of %d", n_run_events, shard_index, shard_count);
+}
+
+// file of one shard, name_shard<shard_index>.extension, or name itself for an unsharded run
+TString shard_name(const char* name, const int shard_index, const int shard_count){
+  if(shard_count <= 1){
+    return name;
   }
-  for(auto drain_rectangle:drain_rectangles){
-    if(drain_rectangle->is_collided(this)){
-      anihilation_type = drain_rectangle->anihilation_type;
-      return true;
+  std::string sharded = name;
+  sharded.insert(sharded.rfind('.'), Form("_shard%d", shard_index));
+  return sharded.c_str();
+}
+
+// blocks [block_begin, block_end) of a shard. Every event draws from its own random counter,
+// so the shards together simulate exactly the events of an unsharded run
+void shard_blocks(const int n_blocks, const int shard_index, const int shard_count, int& block_begin, int& block_end){
+  block_begin = (long long)n_blocks * shard_index / shard_count;
+  block_end = (long long)n_blocks * (shard_index + 1) / shard_count;
+}
+
+const char* cache_directory = "cache"; // one entry per setup record, see spectrometer_kinetic_hist
+// what a run leaves in the working directory
+const vector<const char*> output_names = {"beta_file.root", "beta_tracks.trk", "beta_tracks.trk.idx", "first_10000_track.png", "all_track.png", "detected_track.png", "step_density.png"};
+
+bool is_link(const char* path){
+  struct stat status;
+  return lstat(path, &status) == 0 && S_ISLNK(status.st_mode);
+}
+
+// the outputs in the working directory that link into the cache are removed, so that a run
+// writing its outputs there does not write into a cache entry through them
+void unlink_cached_outputs(){
+  for(auto name:output_names){
+    if(is_link(name)){
+      unlink(name);
     }
   }
-  return false;
 }
 
-void BeamRK4::step_RK4(){
-  auto dx1 = get_dx(p);
-  auto dp1 = get_dp(x, p);
+// the outputs of a cache entry linked into the working directory in place of what was there,
+// where build_hist and draw_track find them; all but skip
+void link_cached_outputs(const TString& entry, const char* skip = nullptr){
+  unlink_cached_outputs();
+  for(auto name:output_names){
+    const TString target = entry + "/" + name;
+    struct stat status;
+    if((skip != nullptr && TString(name) == skip) || stat(target.Data(), &status) != 0){
+      continue;
+    }
+    unlink(name);
+    if(symlink(target.Data(), name) != 0){
+      std::cerr << "cannot link " << name << " to " << target << std::endl;
+    }
+  }
+}
 
-  auto dx2 = get_dx(p + dp1 / 2);
-  auto dp2 = get_dp(x + dx1 / 2, p + dp1 / 2);
+// the blocks of setup in the beta_file.root of a cache entry, 0 if it holds none
+int cached_blocks(const TString& entry, const TString& setup){
+  const TString beta_file_name = entry + "/beta_file.root";
+  struct stat status;
+  if(stat(beta_file_name.Data(), &status) != 0){
+    return 0;
+  }
+  TFile* beta_file = TFile::Open(beta_file_name);
+  if(beta_file == nullptr){
+    return 0;
+  }
+  auto checkpoint_setup = beta_file->Get<TNamed>("checkpoint_setup");
+  auto checkpoint_blocks = beta_file->Get<TParameter<int>>("checkpoint_blocks");
+  auto beta_tree = beta_file->Get<TTree>("beta_tree");
+  int blocks = 0;
+  if(checkpoint_setup != nullptr && checkpoint_blocks != nullptr && beta_tree != nullptr && setup == checkpoint_setup->GetTitle()
+     && beta_tree->GetEntries() == (long long)checkpoint_blocks->GetVal() * events_per_block){
+    blocks = checkpoint_blocks->GetVal();
+  }
+  beta_file->Close();
+  delete beta_file;
+  return blocks;
+}
 
-  auto dx3 = get_dx(p + dp2 / 2);
-  auto dp3 = get_dp(x + dx2 / 2, p + dp2 / 2);
+// the first n_run_events events of a cache entry as beta_file.root in the working directory
+void write_cached_prefix(const TString& entry, const TString& setup, const int n_run_events){
+  TFile* cached_file = TFile::Open(entry + "/beta_file.root");
+  auto cached_tree = cached_file->Get<TTree>("beta_tree");
+  TFile* beta_file = new TFile("beta_file.root", "RECREATE", "beta spectrometer RK4 simulation data");
+  cached_tree->CloneTree(n_run_events)->Write();
+  TNamed("setup", Form("%s, n_events %d", setup.Data(), n_run_events)).Write();
+  beta_file->Close();
+  cached_file->Close();
+  delete beta_file;
+  delete cached_file;
+}
 
-  auto dx4 = get_dx(p + dp3);
-  auto dp4 = get_dp(x + dx3, p + dp3);
+// The worker/writer pipeline of the runs and the sweeps. n_workers threads call
+// simulate(block, worker_index) for the blocks from first_block to block_end, which fills
+// event_blocks[block], and hand each finished block by its index through a bounded queue to this
+// thread, the writer, which calls write(block) for them in block order and alone touches the
+// outputs. The queue carries only the indices; a full one holds the workers back until the
+// writer has taken the blocks waiting for it. What bounds the memory is the window: a worker does
+// not start a block more than blocks_in_flight blocks past the last one written, so a slow block
+// cannot pile the ones after it up. The waits on either side are reported at the end
+template <class Simulate, class Write>
+void run_blocks(vector<EventBlock>& event_blocks, const int first_block, const int block_end, const int n_workers, const Simulate& simulate, const Write& write){
+  std::atomic<int> next_block(first_block);
+  const int blocks_in_flight = blocks_in_flight_per_thread * n_workers;
+  BoundedQueue<int> finished_blocks(blocks_queued_per_thread * n_workers);
+  std::atomic<int> merged_blocks(first_block);
+  std::atomic<long long> window_wait_ns(0);
 
-  x += (dx1 + 2 * dx2 + 2 * dx3 + dx4) / 6;
-  p += (dp1 + 2 * dp2 + 2 * dp3 + dp4) / 6;
+  auto worker = [&](const int worker_index){
+    for(int block = next_block++; block < block_end; block = next_block++){
+      if(block >= merged_blocks.load(std::memory_order_acquire) + blocks_in_flight){
+        const auto start = std::chrono::steady_clock::now();
+        int rounds = 0;
+        while(block >= merged_blocks.load(std::memory_order_acquire) + blocks_in_flight){
+          queue_backoff(rounds);
+        }
+        window_wait_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+      }
+      simulate(block, worker_index);
+      finished_blocks.push(block);
+    }
+  };
+  vector<std::thread> workers;
+  for(int i = 0; i < n_workers; i++){
+    workers.emplace_back(worker, i);
+  }
+
+  // what the writer did: events and seconds spent writing, the queue depth it found at each pop
+  const auto write_start = std::chrono::steady_clock::now();
+  long long written_events = 0;
+  double write_seconds = 0;
+  long long sum_queue_depth = 0, pops = 0;
+  std::size_t max_queue_depth = 0;
+
+  for(int block = first_block; block < block_end; block++){
+    // blocks finished out of order wait in event_blocks until their turn
+    while(!event_blocks[block].done){
+      const std::size_t queue_depth = finished_blocks.depth();
+      sum_queue_depth += queue_depth;
+      max_queue_depth = std::max(max_queue_depth, queue_depth);
+      pops++;
+      int finished_block;
+      finished_blocks.pop(finished_block);
+      event_blocks[finished_block].done = true;
+    }
+    const auto block_start = std::chrono::steady_clock::now();
+    written_events += event_blocks[block].records.size();
+    write(block);
+    merged_blocks.store(block + 1, std::memory_order_release);
+    write_seconds += seconds_since(block_start);
+  }
+  for(auto& worker_thread:workers){
+    worker_thread.join();
+  }
+  const double run_seconds = seconds_since(write_start);
+  std::cout << "output: " << written_events << " events in " << run_seconds << " s, " << written_events / run_seconds << " events/s; writer busy "
+            << 100 * write_seconds / run_seconds << " % of the time; queue of " << finished_blocks.capacity() << " blocks, depth mean "
+            << (pops > 0 ? (double)sum_queue_depth / pops : 0) << ", max " << max_queue_depth << std::endl;
+  std::cout << "workers waited " << finished_blocks.full_wait_ns * 1e-9 << " s for the writer in " << finished_blocks.full_pushes << " full pushes, "
+            << window_wait_ns * 1e-9 << " s for earlier blocks to be written" << std::endl;
 }
 
-void spectrometer_kinetic_hist(){
-  TCanvas* c1 = new TCanvas("c1", "track canvas");
+// The options are the members of KineticHistOptions, whose defaults are those of a plain run.
+// n_threads workers simulate blocks of events and hand them through a bounded queue to this
+// thread, which alone writes them out in event order, so beta_tree and the canvases are the same
+// for a given seed whatever n_threads is.
+// integrator is "rk4" (fixed dtau), "rk4_batch" (the same with BatchRK4), "rk45" (adaptive,
+// tolerance per step in metres for x and relative to |p| for p) or "boris" (the step of boris_step, |p| conserved).
+// region_stepping lets BeamRK4 jump analytically over field-free and uniform parts of the map.
+// density_rendering draws the track images as occupancy maps; without it they are one graph per
+// track, for the first max_graph_tracks tracks.
+// importance_sampling maps the acceptance with a pilot run of the nominal source first and then
+// draws most events where the detector can be reached; e_weight undoes the bias.
+// Every checkpoint_interval blocks beta_file.root is saved with everything needed to go on;
+// resume continues an interrupted run of the same setup from its last checkpoint.
+// With shard_count > 1 this process runs only its share of the blocks into files named
+// *_shard<shard_index>.*; merge_shards puts the shards together again.
+// field_smoothing > 0 fits a smoothing bicubic spline to a noisy measured map and tracks through
+// that instead of the bilinear map, see smoothing_spline for the scale.
+// instrumentation adds e_steps, e_wall_time (s), e_field_evaluations and e_termination (see
+// termination) to beta_tree and writes step_density, the integration steps by where they
+// ended over the field bins; without it no clock is read and nothing more is stored.
+// events are simulated in whole blocks, so the number is rounded up to events_per_block.
+// With cached, every setup is run once: the outputs go to cache/<hash of the setup record>/ and
+// are linked into the working directory. A setup already run with at least as many events is
+// not run again (beta_file.root then holds the first events only if fewer were asked for), one
+// run with fewer events, or interrupted, goes on from there, and resume is not needed.
+// Sharded runs are not cached.
+// three_dimensional tracks through the gap between the poles instead of in the midplane: the field
+// from open_magnetic_field_3d, the source leaving the plane by up to source_vertical_angle, the
+// detector detector_half_height high, and electrons reaching the poles stopped as at an edge.
+// The tracks are stored and drawn projected on the midplane. Not with rk4_batch or region_stepping
+void spectrometer_kinetic_hist(const KineticHistOptions& options){
+  const int n_threads = options.n_threads;
+  const unsigned int seed = options.seed;
+  const TString integrator = options.integrator;
+  const double tolerance = options.tolerance;
+  const bool region_stepping = options.region_stepping;
+  const bool density_rendering = options.density_rendering;
+  const bool importance_sampling = options.importance_sampling;
+  const bool resume = options.resume;
+  const int shard_index = options.shard_index;
+  const int shard_count = options.shard_count;
+  const double field_smoothing = options.field_smoothing;
+  const bool instrumentation = options.instrumentation;
+  const int events = options.events;
+  const bool cached = options.cached;
+  const bool three_dimensional = options.three_dimensional;
+  bool batch;
+  Integrator beam_integrator;
+  if(!parse_integrator(integrator, beam_integrator, batch)){
+    std::cerr << "unknown integrator " << integrator << std::endl;
+    return;
+  }
+  if(shard_count < 1 || shard_index < 0 || shard_index >= shard_count){
+    std::cerr << "shard " << shard_index << " of " << shard_count << " does not exist" << std::endl;
+    return;
+  }
+  if(events < 1){
+    std::cerr << "no events to simulate" << std::endl;
+    return;
+  }
+  if(three_dimensional && (batch || region_stepping)){
+    std::cerr << "rk4_batch and region_stepping track in the plane only" << std::endl;
+    return;
+  }
+  const int n_blocks = (events + events_per_block - 1) / events_per_block;
+  const int n_run_events = n_blocks * events_per_block;
 
-  double cm = unit::c;
+  MagneticFieldGrid* magnetic_field_grid = open_magnetic_field();
+  const std::uint64_t field_hash = magnetic_field_grid->content_hash();
+  if(field_smoothing > 0){
+    magnetic_field_grid->smooth(field_smoothing);
+  }
+  const FieldGrid3D* field_grid_3d = three_dimensional ? open_magnetic_field_3d(*magnetic_field_grid) : nullptr;
+  double integrator_dtau = dtau;
+  if(beam_integrator == Integrator::Boris && !batch){
+    integrator_dtau = three_dimensional ? boris_step<3>(field_grid_3d, momentum) : boris_step<2>(magnetic_field_grid, momentum);
+    std::cout << "Boris step " << integrator_dtau / dtau << " dtau, within " << boris_tolerance << " m of RK4" << std::endl;
+  }
+  const double vertical_angle = three_dimensional ? source_vertical_angle : 0;
+  const DrainRectangles drain_rectangles = spectrometer_drain_rectangles();
 
-  TFile* file = TFile::Open("mfield.root");
+  // the setup record, everything the events and the pictures depend on; its hash names the cache
+  // entry, so a constant missing here would hand back the outputs of another setup. n_threads is
+  // not part of it, nor is the number of events: the events of a run are the first ones of any
+  // longer run of the setup
+  TString obstacles;
+  for(auto& drain_rectangle:drain_rectangles){
+    obstacles += Form("%s%.17g %.17g %.17g %.17g %d", obstacles.IsNull() ? "" : "; ", drain_rectangle->x1, drain_rectangle->x2, drain_rectangle->y1, drain_rectangle->y2, drain_rectangle->anihilation_type);
+  }
+  TString setup = Form("field %s, field_smoothing %g, obstacles %s, source %.17g %.17g, momentum %.17g, seed %u, "
+                       "integrator %s, tolerance %g, dtau %.17g, integrator_dtau %.17g, tau_final %.17g, edge_margin %g, "
+                       "region_stepping %d, region_tolerance %g, region_max_arc %.17g, arc_collision_tolerance %g, "
+                       "importance_sampling %d, pilot_events %d, pilot_first_block %d, importance_fraction %g, "
+                       "acceptance_momentum_max %.17g, acceptance_momentum_bins %d, acceptance_angle_bins %d, acceptance_margin %d, "
+                       "density_rendering %d, raster_subdivision %d, max_graph_tracks %d, first_track_events %d, instrumentation %d, "
+                       "events_per_block %d, track_stride %d, track_quantum %g",
+                       hash_hex(field_hash).c_str(), field_smoothing, obstacles.Data(), source_x, source_y, momentum, seed,
+                       integrator.Data(), tolerance, dtau, integrator_dtau, tau_final, edge_margin,
+                       region_stepping, region_tolerance, region_max_arc, arc_collision_tolerance,
+                       importance_sampling, pilot_events, pilot_first_block, importance_fraction,
+                       acceptance_momentum_max, acceptance_momentum_bins, acceptance_angle_bins, acceptance_margin,
+                       density_rendering, raster_subdivision, max_graph_tracks, first_track_events, instrumentation,
+                       events_per_block, track_stride, track_quantum);
+  if(three_dimensional){
+    setup += Form(", three_dimensional field %s, detector_half_height %.17g, source_vertical_angle %.17g",
+                  hash_hex(field_grid_3d->content_hash()).c_str(), detector_half_height, source_vertical_angle);
+  }
+  if(shard_count > 1){
+    setup += shard_setup_suffix(n_run_events, shard_index, shard_count);
+  }
+
+  const bool use_cache = cached && shard_count == 1;
+  const TString entry = Form("%s/%s", cache_directory, hash_hex(fnv1a(setup.Data())).c_str());
+  bool resuming = resume;
+  if(use_cache){
+    mkdir(cache_directory, 0777);
+    mkdir(entry.Data(), 0777);
+    std::ofstream((entry + "/setup.txt").Data()) << setup.Data() << std::endl;
+    const int blocks = cached_blocks(entry, setup);
+    if(blocks >= n_blocks){
+      std::cout << blocks * events_per_block << " events of this setup are in " << entry << ", none to simulate" << std::endl;
+      link_cached_outputs(entry, blocks > n_blocks ? "beta_file.root" : nullptr);
+      if(blocks > n_blocks){
+        write_cached_prefix(entry, setup, n_run_events);
+        std::cout << "beta_file.root holds the first " << n_run_events << " of them, the pictures show all" << std::endl;
+      }
+      delete field_grid_3d;
+      delete magnetic_field_grid;
+      return;
+    }
+    resuming = blocks > 0;
+    if(resuming){
+      std::cout << blocks * events_per_block << " events of this setup are in " << entry << ", simulating the other " << n_run_events - blocks * events_per_block << std::endl;
+    }
+  }else{
+    unlink_cached_outputs();
+  }
+  // a file of this run, in its cache entry or the working directory
+  auto output_name = [&](const char* name) -> TString {
+    return use_cache ? entry + "/" + name : shard_name(name, shard_index, shard_count);
+  };
+  const TString beta_file_name = output_name("beta_file.root");
+  const TString track_store_name = output_name("beta_tracks.trk");
+
+  TCanvas* c1 = new TCanvas("c1", "track canvas");
+
+  // the histogram is only drawn; the electrons see the grid from the cache
+  TFile* file = TFile::Open(field_file_name);
   auto MagneticField = file->Get<TH2D>("MagneticField"); //mTesla
   MagneticField->Draw("COLZ");
+  const FieldRegionMap field_region_map(magnetic_field_grid, region_tolerance);
 
   TCanvas* c_detected = new TCanvas("c_detected", "detected track canvas");
   MagneticField->Draw("COLZ");
   c1->cd();
 
-  // create tree and branch
-  TFile* beta_file = new TFile("beta_file.root", "RECREATE", "beta spectrometer RK4 simulation data");
-  TTree* beta_tree = new TTree("beta_tree", "beta spectrometer RK4 simulation data");
-  
-  double e_E = 0;
-  auto branch_e_E = beta_tree->Branch("e_E", &e_E);
+  for(auto& drain_rectangle:drain_rectangles){
+    drain_rectangle->tbox->Draw();
+  }
 
-  double e_KE = 0;
-  auto branch_e_KE = beta_tree->Branch("e_KE", &e_KE);
+  c_detected->cd();
+  for(auto& drain_rectangle:drain_rectangles){
+    drain_rectangle->tbox->Draw();
+  }
+  c1->cd();
+  TrackGraphs track_graphs(c1, c_detected, density_rendering ? 0 : max_graph_tracks);
+
+  const int n_workers = std::max(n_threads, 1);
+  int block_begin, block_end;
+  shard_blocks(n_blocks, shard_index, shard_count, block_begin, block_end);
+  const int shard_first_event = block_begin * events_per_block;
+  const int shard_end_event = block_end * events_per_block;
 
+  // create tree and branch, or take them over from the last checkpoint
+  TFile* beta_file = nullptr;
+  TTree* beta_tree = nullptr;
+  ImportanceSource* importance_source = nullptr;
+  // what the run holds, released alike at the end and on the error exits
+  auto release = [&](){
+    if(beta_file != nullptr){
+      beta_file->Close();
+    }
+    delete beta_file;
+    delete importance_source;
+    delete c1;
+    delete c_detected;
+    file->Close();
+    delete file;
+    delete field_grid_3d;
+    delete magnetic_field_grid;
+  };
+  int first_block = block_begin;
+  double sum_energy_drift = 0, max_energy_drift = 0;
+  if(resuming){
+    beta_file = new TFile(beta_file_name, "UPDATE");
+    auto checkpoint_setup = beta_file->Get<TNamed>("checkpoint_setup");
+    auto checkpoint_blocks = beta_file->Get<TParameter<int>>("checkpoint_blocks");
+    auto checkpoint_sum_energy_drift = beta_file->Get<TParameter<double>>("checkpoint_sum_energy_drift");
+    auto checkpoint_max_energy_drift = beta_file->Get<TParameter<double>>("checkpoint_max_energy_drift");
+    beta_tree = beta_file->Get<TTree>("beta_tree");
+    // a checkpoint of this setup, inside the blocks of this shard, written completely
+    if(checkpoint_setup == nullptr || checkpoint_blocks == nullptr || checkpoint_sum_energy_drift == nullptr || checkpoint_max_energy_drift == nullptr
+       || beta_tree == nullptr || setup != checkpoint_setup->GetTitle() || checkpoint_blocks->GetVal() < block_begin || checkpoint_blocks->GetVal() > block_end
+       || beta_tree->GetEntries() != (long long)checkpoint_blocks->GetVal() * events_per_block - shard_first_event){
+      std::cerr << "no checkpoint of this setup in " << beta_file_name << std::endl;
+      release();
+      return;
+    }
+    first_block = checkpoint_blocks->GetVal();
+    sum_energy_drift = checkpoint_sum_energy_drift->GetVal();
+    max_energy_drift = checkpoint_max_energy_drift->GetVal();
+    std::cout << "resuming from block " << first_block << " of " << block_begin << " to " << block_end << std::endl;
+  }else{
+    beta_file = new TFile(beta_file_name, "RECREATE", "beta spectrometer RK4 simulation data");
+    beta_tree = new TTree("beta_tree", "beta spectrometer RK4 simulation data");
+  }
+  // only checkpoints save the tree, so a checkpoint always matches the entries on file
+  beta_tree->SetAutoSave(0);
+
+  double e_E = 0;
+  double e_KE = 0;
   int e_anihilation_type = 0;
-  auto branch_e_detected = beta_tree->Branch("e_anihilation_type", &e_anihilation_type);
+  double e_weight = 1;
+  int e_steps = 0;
+  double e_wall_time = 0;
+  long long e_field_evaluations = 0;
+  int e_termination = 0;
+  if(resuming){
+    beta_tree->SetBranchAddress("e_E", &e_E);
+    beta_tree->SetBranchAddress("e_KE", &e_KE);
+    beta_tree->SetBranchAddress("e_anihilation_type", &e_anihilation_type);
+    beta_tree->SetBranchAddress("e_weight", &e_weight);
+    if(instrumentation){
+      beta_tree->SetBranchAddress("e_steps", &e_steps);
+      beta_tree->SetBranchAddress("e_wall_time", &e_wall_time);
+      beta_tree->SetBranchAddress("e_field_evaluations", &e_field_evaluations);
+      beta_tree->SetBranchAddress("e_termination", &e_termination);
+    }
+  }else{
+    auto branch_e_E = beta_tree->Branch("e_E", &e_E);
+    auto branch_e_KE = beta_tree->Branch("e_KE", &e_KE);
+    auto branch_e_detected = beta_tree->Branch("e_anihilation_type", &e_anihilation_type);
+    auto branch_e_weight = beta_tree->Branch("e_weight", &e_weight);
+    if(instrumentation){
+      beta_tree->Branch("e_steps", &e_steps);
+      beta_tree->Branch("e_wall_time", &e_wall_time);
+      beta_tree->Branch("e_field_evaluations", &e_field_evaluations);
+      beta_tree->Branch("e_termination", &e_termination);
+    }
+  }
+  const int first_event = first_block * events_per_block;
 
-  DrainRectangle* top_collimator_left = new DrainRectangle(-2 * cm, -1.1 * cm, 3 * cm, 4 * cm, cm, 0);
-  top_collimator_left->tbox->Draw();
-  DrainRectangle* top_collimator_right = new DrainRectangle(-0.9 * cm, 0 * cm, 3 * cm, 4 * cm, cm, 0);
-  top_collimator_right->tbox->Draw();
+  // the checkpointed tracks go back on the canvases from the track store
+  if(resuming && !density_rendering){
+    TrackReader track_reader(track_store_name.Data());
+    vector<double> points;
+    for(int event = shard_first_event; event < first_event; event++){
+      beta_tree->GetEntry(event - shard_first_event);
+      if(track_reader.read(event, points)){
+        track_graphs.draw(points, 1, e_anihilation_type == 1);
+      }
+    }
+  }
 
-  DrainRectangle* side_collimator_top = new DrainRectangle(3 * cm, 4 * cm, -0.9 * cm, 0 * cm, cm, 0);
-  side_collimator_top->tbox->Draw();
-  DrainRectangle* side_collimator_bottom = new DrainRectangle(3 * cm, 4 * cm, -2 * cm, -1.1 * cm, cm, 0);
-  side_collimator_bottom->tbox->Draw();
+  // tracks by event number (the entry of beta_tree), see draw_track.cpp
+  TrackWriter track_writer(track_store_name.Data(), track_quantum, track_stride, 1 << 20, resuming ? first_event - shard_first_event : -1);
+  if(!track_writer.is_open()){
+    std::cerr << "cannot write " << track_store_name << std::endl;
+    release();
+    return;
+  }
 
-  DrainRectangle* detector = new DrainRectangle(4.5 * cm, 5 * cm, -1.5 * cm, -0.5 * cm, cm, 1);
-  detector->tbox->SetFillColor(kGreen);
-  detector->tbox->Draw();
+  // one cell per field bin
+  ObstacleGrid obstacle_grid(magnetic_field_grid->x_min, magnetic_field_grid->x_max, magnetic_field_grid->y_min, magnetic_field_grid->y_max, magnetic_field_grid->nx, magnetic_field_grid->ny);
+  for(auto& drain_rectangle:drain_rectangles){
+    if(three_dimensional && drain_rectangle->anihilation_type == 1){
+      obstacle_grid.add_box(drain_rectangle->x1, drain_rectangle->x2, drain_rectangle->y1, drain_rectangle->y2, -detector_half_height, detector_half_height, drain_rectangle->anihilation_type);
+    }else{
+      obstacle_grid.add_rectangle(drain_rectangle->x1, drain_rectangle->x2, drain_rectangle->y1, drain_rectangle->y2, drain_rectangle->anihilation_type);
+    }
+  }
 
-  c_detected->cd();
-  top_collimator_left->tbox->Draw();
-  top_collimator_right->tbox->Draw();
-  side_collimator_top->tbox->Draw();
-  side_collimator_bottom->tbox->Draw();
-  detector->tbox->Draw();
-  c1->cd();
+  ROOT::EnableThreadSafety();
 
-  TRandom* trandom_momentum = new TRandom();
-  TRandom* trandom_angle = new TRandom();
+  // the pilot run needs no orbits; only the batch leaves them out
+  auto simulate = [&](const vector<SourceEvent>& events, const bool keep_orbits, EventBlock& event_block){
+    if(three_dimensional){
+      simulate_block(events, field_grid_3d, &obstacle_grid, beam_integrator, tolerance, integrator_dtau, event_block, instrumentation);
+    }else if(batch){
+      simulate_block_batch(events, magnetic_field_grid, &obstacle_grid, keep_orbits, event_block, instrumentation);
+    }else{
+      simulate_block(events, magnetic_field_grid, region_stepping ? &field_region_map : nullptr, &obstacle_grid, beam_integrator, tolerance, integrator_dtau, event_block, instrumentation);
+    }
+  };
 
-  for(int i = 0; i < 1000000; i++){
-    const auto initial_coordinates = LorentzX(-1 * unit::c, 4 * unit::c, 0, 0); // metre, second
+  // the pilot run is redone on resume; it depends on the seed only
+  AcceptanceMap acceptance_map(acceptance_momentum_max, acceptance_momentum_bins, acceptance_angle_bins);
+  if(importance_sampling){
+    // the pilot run takes blocks far after the last one of any main run, so it shares no random counter with it
+    const int n_pilot_blocks = (pilot_events + events_per_block - 1) / events_per_block;
+    vector<vector<SourceEvent>> pilot_events_of_block(n_pilot_blocks);
+    vector<EventBlock> pilot_blocks(n_pilot_blocks);
+    std::atomic<int> next_pilot_block(0);
+    auto pilot_worker = [&](){
+      for(int block = next_pilot_block++; block < n_pilot_blocks; block = next_pilot_block++){
+        pilot_events_of_block[block] = source_events(pilot_first_block + block, std::min(events_per_block, pilot_events - block * events_per_block), seed, nullptr, momentum, vertical_angle);
+        simulate(pilot_events_of_block[block], false, pilot_blocks[block]);
+        for(auto& record:pilot_blocks[block].records){
+          vector<double>().swap(record.orbit);
+        }
+      }
+    };
+    vector<std::thread> pilot_workers;
+    for(int i = 0; i < n_workers; i++){
+      pilot_workers.emplace_back(pilot_worker);
+    }
+    for(auto& pilot_thread:pilot_workers){
+      pilot_thread.join();
+    }
+    for(int block = 0; block < n_pilot_blocks; block++){
+      for(size_t event = 0; event < pilot_blocks[block].records.size(); event++){
+        const SourceEvent& source = pilot_events_of_block[block][event];
+        acceptance_map.fill(source.momentum_amount, source.angle, pilot_blocks[block].records[event].e_anihilation_type == 1);
+      }
+    }
 
-    double momentum_amount = 0;
-    while(momentum_amount <= 0){
-      momentum_amount = trandom_momentum->Gaus(momentum, momentum);
+    importance_source = new ImportanceSource(acceptance_map, momentum, momentum, importance_fraction, acceptance_margin);
+    if(importance_source->region_cells == 0){
+      std::cerr << "no pilot event was detected, the nominal source is used" << std::endl;
+      delete importance_source;
+      importance_source = nullptr;
+    }else{
+      std::cout << "importance sampling from " << importance_source->region_cells << " of " << acceptance_momentum_bins * acceptance_angle_bins << " cells, P = " << importance_source->region_probability << std::endl;
     }
-    double angle = trandom_angle->Rndm() * 2 * TMath::Pi(); 
-    const auto initial_momentum = LorentzP_M(momentum_amount * TMath::Cos(angle), momentum_amount * TMath::Sin(angle), 0, mass_e); // eV/c, eV
+  }
 
-    BeamRK4 beam_RK4 = BeamRK4(initial_coordinates, initial_momentum, charge_e, MagneticField, dtau, tau_final);
-    beam_RK4.set_magnetic_unit(unit::m * Tesla);
-    beam_RK4.set_length_unit(unit::c);
-    beam_RK4.add_drain_rectangle(top_collimator_left);
-    beam_RK4.add_drain_rectangle(top_collimator_right);
-    beam_RK4.add_drain_rectangle(side_collimator_top);
-    beam_RK4.add_drain_rectangle(side_collimator_bottom);
-    beam_RK4.add_drain_rectangle(detector);
+  // the layers of the merged blocks, and a scratch set per worker
+  const TrackRaster empty_raster(magnetic_field_grid->x_min, magnetic_field_grid->x_max, magnetic_field_grid->y_min, magnetic_field_grid->y_max, magnetic_field_grid->nx * raster_subdivision, magnetic_field_grid->ny * raster_subdivision);
+  TrackLayers layers = {empty_raster, empty_raster, empty_raster};
+  vector<TrackLayers> track_layers(density_rendering ? n_workers : 0, layers);
+  TH2D* density_all = nullptr;
+  TH2D* density_first = nullptr;
+  TH2D* density_detected = nullptr;
+  if(density_rendering){
+    beta_file->cd();
+    density_all = resuming ? beta_file->Get<TH2D>("track_density_all") : track_density(MagneticField, layers.all, "track_density_all", "all tracks;x [cm];y [cm]");
+    density_first = resuming ? beta_file->Get<TH2D>("track_density_first") : track_density(MagneticField, layers.first, "track_density_first", Form("first %d tracks;x [cm];y [cm]", first_track_events));
+    density_detected = resuming ? beta_file->Get<TH2D>("track_density_detected") : track_density(MagneticField, layers.detected, "track_density_detected", "detected tracks;x [cm];y [cm]");
+    load_track_density(density_all, layers.all);
+    load_track_density(density_first, layers.first);
+    load_track_density(density_detected, layers.detected);
+  }
+  vector<double> step_counts;
+  TH2D* step_density = nullptr;
+  if(instrumentation){
+    beta_file->cd();
+    step_density = resuming ? beta_file->Get<TH2D>("step_density") : step_density_histogram(MagneticField);
+    load_step_density(step_density, step_counts);
+  }
 
-    beam_RK4.plot_orbit_point();
+  // beta_tree, the track store and the partial results up to `blocks` merged blocks
+  auto checkpoint = [&](const int blocks){
+    track_writer.flush();
+    beta_file->cd();
+    if(density_rendering){
+      fill_track_density(density_all, layers.all);
+      fill_track_density(density_first, layers.first);
+      fill_track_density(density_detected, layers.detected);
+      density_all->Write("", TObject::kOverwrite);
+      density_first->Write("", TObject::kOverwrite);
+      density_detected->Write("", TObject::kOverwrite);
+    }
+    if(instrumentation){
+      fill_step_density(step_density, step_counts);
+      step_density->Write("", TObject::kOverwrite);
+    }
+    TNamed("checkpoint_setup", setup.Data()).Write("", TObject::kOverwrite);
+    TParameter<int>("checkpoint_blocks", blocks).Write("", TObject::kOverwrite);
+    TParameter<double>("checkpoint_sum_energy_drift", sum_energy_drift).Write("", TObject::kOverwrite);
+    TParameter<double>("checkpoint_max_energy_drift", max_energy_drift).Write("", TObject::kOverwrite);
+    beta_tree->AutoSave("SaveSelf");
+  };
 
-    while(!beam_RK4.is_anihilated()){
-      beam_RK4.step_RK4();
-      beam_RK4.plot_orbit_point();
+  // the workers only track, this thread writes, see run_blocks
+  vector<EventBlock> event_blocks(n_blocks);
+  int i = first_event;
+  run_blocks(event_blocks, first_block, block_end, n_workers, [&](const int block, const int worker_index){
+    EventBlock& event_block = event_blocks[block];
+    simulate(source_events(block, events_per_block, seed, importance_source, momentum, vertical_angle), true, event_block);
+    if(density_rendering){
+      // handed to the merge as the pixels of this block alone, so a checkpoint holds merged blocks only
+      TrackLayers& scratch = track_layers[worker_index];
+      int event = block * events_per_block;
+      for(auto& record:event_block.records){
+        const double* points = record.orbit.data();
+        const size_t n_points = record.orbit.size() / 2;
+        scratch.all.add_track(points, n_points);
+        if(event < first_track_events){
+          scratch.first.add_track(points, n_points);
+        }
+        if(record.e_anihilation_type == 1){
+          scratch.detected.add_track(points, n_points);
+        }
+        event++;
+      }
+      scratch.all.take(event_block.pixels_all);
+      scratch.first.take(event_block.pixels_first);
+      scratch.detected.take(event_block.pixels_detected);
     }
-    e_E = beam_RK4.p.E();
-    e_KE = beam_RK4.p.E() - beam_RK4.p.M();
-    e_anihilation_type = beam_RK4.anihilation_type;
-    beta_tree->Fill();
-    beam_RK4.orbit->Draw("SAME");
+  }, [&](const int block){
+    for(auto& record:event_blocks[block].records){
+      e_E = record.e_E;
+      e_KE = record.e_KE;
+      e_anihilation_type = record.e_anihilation_type;
+      e_weight = record.e_weight;
+      if(instrumentation){
+        e_steps = record.steps;
+        e_wall_time = record.wall_time;
+        e_field_evaluations = record.field_evaluations;
+        e_termination = record.termination;
+        add_steps(record.orbit, *magnetic_field_grid, step_counts);
+      }
+      beta_tree->Fill();
+      track_writer.write(i, record.orbit.data(), record.orbit.size() / 2);
+      if(!density_rendering){
+        track_graphs.draw(record.orbit, track_stride, record.e_anihilation_type == 1); // the points that go to the track store
+      }
+      sum_energy_drift += TMath::Abs(record.energy_drift);
+      max_energy_drift = std::max(max_energy_drift, TMath::Abs(record.energy_drift));
 
-    if(beam_RK4.anihilation_type == 1){
-      c_detected->cd();
-      beam_RK4.orbit->Draw("SAME");
-      c1->cd();
+      if(!density_rendering && i == first_track_events - 1){
+        c1->SaveAs(output_name("first_10000_track.png"));
+      }
+      i++;
+    }
+    if(density_rendering){
+      layers.all.add(event_blocks[block].pixels_all);
+      layers.first.add(event_blocks[block].pixels_first);
+      layers.detected.add(event_blocks[block].pixels_detected);
     }
+    vector<EventRecord>().swap(event_blocks[block].records);
+    PixelCounts().swap(event_blocks[block].pixels_all);
+    PixelCounts().swap(event_blocks[block].pixels_first);
+    PixelCounts().swap(event_blocks[block].pixels_detected);
+    if((block + 1) % checkpoint_interval == 0 && block + 1 < block_end){
+      checkpoint(block + 1);
+    }
+  });
+  std::cout << "kinetic energy drift with " << integrator << ": mean " << sum_energy_drift / (shard_end_event - shard_first_event) << ", max " << max_energy_drift << std::endl;
+
+  // the last checkpoint is the finished run, whether or not it was interrupted on the way
+  checkpoint(block_end);
 
-    if(i == 9999){
-      c1->SaveAs("first_10000_track.png");
+  if(density_rendering){
+    save_track_density(MagneticField, density_first, drain_rectangles, output_name("first_10000_track.png"));
+    save_track_density(MagneticField, density_all, drain_rectangles, output_name("all_track.png"));
+    save_track_density(MagneticField, density_detected, drain_rectangles, output_name("detected_track.png"));
+  }else{
+    if(track_graphs.is_full()){
+      std::cout << "all_track.png shows the first " << max_graph_tracks << " tracks, density_rendering draws them all" << std::endl;
     }
+    c1->SaveAs(output_name("all_track.png"));
+    c_detected->cd();
+    c_detected->SaveAs(output_name("detected_track.png"));
   }
-  c1->SaveAs("all_track.png");
-  c_detected->cd();
-  c_detected->SaveAs("detected_track.png");
+  if(instrumentation){
+    save_track_density(MagneticField, step_density, drain_rectangles, output_name("step_density.png"));
+  }
+
+  beta_file->Write("", TObject::kOverwrite);
+  release();
+
+  if(use_cache){
+    link_cached_outputs(entry);
+  }
+}
 
-  beta_file->Write();
+// Puts the finished shards of one setup together into the files an unsharded run writes:
+// beta_tree in event order, the track store, the summed occupancy layers and step map, the checkpoint
+// parameters, and the track images drawn again from them.
+// events is the number the shards were run with.
+// Every shard file and track store is checked before anything is written, and the merged files are
+// written under temporary names and renamed at the end, so a failed merge leaves nothing behind.
+// The shard files are never removed. Returns whether the merged files are in place.
+// root -l -q -e '.L spectrometer_kinetic_hist.cpp' -e 'merge_shards(4)'
+bool merge_shards(const int shard_count, const int events = n_events){
+  const int n_blocks = (events + events_per_block - 1) / events_per_block;
+  const int n_run_events = n_blocks * events_per_block;
+
+  // the setup record of the same run unsharded, from the final checkpoints of the shards
+  TString setup;
+  for(int shard = 0; shard < shard_count; shard++){
+    const TString shard_file_name = shard_name("beta_file.root", shard, shard_count);
+    const TString shard_store_name = shard_name("beta_tracks.trk", shard, shard_count);
+    TFile* shard_file = TFile::Open(shard_file_name);
+    if(shard_file == nullptr || shard_file->IsZombie()){
+      std::cerr << "cannot read " << shard_file_name << std::endl;
+      delete shard_file;
+      return false;
+    }
+    // only a shard that got to its final checkpoint is complete
+    int block_begin, block_end;
+    shard_blocks(n_blocks, shard, shard_count, block_begin, block_end);
+    const TString shard_suffix = shard_setup_suffix(n_run_events, shard, shard_count);
+    auto checkpoint_setup = shard_file->Get<TNamed>("checkpoint_setup");
+    auto checkpoint_blocks = shard_file->Get<TParameter<int>>("checkpoint_blocks");
+    const TString shard_setup = checkpoint_setup != nullptr ? checkpoint_setup->GetTitle() : "";
+    const bool finished = shard_setup.EndsWith(shard_suffix) && checkpoint_blocks != nullptr && checkpoint_blocks->GetVal() == block_end;
+    shard_file->Close();
+    delete shard_file;
+    if(!finished){
+      std::cerr << shard_file_name << " is not a finished shard " << shard << " of " << shard_count << " of " << n_run_events << " events" << std::endl;
+      return false;
+    }
+    const TString unsharded_setup = shard_setup(0, shard_setup.Length() - shard_suffix.Length());
+    if(shard == 0){
+      setup = unsharded_setup;
+    }else if(setup != unsharded_setup){
+      std::cerr << shard_file_name << " was run with another setup" << std::endl;
+      return false;
+    }
+    // every event of a shard leaves a track
+    const TrackReader track_reader(shard_store_name.Data());
+    if(!track_reader.is_open()){
+      std::cerr << "cannot read " << shard_store_name << std::endl;
+      return false;
+    }
+    if(track_reader.quantum != track_quantum || track_reader.stride != track_stride){
+      std::cerr << shard_store_name << " is stored with another quantum or stride" << std::endl;
+      return false;
+    }
+    if(track_reader.size() != (long long)(block_end - block_begin) * events_per_block){
+      std::cerr << shard_store_name << " holds " << track_reader.size() << " tracks for " << (block_end - block_begin) * events_per_block << " events" << std::endl;
+      return false;
+    }
+  }
+
+  const TString merging = ".merging";
+  TFile* beta_file = new TFile("beta_file.root" + merging, "RECREATE", "beta spectrometer RK4 simulation data");
+  TChain* beta_chain = new TChain("beta_tree");
+  double sum_energy_drift = 0, max_energy_drift = 0;
+  TH2D* density_all = nullptr;
+  TH2D* density_first = nullptr;
+  TH2D* density_detected = nullptr;
+  TH2D* step_density = nullptr;
+  {
+    TrackWriter track_writer(("beta_tracks.trk" + merging).Data(), track_quantum, track_stride);
+    if(!track_writer.is_open()){
+      std::cerr << "cannot write beta_tracks.trk" << merging << std::endl;
+      beta_file->Close();
+      delete beta_file;
+      unlink("beta_file.root" + merging);
+      return false;
+    }
+    TrackIndexEntry entry;
+    vector<unsigned char> bytes;
+
+    for(int shard = 0; shard < shard_count; shard++){
+      const TString shard_file_name = shard_name("beta_file.root", shard, shard_count);
+      TFile* shard_file = TFile::Open(shard_file_name);
+      sum_energy_drift += shard_file->Get<TParameter<double>>("checkpoint_sum_energy_drift")->GetVal();
+      max_energy_drift = std::max(max_energy_drift, shard_file->Get<TParameter<double>>("checkpoint_max_energy_drift")->GetVal());
+
+      auto add_layer = [&](const char* name, TH2D*& merged){
+        auto layer = shard_file->Get<TH2D>(name);
+        if(layer == nullptr){
+          return;
+        }
+        if(merged == nullptr){
+          merged = (TH2D*)layer->Clone(name);
+          merged->SetDirectory(beta_file);
+        }else{
+          merged->Add(layer);
+        }
+      };
+      add_layer("track_density_all", density_all);
+      add_layer("track_density_first", density_first);
+      add_layer("track_density_detected", density_detected);
+      add_layer("step_density", step_density);
+
+      // the shards hold consecutive event ranges, so their tracks go on in event order
+      TrackReader track_reader(shard_name("beta_tracks.trk", shard, shard_count).Data());
+      for(long long position = 0; position < track_reader.size(); position++){
+        if(track_reader.read_at(position, entry, bytes)){
+          track_writer.append(entry, bytes);
+        }
+      }
+
+      beta_chain->Add(shard_file_name);
+      shard_file->Close();
+      delete shard_file;
+    }
+  }
+  beta_chain->Merge(beta_file, 0, "keep");
+
+  beta_file->cd();
+  TNamed("checkpoint_setup", setup.Data()).Write("", TObject::kOverwrite);
+  TParameter<int>("checkpoint_blocks", n_blocks).Write("", TObject::kOverwrite);
+  TParameter<double>("checkpoint_sum_energy_drift", sum_energy_drift).Write("", TObject::kOverwrite);
+  TParameter<double>("checkpoint_max_energy_drift", max_energy_drift).Write("", TObject::kOverwrite);
+  std::cout << "kinetic energy drift: mean " << sum_energy_drift / n_run_events << ", max " << max_energy_drift << std::endl;
+
+  // the merged files take the place of the outputs, links into the cache included
+  unlink_cached_outputs();
+
+  TFile* file = TFile::Open("mfield.root");
+  auto MagneticField = file->Get<TH2D>("MagneticField"); //mTesla
+  const DrainRectangles drain_rectangles = spectrometer_drain_rectangles();
+  if(density_all != nullptr){
+    save_track_density(MagneticField, density_first, drain_rectangles, "first_10000_track.png");
+    save_track_density(MagneticField, density_all, drain_rectangles, "all_track.png");
+    save_track_density(MagneticField, density_detected, drain_rectangles, "detected_track.png");
+  }else{
+    // the same canvases as an unsharded run, from the stored tracks
+    TCanvas* c1 = new TCanvas("c1", "track canvas");
+    MagneticField->Draw("COLZ");
+    TCanvas* c_detected = new TCanvas("c_detected", "detected track canvas");
+    MagneticField->Draw("COLZ");
+    for(auto& drain_rectangle:drain_rectangles){
+      drain_rectangle->tbox->Draw();
+    }
+    c1->cd();
+    for(auto& drain_rectangle:drain_rectangles){
+      drain_rectangle->tbox->Draw();
+    }
+
+    TrackGraphs track_graphs(c1, c_detected, max_graph_tracks);
+    int e_anihilation_type = 0;
+    beta_chain->SetBranchAddress("e_anihilation_type", &e_anihilation_type);
+    TrackReader track_reader(("beta_tracks.trk" + merging).Data());
+    vector<double> points;
+    for(int event = 0; event < n_run_events; event++){
+      beta_chain->GetEntry(event);
+      if(track_reader.read(event, points)){
+        track_graphs.draw(points, 1, e_anihilation_type == 1);
+      }
+      if(event == first_track_events - 1){
+        c1->SaveAs("first_10000_track.png");
+      }
+    }
+    c1->SaveAs("all_track.png");
+    c_detected->cd();
+    c_detected->SaveAs("detected_track.png");
+
+    delete c1;
+    delete c_detected;
+  }
+  if(step_density != nullptr){
+    save_track_density(MagneticField, step_density, drain_rectangles, "step_density.png");
+  }
+
+  beta_file->cd();
+  beta_file->Write("", TObject::kOverwrite);
   beta_file->Close();
 
   delete beta_file;
-  delete c1;
-  delete c_detected;
+  // all merged files or none: a failed rename moves the ones already renamed back
+  const vector<const char*> merged_names = {"beta_file.root", "beta_tracks.trk", "beta_tracks.trk.idx"};
+  for(std::size_t renamed = 0; renamed < merged_names.size(); renamed++){
+    if(rename(merged_names[renamed] + merging, merged_names[renamed]) != 0){
+      std::cerr << "cannot rename " << merged_names[renamed] << merging << " to " << merged_names[renamed] << ", the merge is left in the "
+                << merging << " files" << std::endl;
+      while(renamed-- > 0){
+        rename(merged_names[renamed], merged_names[renamed] + merging);
+      }
+      return false;
+    }
+  }
+  return true;
+}
+
+// one point of a parameter sweep
+struct SweepSetup {
+  double collimator_gap; // m
+  double detector_x; // m
+  double field_scale; // times mfield.root
+  double momentum; // eV/c, mean and width of the source
+};
+
+// Setups of a sweep file, one group per line:
+//   collimator_gap [cm]  detector_x [cm]  field_scale  momentum [MeV/c]
+// Each column is a value or a comma separated list, and a line stands for every combination
+// of its lists, so a line is a grid and a list of lines is a list of setups. # starts a comment.
+vector<SweepSetup> read_sweep_setups(const char* file_name){
+  vector<SweepSetup> setups;
+  std::ifstream sweep_file(file_name);
+  if(!sweep_file){
+    std::cerr << "cannot read " << file_name << std::endl;
+    return setups;
+  }
+  std::string line;
+  for(int line_number = 1; std::getline(sweep_file, line); line_number++){
+    line = line.substr(0, line.find('#'));
+    std::istringstream columns(line);
+    vector<vector<double>> values;
+    std::string column, item;
+    while(columns >> column){
+      std::istringstream items(column);
+      values.emplace_back();
+      while(std::getline(items, item, ',')){
+        values.back().push_back(std::stod(item));
+      }
+    }
+    if(values.empty()){
+      continue;
+    }
+    if(values.size() != 4){
+      std::cerr << file_name << ":" << line_number << ": expected collimator_gap detector_x field_scale momentum" << std::endl;
+      return {};
+    }
+    for(auto gap:values[0]){
+      for(auto detector_front:values[1]){
+        for(auto field_scale:values[2]){
+          for(auto momentum_mean:values[3]){
+            setups.push_back({gap * unit::c, detector_front * unit::c, field_scale, momentum_mean * unit::M});
+          }
+        }
+      }
+    }
+  }
+  return setups;
+}
+
+// Runs every setup of sweep_file on n_setup_events source events in one process.
+// The field is mapped once from mfield.cache and setups with the same field_scale share one MagneticFieldGrid;
+// the workers take (setup, block) items from one queue, so all setups share the thread pool.
+// Event i of every setup draws from the same Philox counter, so the setups are compared on
+// the same source electrons and their differences are far less noisy than separate runs.
+// sweep.root holds sweep_setups, one entry per setup_id, and sweep_tree with the events of all
+// setups in setup and event order, each tagged with its setup_id.
+// integrator is "rk4", "rk4_batch", "rk45" or "boris" as for spectrometer_kinetic_hist
+void spectrometer_sweep(const char* sweep_file = "sweep.txt", const int n_threads = 1, const unsigned int seed = 65539, const int n_setup_events = 100000, const TString integrator = "rk4"){
+  bool batch;
+  Integrator beam_integrator;
+  if(!parse_integrator(integrator, beam_integrator, batch)){
+    std::cerr << "unknown integrator " << integrator << std::endl;
+    return;
+  }
+  const vector<SweepSetup> setups = read_sweep_setups(sweep_file);
+  if(setups.empty()){
+    std::cerr << "no setups in " << sweep_file << std::endl;
+    return;
+  }
+  const int n_setups = setups.size();
+
+  // one field grid per field scale, one obstacle grid per setup
+  MagneticFieldGrid* magnetic_field_grid = open_magnetic_field();
+  vector<double> field_scales;
+  vector<MagneticFieldGrid*> magnetic_field_grids;
+  vector<double> field_momenta; // largest momentum of the setups of each field scale, eV/c
+  vector<int> setup_field(n_setups);
+  vector<std::unique_ptr<ObstacleGrid>> obstacle_grids(n_setups);
+  for(int setup = 0; setup < n_setups; setup++){
+    const double field_scale = setups[setup].field_scale;
+    setup_field[setup] = std::find(field_scales.begin(), field_scales.end(), field_scale) - field_scales.begin();
+    if(setup_field[setup] == (int)field_scales.size()){
+      field_scales.push_back(field_scale);
+      magnetic_field_grids.push_back(field_scale == 1 ? magnetic_field_grid : new MagneticFieldGrid(*magnetic_field_grid, field_scale));
+      field_momenta.push_back(0);
+    }
+    field_momenta[setup_field[setup]] = std::max(field_momenta[setup_field[setup]], setups[setup].momentum);
+    const MagneticFieldGrid* grid = magnetic_field_grids[setup_field[setup]];
+    obstacle_grids[setup].reset(new ObstacleGrid(grid->x_min, grid->x_max, grid->y_min, grid->y_max, grid->nx, grid->ny));
+    for(auto& drain_rectangle:spectrometer_drain_rectangles(setups[setup].collimator_gap, setups[setup].detector_x)){
+      obstacle_grids[setup]->add_rectangle(drain_rectangle->x1, drain_rectangle->x2, drain_rectangle->y1, drain_rectangle->y2, drain_rectangle->anihilation_type);
+    }
+  }
+  std::cout << n_setups << " setups over " << field_scales.size() << " field scales" << std::endl;
+  // the Boris step of a field scale holds for the fastest electrons of its setups
+  vector<double> field_dtaus; // integrator_dtau of each field scale
+  for(size_t field = 0; field < field_scales.size(); field++){
+    field_dtaus.push_back(beam_integrator == Integrator::Boris && !batch ? boris_step<2>(magnetic_field_grids[field], field_momenta[field]) : dtau);
+  }
+
+  TFile* sweep_root = new TFile("sweep.root", "RECREATE", "beta spectrometer parameter sweep");
+  TTree* sweep_tree = new TTree("sweep_tree", "beta spectrometer events of every setup");
+  int setup_id = 0;
+  double e_E = 0;
+  double e_KE = 0;
+  int e_anihilation_type = 0;
+  double e_weight = 1;
+  sweep_tree->Branch("setup_id", &setup_id);
+  sweep_tree->Branch("e_E", &e_E);
+  sweep_tree->Branch("e_KE", &e_KE);
+  sweep_tree->Branch("e_anihilation_type", &e_anihilation_type);
+  sweep_tree->Branch("e_weight", &e_weight);
+
+  ROOT::EnableThreadSafety();
+
+  const int n_workers = std::max(n_threads, 1);
+  const int n_blocks = (n_setup_events + events_per_block - 1) / events_per_block;
+  const int n_items = n_setups * n_blocks; // item = setup * n_blocks + block
+  vector<EventBlock> event_blocks(n_items);
+  vector<long long> n_detected(n_setups);
+  run_blocks(event_blocks, 0, n_items, n_workers, [&](const int item, const int){
+    const int setup = item / n_blocks, block = item % n_blocks;
+    const MagneticFieldGrid* grid = magnetic_field_grids[setup_field[setup]];
+    const vector<SourceEvent> events = source_events(block, std::min(events_per_block, n_setup_events - block * events_per_block), seed, nullptr, setups[setup].momentum);
+    EventBlock& event_block = event_blocks[item];
+    if(batch){
+      simulate_block_batch(events, grid, obstacle_grids[setup].get(), false, event_block);
+    }else{
+      simulate_block(events, grid, nullptr, obstacle_grids[setup].get(), beam_integrator, rk45_tolerance, field_dtaus[setup_field[setup]], event_block);
+    }
+    for(auto& record:event_block.records){
+      vector<double>().swap(record.orbit);
+    }
+  }, [&](const int item){
+    setup_id = item / n_blocks;
+    for(auto& record:event_blocks[item].records){
+      e_E = record.e_E;
+      e_KE = record.e_KE;
+      e_anihilation_type = record.e_anihilation_type;
+      e_weight = record.e_weight;
+      sweep_tree->Fill();
+      n_detected[setup_id] += record.e_anihilation_type == 1;
+    }
+    vector<EventRecord>().swap(event_blocks[item].records);
+  });
+
+  TTree* sweep_setups = new TTree("sweep_setups", "beta spectrometer sweep setups");
+  double setup_collimator_gap = 0, setup_detector_x = 0, setup_field_scale = 0, setup_momentum = 0;
+  int setup_events = n_setup_events;
+  long long setup_detected = 0;
+  sweep_setups->Branch("setup_id", &setup_id);
+  sweep_setups->Branch("collimator_gap", &setup_collimator_gap); // m
+  sweep_setups->Branch("detector_x", &setup_detector_x); // m
+  sweep_setups->Branch("field_scale", &setup_field_scale);
+  sweep_setups->Branch("momentum", &setup_momentum); // eV/c
+  sweep_setups->Branch("n_events", &setup_events);
+  sweep_setups->Branch("n_detected", &setup_detected);
+  for(setup_id = 0; setup_id < n_setups; setup_id++){
+    setup_collimator_gap = setups[setup_id].collimator_gap;
+    setup_detector_x = setups[setup_id].detector_x;
+    setup_field_scale = setups[setup_id].field_scale;
+    setup_momentum = setups[setup_id].momentum;
+    setup_detected = n_detected[setup_id];
+    sweep_setups->Fill();
+    std::cout << "setup " << setup_id << ": gap " << setup_collimator_gap / unit::c << " cm, detector " << setup_detector_x / unit::c << " cm, field x" << setup_field_scale
+              << ", momentum " << setup_momentum / unit::M << " MeV/c: " << setup_detected << " of " << n_setup_events << " detected" << std::endl;
+  }
+
+  sweep_root->Write();
+  sweep_root->Close();
+
+  delete sweep_root;
+  for(auto grid:magnetic_field_grids){
+    if(grid != magnetic_field_grid){
+      delete grid;
+    }
+  }
+  delete magnetic_field_grid;
 }
\ No newline at end of file
@@ -0,0 +1,135 @@
+#ifndef RUNGE_SPECTROMETER_KINETIC_HIST_H
+#define RUNGE_SPECTROMETER_KINETIC_HIST_H
+
+#include <chrono>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "TString.h"
+
+#include "../tracker/beam_rk4.h"
+#include "../tracker/drain_rectangle.h"
+#include "../tracker/field_region_map.h"
+#include "../tracker/importance_source.h"
+#include "../tracker/magnetic_field_grid.h"
+#include "../tracker/obstacle_grid.h"
+#include "../tracker/units.h"
+
+// The setup and the simulation of blocks of events, as spectrometer_kinetic_hist.cpp defines them
+// and benchmark.cpp times them. In ROOT benchmark.cpp needs the macro loaded first, see there.
+
+const int n_events = 1000000; // unless asked for another number
+
+const double momentum = 1 * unit::M; // eV
+const double source_x = -1 * unit::c, source_y = 4 * unit::c; // m
+const double collimator_gap = 0.2 * unit::c; // m, of both collimators, centred on the source line
+const double detector_x = 4.5 * unit::c; // m, front face of the detector
+
+const double tau_final = 1 * unit::n * second; // m
+const double dtau = 0.001 * unit::n * second; // m
+
+const int events_per_block = 1000; // events a worker takes at a time
+
+// tracking out of the plane, see three_dimensional
+const double field_half_height = 2 * unit::c; // m, the 3D map spans the gap between the poles
+const int field_nz = 21; // bins of a 3D map made from the midplane one, odd so a node lies in the midplane
+const double detector_half_height = 0.5 * unit::c; // m, the collimators fill the gap
+const double source_vertical_angle = 0.1; // rad, the source is isotropic within this of the midplane
+
+// one finished electron, kept until it is merged into beta_tree
+struct EventRecord {
+  double e_E;
+  double e_KE;
+  int e_anihilation_type;
+  double e_weight;
+  std::vector<double> orbit; // x, y pairs, m
+  double energy_drift;
+  // for the instrumentation branches
+  int steps;
+  double wall_time; // s, only measured when asked for
+  long long field_evaluations;
+  int termination;
+};
+
+using PixelCounts = std::vector<std::pair<unsigned int, unsigned int>>; // (pixel, count), see TrackRaster::take
+
+struct EventBlock {
+  std::vector<EventRecord> records;
+  PixelCounts pixels_all, pixels_first, pixels_detected; // the block's tracks in TrackLayers, with density_rendering
+  bool done = false; // seen by the writer of run_blocks
+};
+
+// one electron leaving the source
+struct SourceEvent {
+  SpaceVector<2> momentum; // eV/c, in the plane
+  double weight; // p / q of the source it was drawn from
+  double momentum_amount; // eV
+  double angle;
+  double momentum_z; // eV/c, out of the plane, 0 unless the source has a vertical_angle
+};
+
+using DrainRectangles = std::vector<std::unique_ptr<DrainRectangle>>;
+
+double seconds_since(const std::chrono::steady_clock::time_point start);
+std::vector<SourceEvent> source_events(const int block, const int n_block_events, const unsigned int seed, const ImportanceSource* importance = nullptr, const double momentum_mean = momentum, const double vertical_angle = 0);
+void simulate_block_batch(const std::vector<SourceEvent>& events, const MagneticFieldGrid* magnetic_field, const ObstacleGrid* obstacles, const bool keep_orbits, EventBlock& event_block, const bool timed = false);
+void simulate_block(const std::vector<SourceEvent>& events, const MagneticFieldGrid* magnetic_field, const FieldRegionMap* region_map, const ObstacleGrid* obstacles, const Integrator integrator, const double tolerance, const double integrator_dtau, EventBlock& event_block, const bool timed = false);
+template <int D>
+double boris_step(const typename TrackerSpace<D>::Field* magnetic_field, const double source_momentum);
+MagneticFieldGrid* open_magnetic_field();
+DrainRectangles spectrometer_drain_rectangles(const double gap = collimator_gap, const double detector_front = detector_x);
+
+// the integrator an integrator option names: "rk4" (fixed dtau), "rk4_batch" (the same with
+// BatchRK4), "rk45" or "boris"; false for any other name
+inline bool parse_integrator(const TString& name, Integrator& integrator, bool& batch){
+  batch = name == "rk4_batch";
+  integrator = name == "rk45" ? Integrator::RK45 : name == "boris" ? Integrator::Boris : Integrator::RK4;
+  return batch || name == "rk4" || name == "rk45" || name == "boris";
+}
+
+// What spectrometer_kinetic_hist is asked to do, see there. These are the only defaults: the
+// macro and the runner both start from them. In ROOT the members can be given in order, e.g.
+//   spectrometer_kinetic_hist({8, 65539, "rk45"})
+// and the runner takes them the same way, or by name as name=value.
+struct KineticHistOptions {
+  int n_threads = 1;
+  unsigned int seed = 65539;
+  TString integrator = "rk4"; // rk4, rk4_batch, rk45 or boris
+  double tolerance = rk45_tolerance; // of rk45
+  bool region_stepping = false;
+  bool density_rendering = true;
+  bool importance_sampling = false;
+  bool resume = false;
+  int shard_index = 0;
+  int shard_count = 1;
+  double field_smoothing = 0;
+  bool instrumentation = false;
+  int events = n_events;
+  bool cached = true;
+  bool three_dimensional = false;
+
+  // visit(name, member) for every member, in order
+  template <class Visit>
+  void visit(Visit&& visit){
+    visit("n_threads", n_threads);
+    visit("seed", seed);
+    visit("integrator", integrator);
+    visit("tolerance", tolerance);
+    visit("region_stepping", region_stepping);
+    visit("density_rendering", density_rendering);
+    visit("importance_sampling", importance_sampling);
+    visit("resume", resume);
+    visit("shard_index", shard_index);
+    visit("shard_count", shard_count);
+    visit("field_smoothing", field_smoothing);
+    visit("instrumentation", instrumentation);
+    visit("events", events);
+    visit("cached", cached);
+    visit("three_dimensional", three_dimensional);
+  }
+};
+
+void spectrometer_kinetic_hist(const KineticHistOptions& options = KineticHistOptions());
+
+#endif
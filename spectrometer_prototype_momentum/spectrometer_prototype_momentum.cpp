@@ -1,146 +1,24 @@
-using LorentzX = ROOT::Math::XYZTVector;
-using LorentzP = ROOT::Math::PxPyPzEVector;
-using LorentzP_M = ROOT::Math::PxPyPzMVector;
-
-const double c = 300 * 1000 * 1000; // m/s
-const double Tesla = c; // eV/m
-const double second = c; // m
-
-namespace unit {
-  const double n = 0.001 * 0.001 * 0.001;
-  const double micro = 0.001 * 0.001;
-  const double m = 0.001;
-  const double c = 0.01;
-  const double k = 1000;
-  const double M = 1000 * 1000;
-  const double G = 1000 * 1000 * 1000;
-}
-
-const double mass_e = 511 * unit::k; // eV
-const double charge_e = -1; // e = 1
+#include "TCanvas.h"
+#include "TFile.h"
+#include "TH2D.h"
+#include "TMath.h"
+#include "TRandom.h"
+#include "TTree.h"
+
+#include "../tracker/beam_rk4.h"
+#include "../tracker/drain_rectangle.h"
+#include "../tracker/magnetic_field_grid.h"
+#include "../tracker/obstacle_grid.h"
+#include "../tracker/track_graph.h"
+#include "../tracker/units.h"
+
+using std::vector;
+
 const double momentum = 1 * unit::M; // eV
 
 const double tau_final = 1 * unit::n * second; // m
 const double dtau = 0.001 * unit::n * second; // m
 
-const double edge_margin = 0.005;
-
-class DrainRectangle;
-
-class BeamRK4 {
-  public:
-    BeamRK4(const LorentzX, const LorentzP_M, const double, TH2D*, const double, const double);
-    void step_RK4();
-    void plot_orbit_point();
-    void set_magnetic_unit(const double magnetic_unit);
-    void set_length_unit(const double length_unit);
-    void add_drain_rectangle(DrainRectangle*);
-    bool is_anihilated();
-
-    LorentzX x;
-    LorentzP p;
-
-    const double charge;
-    
-    TH2D* magnetic_field;
-    double magnetic_field_unit = 1.0; //c*eV/m
-    double length_unit = 1.0; // m
-
-    vector<DrainRectangle*> drain_rectangles;
-
-    TGraph* orbit;
-    int tau_index = 0;
-    const double dtau;
-    const double tau_final;
-    int anihilation_type = 0;
-
-  private:
-    LorentzX get_dx(const LorentzP p);
-    LorentzP get_dp(const LorentzX x, const LorentzP p);
-};
-
-class DrainRectangle{
-  public:
-    DrainRectangle(const double x1, const double x2, const double y1, const double y2, const double length_unit, const int anihilation_type)
-      : x1(x1), x2(x2), y1(y1), y2(y2), length_unit(length_unit), anihilation_type(anihilation_type){
-        tbox = new TBox(x1 / length_unit, y1 / length_unit, x2 / length_unit, y2 / length_unit);
-        tbox->SetFillStyle(3001);
-        tbox->SetFillColor(kRed);
-      }
-    bool is_collided(BeamRK4* beam_RK4){
-      return (x1 <= beam_RK4->x.X() && beam_RK4->x.X() <= x2 && y1 <= beam_RK4->x.Y() && beam_RK4->x.Y() <= y2);
-    }
-
-    const double x1, x2, y1, y2;
-    double length_unit;
-    TBox* tbox;
-    const int anihilation_type;
-};
-
-BeamRK4::BeamRK4(const LorentzX initial_x, const LorentzP_M initial_p, const double particle_charge, TH2D* _magnetic_field, const double dtau, const double tau_final)
-: x(initial_x), p(initial_p), charge(particle_charge), magnetic_field(_magnetic_field), dtau(dtau), tau_final(tau_final){
-  orbit = new TGraph();
-}
-
-void BeamRK4::plot_orbit_point(){
-  orbit->SetPoint(tau_index, x.X() / length_unit, x.Y() / length_unit);
-  tau_index++;
-}
-
-LorentzX BeamRK4::get_dx(const LorentzP p){
-  return p / this->p.M() * dtau;
-}
-
-LorentzP BeamRK4::get_dp(const LorentzX x, const LorentzP p){
-  auto dp = charge * magnetic_field->Interpolate(x.X() / length_unit, x.Y() / length_unit) * magnetic_field_unit * LorentzP(p.Y(), -p.X(), 0, 0) / this->p.M() * dtau;
-  return dp;
-}
-
-void BeamRK4::set_magnetic_unit(const double magnetic_field_unit){
-  this->magnetic_field_unit = magnetic_field_unit;
-}
-
-void BeamRK4::set_length_unit(const double length_unit){
-  this->length_unit = length_unit;
-}
-
-void BeamRK4::add_drain_rectangle(DrainRectangle* drain_rectangle){
-  drain_rectangles.emplace_back(drain_rectangle);
-}
-
-bool BeamRK4::is_anihilated(){
-  if(tau_index * dtau > tau_final){
-    return true;
-  }
-  if(x.X() - edge_margin <= magnetic_field->GetXaxis()->GetXmin() * length_unit || magnetic_field->GetXaxis()->GetXmax() * length_unit <= x.X() + edge_margin || x.Y() - edge_margin <= magnetic_field->GetYaxis()->GetXmin() * length_unit || magnetic_field->GetYaxis()->GetXmax() * length_unit <= x.Y() + edge_margin){
-    return true;
-  }
-  for(auto drain_rectangle:drain_rectangles){
-    if(drain_rectangle->is_collided(this)){
-      anihilation_type = drain_rectangle->anihilation_type;
-      return true;
-    }
-  }
-  return false;
-}
-
-void BeamRK4::step_RK4(){
-  auto dx1 = get_dx(p);
-  auto dp1 = get_dp(x, p);
-
-  auto dx2 = get_dx(p + dp1 / 2);
-  auto dp2 = get_dp(x + dx1 / 2, p + dp1 / 2);
-
-  auto dx3 = get_dx(p + dp2 / 2);
-  auto dp3 = get_dp(x + dx2 / 2, p + dp2 / 2);
-
-  auto dx4 = get_dx(p + dp3);
-  auto dp4 = get_dp(x + dx3, p + dp3);
-
-  x += (dx1 + 2 * dx2 + 2 * dx3 + dx4) / 6;
-  p += (dp1 + 2 * dp2 + 2 * dp3 + dp4) / 6;
-}
-
 void spectrometer_prototype_momentum(){
   TCanvas* c1 = new TCanvas("c1", "track canvas");
 
@@ -186,42 +64,44 @@ void spectrometer_prototype_momentum(){
   detector->tbox->Draw();
   c1->cd();
 
+  // the electrons see the field and the rectangles through the grids of the tracker
+  const MagneticFieldGrid magnetic_field_grid(MagneticField, cm, unit::m * Tesla);
+  ObstacleGrid obstacle_grid(magnetic_field_grid.x_min, magnetic_field_grid.x_max, magnetic_field_grid.y_min, magnetic_field_grid.y_max, magnetic_field_grid.nx, magnetic_field_grid.ny);
+  for(auto drain_rectangle:{top_collimator_left, top_collimator_right, side_collimator_top, side_collimator_bottom, detector}){
+    obstacle_grid.add_rectangle(drain_rectangle->x1, drain_rectangle->x2, drain_rectangle->y1, drain_rectangle->y2, drain_rectangle->anihilation_type);
+  }
+
   TRandom* trandom_momentum = new TRandom();
   TRandom* trandom_angle = new TRandom();
 
   for(int i = 0; i < 1000000; i++){
-    const auto initial_coordinates = LorentzX(-1 * unit::c, 4 * unit::c, 0, 0); // metre, second
+    const SpaceVector<2> initial_coordinates = {{-1 * unit::c, 4 * unit::c}}; // m
 
     double momentum_amount = 0;
     while(momentum_amount <= 0){
       momentum_amount = trandom_momentum->Gaus(momentum, momentum);
     }
     double angle = trandom_angle->Rndm() * 2 * TMath::Pi(); 
-    const auto initial_momentum = LorentzP_M(momentum_amount * TMath::Cos(angle), momentum_amount * TMath::Sin(angle), 0, mass_e); // eV/c, eV
+    const SpaceVector<2> initial_momentum = {{momentum_amount * TMath::Cos(angle), momentum_amount * TMath::Sin(angle)}}; // eV/c
 
-    BeamRK4 beam_RK4 = BeamRK4(initial_coordinates, initial_momentum, charge_e, MagneticField, dtau, tau_final);
-    beam_RK4.set_magnetic_unit(unit::m * Tesla);
-    beam_RK4.set_length_unit(unit::c);
-    beam_RK4.add_drain_rectangle(top_collimator_left);
-    beam_RK4.add_drain_rectangle(top_collimator_right);
-    beam_RK4.add_drain_rectangle(side_collimator_top);
-    beam_RK4.add_drain_rectangle(side_collimator_bottom);
-    beam_RK4.add_drain_rectangle(detector);
+    BeamRK4 beam_RK4 = BeamRK4(initial_coordinates, initial_momentum, mass_e, charge_e, &magnetic_field_grid, dtau, tau_final);
+    beam_RK4.set_obstacles(&obstacle_grid);
 
     beam_RK4.plot_orbit_point();
 
     while(!beam_RK4.is_anihilated()){
-      beam_RK4.step_RK4();
+      beam_RK4.step();
       beam_RK4.plot_orbit_point();
     }
-    e_E = beam_RK4.p.E();
+    TGraph* orbit = track_graph(beam_RK4.orbit);
+    e_E = beam_RK4.energy();
     e_anihilation_type = beam_RK4.anihilation_type;
     beta_tree->Fill();
-    beam_RK4.orbit->Draw("SAME");
+    orbit->Draw("SAME");
 
     if(beam_RK4.anihilation_type == 1){
       c_detected->cd();
-      beam_RK4.orbit->Draw("SAME");
+      orbit->Draw("SAME");
       c1->cd();
     }
 
@@ -0,0 +1,35 @@
+#ifndef RUNGE_TESTS_CHECK_H
+#define RUNGE_TESTS_CHECK_H
+
+#include <cmath>
+#include <iostream>
+#include <string>
+
+// The checks of a test program: every failed one is printed, and check_status is the exit
+// status ctest reads, the number of failures.
+
+inline int check_failures = 0;
+
+inline void check(const bool passed, const std::string& what){
+  if(!passed){
+    std::cerr << "FAILED: " << what << std::endl;
+    check_failures++;
+  }
+}
+
+// |value - expected| <= tolerance
+inline void check_near(const double value, const double expected, const double tolerance, const std::string& what){
+  if(!(std::fabs(value - expected) <= tolerance)){
+    std::cerr << "FAILED: " << what << ": " << value << " instead of " << expected << " within " << tolerance << std::endl;
+    check_failures++;
+  }
+}
+
+inline int check_status(){
+  if(check_failures == 0){
+    std::cout << "all checks passed" << std::endl;
+  }
+  return check_failures;
+}
+
+#endif
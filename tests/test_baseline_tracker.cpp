@@ -0,0 +1,240 @@
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "Math/Vector4D.h"
+#include "TH2D.h"
+#include "TMath.h"
+
+#include "batch_rk4.h"
+#include "beam_rk4.h"
+#include "field_region_map.h"
+#include "magnetic_field_grid.h"
+#include "units.h"
+
+#include "check.h"
+
+// The trackers against the one every setup used before them: the BeamRK4 of the first
+// spectrometer_kinetic_hist, which stepped Lorentz vectors through TH2D::Interpolate. Its step
+// is repeated here as it was, and every tracker has to follow its electrons.
+
+using LorentzX = ROOT::Math::XYZTVector;
+using LorentzP = ROOT::Math::PxPyPzEVector;
+using LorentzP_M = ROOT::Math::PxPyPzMVector;
+
+const double source_x = -1 * unit::c, source_y = 4 * unit::c; // m
+const double dtau = 0.001 * unit::n * second; // m
+const double tau_final = 1 * unit::n * second; // m
+
+const double step_tolerance = 1e-9; // m, between trackers taking the same RK4 steps
+const double end_tolerance = 1 * unit::micro; // m, between RK4 and RK45 or analytic arcs at tau_final
+const double boris_tolerance = 10 * unit::micro; // m, Boris is second order
+
+// the baseline step, without the drawing and the collimators
+class BaselineRK4 {
+  public:
+    BaselineRK4(const LorentzX initial_x, const LorentzP_M initial_p, TH2D* magnetic_field)
+    : x(initial_x), p(initial_p), magnetic_field(magnetic_field){}
+
+    bool is_anihilated(){
+      if(tau_index * dtau > tau_final){
+        return true;
+      }
+      return x.X() - edge_margin <= magnetic_field->GetXaxis()->GetXmin() * unit::c || magnetic_field->GetXaxis()->GetXmax() * unit::c <= x.X() + edge_margin
+             || x.Y() - edge_margin <= magnetic_field->GetYaxis()->GetXmin() * unit::c || magnetic_field->GetYaxis()->GetXmax() * unit::c <= x.Y() + edge_margin;
+    }
+
+    void step_RK4(){
+      auto dx1 = get_dx(p);
+      auto dp1 = get_dp(x, p);
+      auto dx2 = get_dx(p + dp1 / 2);
+      auto dp2 = get_dp(x + dx1 / 2, p + dp1 / 2);
+      auto dx3 = get_dx(p + dp2 / 2);
+      auto dp3 = get_dp(x + dx2 / 2, p + dp2 / 2);
+      auto dx4 = get_dx(p + dp3);
+      auto dp4 = get_dp(x + dx3, p + dp3);
+      x += (dx1 + 2 * dx2 + 2 * dx3 + dx4) / 6;
+      p += (dp1 + 2 * dp2 + 2 * dp3 + dp4) / 6;
+    }
+
+    LorentzX x;
+    LorentzP p;
+    TH2D* magnetic_field;
+    int tau_index = 1; // the start is the first orbit point
+
+  private:
+    LorentzX get_dx(const LorentzP p){
+      return LorentzX(p / this->p.M() * dtau);
+    }
+
+    LorentzP get_dp(const LorentzX x, const LorentzP p){
+      return charge_e * magnetic_field->Interpolate(x.X() / unit::c, x.Y() / unit::c) * unit::m * Tesla * LorentzP(p.Y(), -p.X(), 0, 0) / this->p.M() * dtau;
+    }
+};
+
+// positions after every step, x, y pairs
+struct BaselineTrack {
+  std::vector<double> points;
+  bool at_edge; // rather than out of time
+  double kinetic_energy; // eV
+};
+
+BaselineTrack baseline_track(TH2D* histogram, const double px, const double py){
+  BaselineRK4 baseline(LorentzX(source_x, source_y, 0, 0), LorentzP_M(px, py, 0, mass_e), histogram);
+  BaselineTrack track = {{source_x, source_y}, false, 0};
+  while(!baseline.is_anihilated()){
+    baseline.step_RK4();
+    baseline.tau_index++;
+    track.points.push_back(baseline.x.X());
+    track.points.push_back(baseline.x.Y());
+  }
+  track.at_edge = !(baseline.tau_index * dtau > tau_final);
+  track.kinetic_energy = baseline.p.E() - baseline.p.M();
+  return track;
+}
+
+// largest distance between the points both tracks have
+double track_distance(const std::vector<double>& a, const std::vector<double>& b){
+  double distance = 0;
+  for(std::size_t i = 0; i + 1 < std::min(a.size(), b.size()); i += 2){
+    distance = std::max(distance, std::hypot(a[i] - b[i], a[i + 1] - b[i + 1]));
+  }
+  return distance;
+}
+
+int main(){
+  // a nonuniform map in cm and mT, as mfield.root
+  TH2D histogram("MagneticField", "MagneticField", 200, -10, 10, 200, -10, 10);
+  for(int i = 1; i <= 200; i++){
+    for(int j = 1; j <= 200; j++){
+      const double x = histogram.GetXaxis()->GetBinCenter(i), y = histogram.GetYaxis()->GetBinCenter(j);
+      histogram.SetBinContent(i, j, 30 + 6 * std::sin(x / 4) * std::cos(y / 5) + 0.5 * y);
+    }
+  }
+  const MagneticFieldGrid grid(&histogram, unit::c, unit::m * Tesla);
+
+  double worst_field = 0;
+  for(int i = 0; i < 200; i++){
+    for(int j = 0; j < 200; j++){
+      const double x = (-10 + 0.1003 * i) * unit::c, y = (-10 + 0.0997 * j) * unit::c;
+      const double expected = histogram.Interpolate(x / unit::c, y / unit::c) * unit::m * Tesla;
+      worst_field = std::max(worst_field, std::fabs(grid.field(x, y) - expected) / (unit::m * Tesla));
+    }
+  }
+  check_near(worst_field, 0, 1e-12, "MagneticFieldGrid against TH2D::Interpolate, mT");
+
+  std::vector<double> momenta_x, momenta_y;
+  for(const double momentum:{0.5 * unit::M, 1 * unit::M, 2 * unit::M}){
+    for(int direction = 0; direction < 24; direction++){
+      const double angle = 2 * TMath::Pi() * (direction + 0.25) / 24;
+      momenta_x.push_back(momentum * std::cos(angle));
+      momenta_y.push_back(momentum * std::sin(angle));
+    }
+  }
+  const int n_electrons = momenta_x.size();
+  std::vector<BaselineTrack> baseline(n_electrons);
+  for(int electron = 0; electron < n_electrons; electron++){
+    baseline[electron] = baseline_track(&histogram, momenta_x[electron], momenta_y[electron]);
+  }
+  const int at_edge = std::count_if(baseline.begin(), baseline.end(), [](const BaselineTrack& track){ return track.at_edge; });
+  check(0 < at_edge && at_edge < n_electrons, "electrons both leave the map and stay in it");
+
+  // BeamRK4 takes the same steps
+  double worst_step = 0, worst_energy = 0;
+  std::vector<std::vector<double>> rk4_points(n_electrons);
+  for(int electron = 0; electron < n_electrons; electron++){
+    BeamRK4 tracker({source_x, source_y}, {momenta_x[electron], momenta_y[electron]}, mass_e, charge_e, &grid, dtau, tau_final);
+    std::vector<double>& points = rk4_points[electron];
+    points = {source_x, source_y};
+    while(!tracker.is_anihilated()){
+      tracker.step();
+      points.push_back(tracker.x[0]);
+      points.push_back(tracker.x[1]);
+    }
+    worst_step = std::max(worst_step, track_distance(points, baseline[electron].points));
+    if(baseline[electron].at_edge){
+      check(points.size() == baseline[electron].points.size(), "BeamRK4 leaves the map at the step the baseline does, electron " + std::to_string(electron));
+      worst_energy = std::max(worst_energy, std::fabs(tracker.kinetic_energy() / baseline[electron].kinetic_energy - 1));
+    }
+  }
+  check_near(worst_step, 0, step_tolerance, "BeamRK4 against the baseline, every step, m");
+  check_near(worst_energy, 0, 1e-10, "BeamRK4 kinetic energy at the edge against the baseline, relative");
+
+  // BatchRK4 too, whichever vector step this processor runs
+  std::vector<std::vector<double>> batch_points(n_electrons);
+  BatchRK4 batch(&grid, charge_e, dtau, tau_final, edge_margin, 16);
+  batch.set_keep_orbits(true);
+  int next_electron = 0;
+  batch.run([&](BatchParticle& particle){
+    if(next_electron == n_electrons){
+      return false;
+    }
+    particle = {next_electron, source_x, source_y, momenta_x[next_electron], momenta_y[next_electron], mass_e};
+    next_electron++;
+    return true;
+  }, [&](const BatchResult& result, const std::vector<double>& orbit){
+    batch_points[result.event] = orbit;
+  });
+  double worst_batch = 0;
+  for(int electron = 0; electron < n_electrons; electron++){
+    worst_batch = std::max(worst_batch, track_distance(batch_points[electron], baseline[electron].points));
+    check(batch_points[electron].size() == rk4_points[electron].size(), "BatchRK4 takes the steps BeamRK4 takes, electron " + std::to_string(electron));
+  }
+  check_near(worst_batch, 0, step_tolerance, "BatchRK4 against the baseline, every step, m");
+
+  // RK45 and Boris step differently, so only where both stay in the map until tau_final
+  for(const Integrator integrator:{Integrator::RK45, Integrator::Boris}){
+    double worst_end = 0;
+    for(int electron = 0; electron < n_electrons; electron++){
+      if(baseline[electron].at_edge){
+        continue;
+      }
+      BeamRK4 tracker({source_x, source_y}, {momenta_x[electron], momenta_y[electron]}, mass_e, charge_e, &grid, dtau, tau_final);
+      tracker.set_integrator(integrator);
+      while(!tracker.is_anihilated()){
+        tracker.step();
+      }
+      const std::vector<double>& reference = rk4_points[electron];
+      check(tracker.tau == tau_final, "ends at tau_final, electron " + std::to_string(electron));
+      worst_end = std::max(worst_end, std::hypot(tracker.x[0] - reference.end()[-2], tracker.x[1] - reference.end()[-1]));
+    }
+    if(integrator == Integrator::RK45){
+      check_near(worst_end, 0, end_tolerance, "RK45 end points against RK4, m");
+    }else{
+      check_near(worst_end, 0, boris_tolerance, "Boris end points against RK4, m");
+    }
+  }
+
+  // analytic arcs through a uniform map end where the baseline RK4 ends
+  TH2D uniform("uniform", "uniform", 50, -10, 10, 50, -10, 10);
+  for(int i = 1; i <= 50; i++){
+    for(int j = 1; j <= 50; j++){
+      uniform.SetBinContent(i, j, 30);
+    }
+  }
+  const MagneticFieldGrid uniform_grid(&uniform, unit::c, unit::m * Tesla);
+  const FieldRegionMap region_map(&uniform_grid, 1e-4);
+  double worst_arc = 0;
+  int arcs = 0;
+  for(int electron = 0; electron < n_electrons; electron++){
+    const BaselineTrack reference = baseline_track(&uniform, momenta_x[electron], momenta_y[electron]);
+    if(reference.at_edge){
+      continue;
+    }
+    BeamRK4 tracker({source_x, source_y}, {momenta_x[electron], momenta_y[electron]}, mass_e, charge_e, &uniform_grid, dtau, tau_final);
+    tracker.set_region_map(&region_map);
+    while(!tracker.is_anihilated()){
+      tracker.step();
+    }
+    arcs++;
+    // the baseline may stop one step short of tau_final
+    const double missing_steps = (tau_final - dtau * (reference.points.size() / 2 - 1)) / dtau;
+    check(missing_steps < 1.5, "the baseline stops within a step of tau_final");
+    worst_arc = std::max(worst_arc, std::hypot(tracker.x[0] - reference.points.end()[-2], tracker.x[1] - reference.points.end()[-1]) - missing_steps * dtau * 2 * unit::M / mass_e);
+  }
+  check(arcs > 0, "some electrons stay in the uniform map");
+  check_near(std::max(worst_arc, 0.0), 0, end_tolerance, "region stepping end points against the baseline, m");
+
+  return check_status();
+}
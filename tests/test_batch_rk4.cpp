@@ -0,0 +1,109 @@
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "TH2D.h"
+
+#include "batch_rk4.h"
+#include "beam_rk4.h"
+#include "magnetic_field_grid.h"
+#include "obstacle_grid.h"
+#include "units.h"
+
+#include "check.h"
+
+// BatchRK4 against BeamRK4 with RK4 bit for bit, every point of every orbit, with each vector
+// step this processor has, electrons stopped by obstacles, at the edge and at tau_final.
+
+const double source_x = -1 * unit::c, source_y = 4 * unit::c; // m
+const double dtau = 0.001 * unit::n * second; // m
+const double tau_final = 1 * unit::n * second; // m
+const int n_electrons = 300;
+
+struct Electron {
+  BatchResult result;
+  std::vector<double> orbit;
+};
+
+int main(){
+  // a field that changes from bin to bin, so every lane gathers other nodes
+  TH2D histogram("MagneticField", "MagneticField", 60, -10, 10, 60, -6, 14);
+  for(int i = 1; i <= 60; i++){
+    for(int j = 1; j <= 60; j++){
+      const double x = histogram.GetXaxis()->GetBinCenter(i), y = histogram.GetYaxis()->GetBinCenter(j);
+      histogram.SetBinContent(i, j, 40 + 15 * std::sin(x / 4) * std::cos(y / 5) + 0.5 * std::sin(3.7 * i * j));
+    }
+  }
+  const MagneticFieldGrid grid(&histogram, unit::c, unit::m * Tesla);
+  ObstacleGrid obstacles(grid.x_min, grid.x_max, grid.y_min, grid.y_max, grid.nx, grid.ny);
+  obstacles.add_rectangle(1 * unit::c, 2 * unit::c, -6 * unit::c, 3.9 * unit::c, 0);
+  obstacles.add_rectangle(1 * unit::c, 2 * unit::c, 4.1 * unit::c, 14 * unit::c, 0);
+  obstacles.add_rectangle(-4 * unit::c, -3 * unit::c, -2 * unit::c, 2 * unit::c, 1);
+
+  // electrons of 0.2 to 3 MeV/c in every direction, and some heavier particles, so the lanes
+  // step with other factors h / m
+  std::vector<SpaceVector<2>> momenta(n_electrons);
+  std::vector<double> masses(n_electrons);
+  for(int electron = 0; electron < n_electrons; electron++){
+    masses[electron] = electron % 3 == 0 ? 1.7 * mass_e : mass_e;
+    const double amount = (0.2 + 2.8 * std::fmod(electron * 0.618034, 1.0)) * unit::M;
+    const double angle = 2 * M_PI * electron / n_electrons;
+    momenta[electron] = {{amount * std::cos(angle), amount * std::sin(angle)}};
+  }
+
+  std::vector<Electron> single(n_electrons);
+  int terminations[3] = {0, 0, 0}; // obstacle, tau_final, edge
+  for(int electron = 0; electron < n_electrons; electron++){
+    BeamRK4 beam_RK4({{source_x, source_y}}, momenta[electron], masses[electron], charge_e, &grid, dtau, tau_final);
+    beam_RK4.set_obstacles(&obstacles);
+    beam_RK4.plot_orbit_point();
+    while(!beam_RK4.is_anihilated()){
+      beam_RK4.step();
+      beam_RK4.plot_orbit_point();
+    }
+    single[electron].result = {electron, beam_RK4.energy(), beam_RK4.kinetic_energy(), beam_RK4.anihilation_type, beam_RK4.obstacle, beam_RK4.tau, beam_RK4.tau_index};
+    single[electron].orbit = beam_RK4.orbit;
+    terminations[beam_RK4.obstacle >= 0 ? 0 : beam_RK4.tau >= tau_final ? 1 : 2]++;
+  }
+  check(terminations[0] > 0 && terminations[1] > 0 && terminations[2] > 0, "the electrons end on obstacles, at tau_final and at the edge");
+
+  const BatchRK4::Gathers available = BatchRK4::available_gathers();
+  for(const BatchRK4::Gathers gathers:{BatchRK4::Gathers::None, BatchRK4::Gathers::AVX2, BatchRK4::Gathers::AVX512}){
+    if(available < gathers){
+      continue;
+    }
+    const std::string name = gathers == BatchRK4::Gathers::None ? "without gathers" : gathers == BatchRK4::Gathers::AVX2 ? "with AVX2" : "with AVX-512";
+    for(const bool keep_orbits:{true, false}){
+      std::vector<Electron> batch(n_electrons);
+      // fewer lanes than electrons, so lanes are refilled and compacted
+      BatchRK4 batch_RK4(&grid, charge_e, dtau, tau_final, edge_margin, 64, gathers);
+      check(batch_RK4.gathers == gathers, "the batch steps " + name);
+      batch_RK4.set_keep_orbits(keep_orbits);
+      batch_RK4.set_obstacles(&obstacles);
+      int next = 0;
+      batch_RK4.run([&](BatchParticle& particle){
+        if(next == n_electrons){
+          return false;
+        }
+        particle = {next, source_x, source_y, momenta[next].X(), momenta[next].Y(), masses[next]};
+        next++;
+        return true;
+      }, [&](const BatchResult& result, const std::vector<double>& orbit){
+        batch[result.event] = {result, orbit};
+      });
+
+      bool same_ends = true, same_orbits = true;
+      for(int electron = 0; electron < n_electrons; electron++){
+        const BatchResult& a = single[electron].result;
+        const BatchResult& b = batch[electron].result;
+        same_ends = same_ends && a.e_E == b.e_E && a.e_KE == b.e_KE && a.anihilation_type == b.anihilation_type && a.obstacle == b.obstacle && a.tau == b.tau && a.steps == b.steps;
+        same_orbits = same_orbits && (keep_orbits ? batch[electron].orbit == single[electron].orbit : batch[electron].orbit.empty());
+      }
+      const std::string run = name + (keep_orbits ? ", orbits kept" : ", no orbits");
+      check(same_ends, "BatchRK4 ends every electron as BeamRK4, bit for bit, " + run);
+      check(same_orbits, keep_orbits ? "BatchRK4 takes every step of BeamRK4, bit for bit, " + run : "BatchRK4 keeps no orbits unless asked, " + run);
+    }
+  }
+
+  return check_status();
+}
@@ -0,0 +1,83 @@
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bounded_queue.h"
+
+#include "check.h"
+
+// The queue in order and at capacity from one thread, and with several producers and consumers
+// every value pushed popped exactly once.
+
+int main(){
+  check(BoundedQueue<int>(0).capacity() == 2 && BoundedQueue<int>(1).capacity() == 2, "capacity at least 2");
+  check(BoundedQueue<int>(5).capacity() == 8 && BoundedQueue<int>(64).capacity() == 64, "capacity rounded up to a power of two");
+
+  BoundedQueue<int> queue(8);
+  int value = -1;
+  check(!queue.try_pop(value), "an empty queue pops nothing");
+  // several laps around the cells
+  bool in_order = true;
+  for(int lap = 0; lap < 5; lap++){
+    for(int i = 0; i < 8; i++){
+      in_order = in_order && queue.try_push(10 * lap + i);
+    }
+    check(!queue.try_push(-1), "a full queue takes nothing, lap " + std::to_string(lap));
+    check(queue.depth() == 8, "depth of a full queue, lap " + std::to_string(lap));
+    for(int i = 0; i < 8; i++){
+      in_order = in_order && queue.try_pop(value) && value == 10 * lap + i;
+    }
+  }
+  check(in_order, "values come out in the order they went in");
+  check(queue.depth() == 0 && !queue.try_pop(value), "the queue is empty again");
+
+  // 4 producers and 3 consumers through a small queue, so both sides wait
+  const int n_producers = 4, n_consumers = 3, per_producer = 100000;
+  BoundedQueue<long long> shared(16);
+  std::vector<std::vector<int>> seen(n_producers, std::vector<int>(per_producer, 0));
+  std::vector<std::thread> threads;
+  for(int producer = 0; producer < n_producers; producer++){
+    threads.emplace_back([&shared, producer, per_producer](){
+      for(int i = 0; i < per_producer; i++){
+        shared.push((long long)producer * per_producer + i);
+      }
+    });
+  }
+  std::vector<std::vector<long long>> popped(n_consumers);
+  const int per_consumer = n_producers * per_producer / n_consumers;
+  for(int consumer = 0; consumer < n_consumers; consumer++){
+    const int count = consumer < n_consumers - 1 ? per_consumer : n_producers * per_producer - (n_consumers - 1) * per_consumer;
+    threads.emplace_back([&shared, &popped, consumer, count](){
+      // in the order this consumer got them, which is the order each producer pushed them
+      for(int i = 0; i < count; i++){
+        long long value;
+        shared.pop(value);
+        popped[consumer].push_back(value);
+      }
+    });
+  }
+  for(std::thread& thread:threads){
+    thread.join();
+  }
+
+  bool once = true, producer_order = true;
+  for(int consumer = 0; consumer < n_consumers; consumer++){
+    std::vector<long long> last(n_producers, -1);
+    for(const long long value:popped[consumer]){
+      const int producer = value / per_producer;
+      seen[producer][value % per_producer]++;
+      producer_order = producer_order && value > last[producer];
+      last[producer] = value;
+    }
+  }
+  for(const std::vector<int>& producer:seen){
+    for(const int times:producer){
+      once = once && times == 1;
+    }
+  }
+  check(once, "every value pushed is popped exactly once");
+  check(producer_order, "each consumer gets the values of a producer in the order they were pushed");
+  check(shared.depth() == 0, "the shared queue is empty at the end");
+
+  return check_status();
+}
@@ -0,0 +1,92 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "counter_random.h"
+
+#include "check.h"
+
+// Philox against the known answers of Random123, and the source sampling against itself: the
+// same events give the same numbers however they are split into blocks.
+
+struct KnownAnswer {
+  std::uint32_t counter[4];
+  std::uint32_t key[2];
+  std::uint32_t expected[4];
+};
+
+// kat_vectors of Random123, philox4x32 with 10 rounds
+const KnownAnswer known_answers[] = {
+  {{0x00000000, 0x00000000, 0x00000000, 0x00000000}, {0x00000000, 0x00000000}, {0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8}},
+  {{0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff}, {0xffffffff, 0xffffffff}, {0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd}},
+  {{0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344}, {0xa4093822, 0x299f31d0}, {0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1}}
+};
+
+int main(){
+  for(const KnownAnswer& answer:known_answers){
+    std::uint32_t c[4] = {answer.counter[0], answer.counter[1], answer.counter[2], answer.counter[3]};
+    philox4x32(c, answer.key);
+    for(int word = 0; word < 4; word++){
+      check(c[word] == answer.expected[word], "philox4x32 known answer, word " + std::to_string(word));
+    }
+  }
+
+  check(uniform_open(0, 0) > 0, "uniform_open is above 0");
+  check(uniform_open(0xFFFFFFFF, 0xFFFFFFFF) < 1, "uniform_open is below 1");
+
+  check_near(normal_quantile(0.5), 0, 1e-15, "normal_quantile(0.5)");
+  check_near(normal_quantile(0.975), 1.959963984540054, 1e-14, "normal_quantile(0.975)");
+  check_near(normal_quantile(0.025), -1.959963984540054, 1e-14, "normal_quantile(0.025)");
+  check_near(normal_quantile(1e-10), -6.361340902404056, 1e-12, "normal_quantile(1e-10)");
+  check_near(normal_quantile(1e-300) / -37.04709629936121, 1, 1e-12, "normal_quantile(1e-300)");
+
+  const std::uint32_t seed = 65539;
+  const double mean = 1e6, sigma = 2e5; // eV/c
+  const int n = 100000;
+  std::vector<double> momenta(n), angles(n), selectors(n);
+  sample_source(seed, 0, n, mean, sigma, momenta.data(), angles.data(), selectors.data());
+
+  // the blocks the macro draws, of any size and in any order, give the same events
+  for(const int block:{1, 7, 1000, 4096}){
+    std::vector<double> block_momenta(n), block_angles(n), block_selectors(n);
+    for(int first = (n - 1) / block * block; first >= 0; first -= block){
+      const int size = std::min(block, n - first);
+      sample_source(seed, first, size, mean, sigma, &block_momenta[first], &block_angles[first], &block_selectors[first]);
+    }
+    check(block_momenta == momenta && block_angles == angles && block_selectors == selectors, "sample_source in blocks of " + std::to_string(block));
+  }
+
+  double sum = 0, sum2 = 0;
+  bool in_range = true;
+  for(int i = 0; i < n; i++){
+    sum += momenta[i];
+    sum2 += momenta[i] * momenta[i];
+    in_range = in_range && momenta[i] > 0 && 0 <= angles[i] && angles[i] < 2 * M_PI && 0 < selectors[i] && selectors[i] < 1;
+  }
+  check(in_range, "momenta above 0, angles in [0, 2 pi), selectors in (0, 1)");
+  const double sample_mean = sum / n, sample_sigma = std::sqrt(sum2 / n - sample_mean * sample_mean);
+  check_near(sample_mean, mean, 5 * sigma / std::sqrt(n), "mean momentum, eV/c");
+  check_near(sample_sigma, sigma, 5 * sigma / std::sqrt(2 * n), "momentum sigma, eV/c");
+
+  std::vector<double> other_seed(n), other_angles(n);
+  sample_source(seed + 1, 0, n, mean, sigma, other_seed.data(), other_angles.data());
+  check(other_seed != momenta, "another seed, other momenta");
+
+  // CounterUniform starts at draw 2 and draws an event again on its own
+  std::vector<double> uniforms(10);
+  sample_uniform(seed, 12345, 10, 2, uniforms.data());
+  for(int event = 0; event < 10; event++){
+    CounterUniform first(seed, 12345 + event), again(seed, 12345 + event);
+    check(first() == uniforms[event], "CounterUniform draws draw 2 first, event " + std::to_string(event));
+    again();
+    bool same = true;
+    for(int i = 0; i < 9; i++){
+      same = same && first() == again();
+    }
+    check(same, "CounterUniform draws an event again, event " + std::to_string(event));
+  }
+
+  return check_status();
+}
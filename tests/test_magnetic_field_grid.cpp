@@ -0,0 +1,136 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+
+#include <unistd.h>
+
+#include "TH2D.h"
+
+#include "magnetic_field_grid.h"
+#include "units.h"
+
+#include "check.h"
+
+// The grid against the histogram it comes from, opened again from its cache, damaged caches
+// refused, and the smoothed field continuous in its slope.
+
+const char* source_path = "test_magnetic_field_grid.root";
+const char* cache_path = "test_magnetic_field_grid.cache";
+
+// a source file of some bytes, only its size and time matter
+void write_source(const int bytes){
+  std::FILE* file = std::fopen(source_path, "wb");
+  for(int i = 0; i < bytes; i++){
+    std::fputc(i & 0xFF, file);
+  }
+  std::fclose(file);
+}
+
+// largest jump of the slope of the field across the bin centres along x and y, where the cubic
+// pieces meet, relative to the largest slope
+double worst_slope_jump(const MagneticFieldGrid& grid){
+  const double h = 1e-5 * grid.dx;
+  double worst = 0, largest = 0;
+  for(int i = 2; i < grid.nx - 1; i++){
+    for(int j = 2; j < grid.ny - 1; j++){
+      const double x = grid.x_min + (i + 0.5) * grid.dx, y = grid.y_min + (j + 0.5) * grid.dy;
+      const double centre = grid.field(x, y);
+      const double left = (centre - grid.field(x - h, y)) / h, right = (grid.field(x + h, y) - centre) / h;
+      const double below = (centre - grid.field(x, y - h)) / h, above = (grid.field(x, y + h) - centre) / h;
+      worst = std::max({worst, std::fabs(right - left), std::fabs(above - below)});
+      largest = std::max({largest, std::fabs(left), std::fabs(below)});
+    }
+  }
+  return worst / largest;
+}
+
+int main(){
+  TH2D histogram("MagneticField", "MagneticField", 40, -10, 10, 30, -6, 9);
+  for(int i = 1; i <= 40; i++){
+    for(int j = 1; j <= 30; j++){
+      const double x = histogram.GetXaxis()->GetBinCenter(i), y = histogram.GetYaxis()->GetBinCenter(j);
+      histogram.SetBinContent(i, j, 30 + 8 * std::sin(x / 3) * std::cos(y / 4) + 0.3 * std::sin(5.3 * i * j));
+    }
+  }
+  const MagneticFieldGrid grid(&histogram, unit::c, unit::m * Tesla);
+  check(grid.nx == 40 && grid.ny == 30, "bins of the histogram");
+  check(grid.is_inside(0, 0) && !grid.is_inside(0, 10 * unit::c), "is_inside");
+
+  // TH2::Interpolate everywhere, including the half bins at the edges
+  double worst = 0;
+  for(int i = 0; i <= 400; i++){
+    for(int j = 0; j <= 300; j++){
+      const double x = -10 + 0.05 * i * 0.99999, y = -6 + 0.05 * j * 0.99999; // cm
+      worst = std::max(worst, std::fabs(grid.field(x * unit::c, y * unit::c) - histogram.Interpolate(x, y) * unit::m * Tesla));
+    }
+  }
+  check_near(worst / (unit::m * Tesla), 0, 1e-12, "field against TH2D::Interpolate, mT");
+  check(worst_slope_jump(grid) > 0.01, "the bilinear slope jumps at the bin centres");
+
+  const MagneticFieldGrid doubled(grid, 2);
+  check(doubled.field(0.01, 0.02) == 2 * grid.field(0.01, 0.02), "scaled grid");
+
+  // the cache holds the same grid and knows its source
+  write_source(1000);
+  check(grid.write_cache(cache_path, source_path), "write_cache");
+  {
+    const MagneticFieldGrid cached(cache_path);
+    check(cached.is_open(), "the cache opens");
+    check(cached.content_hash() == grid.content_hash(), "the cache hashes as the histogram");
+    check(cached.nx == grid.nx && cached.ny == grid.ny && cached.x_min == grid.x_min && cached.y_max == grid.y_max, "the cache has the extent");
+    bool same = true;
+    for(int node = 0; node < grid.stride * (grid.ny + 2); node++){
+      same = same && cached.values[node] == grid.values[node];
+    }
+    check(same, "the cache has the nodes");
+    check(cached.is_current(source_path), "the cache is current");
+    write_source(1001);
+    check(!cached.is_current(source_path), "a changed source makes the cache stale");
+    check(!grid.is_current(source_path), "a grid not from a cache is never current");
+  }
+  // a cache cut short, even with a header claiming the shorter size, is refused rather than read past its end
+  MagneticFieldCacheHeader header;
+  std::FILE* damaged = std::fopen(cache_path, "r+b");
+  check(std::fread(&header, sizeof(header), 1, damaged) == 1, "the cache has a header");
+  header.file_bytes = header.values_offset + 64;
+  std::rewind(damaged);
+  std::fwrite(&header, sizeof(header), 1, damaged);
+  std::fclose(damaged);
+  check(truncate(cache_path, header.file_bytes) == 0, "the cache is cut short");
+  check(!MagneticFieldGrid(cache_path).is_open(), "a truncated cache does not open");
+  header.file_bytes = 4096;
+  for(const int bins:{0, 1, -5, 1 << 30}){
+    header.nx = bins;
+    damaged = std::fopen(cache_path, "wb");
+    std::fwrite(&header, sizeof(header), 1, damaged);
+    std::fclose(damaged);
+    check(truncate(cache_path, header.file_bytes) == 0, "the cache is padded");
+    check(!MagneticFieldGrid(cache_path).is_open(), "a cache of " + std::to_string(bins) + " bins does not open");
+  }
+  damaged = std::fopen(cache_path, "r+b");
+  std::fputc('X', damaged);
+  std::fclose(damaged);
+  check(!MagneticFieldGrid(cache_path).is_open(), "a cache of another magic does not open");
+  check(!MagneticFieldGrid("test_magnetic_field_grid.missing").is_open(), "a missing cache does not open");
+  std::remove(cache_path);
+  std::remove(source_path);
+
+  // smoothing changes the hash, and the spline through the smoothed nodes is C1
+  MagneticFieldGrid smoothed(&histogram, unit::c, unit::m * Tesla);
+  smoothed.smooth(3);
+  check(smoothed.content_hash() != grid.content_hash(), "smoothing changes the hash");
+  check_near(worst_slope_jump(smoothed), 0, 1e-3, "the spline slope is continuous at the bin centres");
+  double node_difference = 0, largest_step = 0;
+  for(int i = 1; i <= 40; i++){
+    for(int j = 1; j <= 30; j++){
+      const double x = histogram.GetXaxis()->GetBinCenter(i) * unit::c, y = histogram.GetYaxis()->GetBinCenter(j) * unit::c;
+      node_difference = std::max(node_difference, std::fabs(smoothed.field(x, y) - smoothed.values[j * smoothed.stride + i]));
+      largest_step = std::max(largest_step, std::fabs(smoothed.field(x, y) - grid.field(x, y)));
+    }
+  }
+  check_near(node_difference / (unit::m * Tesla), 0, 1e-9, "the spline passes through the smoothed nodes, mT");
+  check(largest_step > 0.1 * unit::m * Tesla, "smoothing flattens the short wiggles");
+
+  return check_status();
+}
@@ -0,0 +1,136 @@
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "smoothing_spline.h"
+
+#include "check.h"
+
+// The banded Reinsch solve against the same smoothing spline solved densely, (I + smoothing K) f = y
+// with K = Q R^-1 Q^T, and the spline slopes against what makes a natural cubic spline.
+
+// x = A^-1 b by Gaussian elimination with partial pivoting, A n x n row-major
+std::vector<double> solve_dense(std::vector<double> a, std::vector<double> b){
+  const int n = b.size();
+  for(int k = 0; k < n; k++){
+    int pivot = k;
+    for(int i = k + 1; i < n; i++){
+      if(std::fabs(a[i * n + k]) > std::fabs(a[pivot * n + k])){
+        pivot = i;
+      }
+    }
+    for(int j = 0; j < n; j++){
+      std::swap(a[k * n + j], a[pivot * n + j]);
+    }
+    std::swap(b[k], b[pivot]);
+    for(int i = k + 1; i < n; i++){
+      const double factor = a[i * n + k] / a[k * n + k];
+      for(int j = k; j < n; j++){
+        a[i * n + j] -= factor * a[k * n + j];
+      }
+      b[i] -= factor * b[k];
+    }
+  }
+  for(int k = n - 1; k >= 0; k--){
+    for(int j = k + 1; j < n; j++){
+      b[k] -= a[k * n + j] * b[j];
+    }
+    b[k] /= a[k * n + k];
+  }
+  return b;
+}
+
+std::vector<double> dense_smoothing_spline(const std::vector<double>& y, const double smoothing){
+  const int n = y.size(), m = n - 2;
+  // R^-1 Q^T, column by column of Q^T
+  std::vector<double> r(m * m, 0);
+  for(int j = 0; j < m; j++){
+    r[j * m + j] = 2.0 / 3;
+    if(j + 1 < m){
+      r[j * m + j + 1] = r[(j + 1) * m + j] = 1.0 / 6;
+    }
+  }
+  auto q = [&](const int i, const int j){ return i == j || i == j + 2 ? 1.0 : i == j + 1 ? -2.0 : 0.0; };
+  std::vector<double> system(n * n, 0);
+  for(int column = 0; column < n; column++){
+    std::vector<double> q_t(m);
+    for(int j = 0; j < m; j++){
+      q_t[j] = q(column, j);
+    }
+    const std::vector<double> r_q_t = solve_dense(r, q_t);
+    for(int i = 0; i < n; i++){
+      double k = 0;
+      for(int j = 0; j < m; j++){
+        k += q(i, j) * r_q_t[j];
+      }
+      system[i * n + column] = (i == column) + smoothing * k;
+    }
+  }
+  return solve_dense(system, y);
+}
+
+double largest_difference(const std::vector<double>& a, const std::vector<double>& b){
+  double difference = 0;
+  for(std::size_t i = 0; i < a.size(); i++){
+    difference = std::max(difference, std::fabs(a[i] - b[i]));
+  }
+  return difference;
+}
+
+int main(){
+  const int n = 40;
+  std::vector<double> noisy(n), line(n);
+  for(int i = 0; i < n; i++){
+    noisy[i] = std::sin(0.3 * i) + 0.2 * std::sin(7.1 * i * i);
+    line[i] = 2.5 - 0.75 * i;
+  }
+
+  std::vector<double> kept(noisy);
+  smoothing_spline(kept.data(), n, 1, 0);
+  check(kept == noisy, "smoothing 0 keeps the samples");
+
+  for(const double smoothing:{0.01, 1.0, 30.0, 1e4}){
+    const std::string name = " at smoothing " + std::to_string(smoothing);
+    std::vector<double> smoothed(noisy);
+    smoothing_spline(smoothed.data(), n, 1, smoothing);
+    check_near(largest_difference(smoothed, dense_smoothing_spline(noisy, smoothing)), 0, 1e-10, "banded against dense solve" + name);
+
+    std::vector<double> straight(line);
+    smoothing_spline(straight.data(), n, 1, smoothing);
+    check_near(largest_difference(straight, line), 0, 1e-10, "a line is kept" + name);
+
+    // every third value of an interleaved array, as the columns of a map
+    std::vector<double> strided(3 * n, -1);
+    for(int i = 0; i < n; i++){
+      strided[3 * i + 1] = noisy[i];
+    }
+    smoothing_spline(&strided[1], n, 3, smoothing);
+    bool same = true;
+    for(int i = 0; i < n; i++){
+      same = same && strided[3 * i + 1] == smoothed[i] && strided[3 * i] == -1 && strided[3 * i + 2] == -1;
+    }
+    check(same, "strided samples" + name);
+  }
+
+  // a natural cubic spline has continuous second derivatives and none at the ends; on [i, i + 1]
+  // from the slopes, f''(i) = 6 (y_i+1 - y_i) - 4 s_i - 2 s_i+1 and f''(i + 1) = -6 (y_i+1 - y_i) + 2 s_i + 4 s_i+1
+  std::vector<double> slopes(2 * n);
+  spline_slopes(noisy.data(), n, 1, slopes.data(), 2);
+  auto second_left = [&](const int i){ return 6 * (noisy[i + 1] - noisy[i]) - 4 * slopes[2 * i] - 2 * slopes[2 * (i + 1)]; };
+  auto second_right = [&](const int i){ return -6 * (noisy[i + 1] - noisy[i]) + 2 * slopes[2 * i] + 4 * slopes[2 * (i + 1)]; };
+  double worst_jump = 0;
+  for(int i = 1; i < n - 1; i++){
+    worst_jump = std::max(worst_jump, std::fabs(second_right(i - 1) - second_left(i)));
+  }
+  check_near(worst_jump, 0, 1e-12, "spline_slopes second derivative continuous");
+  check_near(second_left(0), 0, 1e-12, "spline_slopes natural at the start");
+  check_near(second_right(n - 2), 0, 1e-12, "spline_slopes natural at the end");
+
+  std::vector<double> line_slopes(n);
+  spline_slopes(line.data(), n, 1, line_slopes.data(), 1);
+  check_near(*std::max_element(line_slopes.begin(), line_slopes.end()), -0.75, 1e-12, "spline_slopes of a line, largest");
+  check_near(*std::min_element(line_slopes.begin(), line_slopes.end()), -0.75, 1e-12, "spline_slopes of a line, smallest");
+
+  return check_status();
+}
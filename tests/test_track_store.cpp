@@ -0,0 +1,162 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "track_store.h"
+
+#include "check.h"
+
+// Tracks read back as written to the quantum, thinned by the stride with the end kept, and
+// stores resumed or merged track by track equal a store written in one go.
+
+const double quantum = 1e-6; // m
+
+// a spiral of n points, x, y pairs in m
+std::vector<double> spiral_track(const long long event, const int n){
+  std::vector<double> points(2 * n);
+  for(int i = 0; i < n; i++){
+    const double radius = 0.01 + 0.0001 * i + 0.001 * (event % 7);
+    points[2 * i] = -0.01 + radius * std::cos(0.05 * i + event);
+    points[2 * i + 1] = 0.04 + radius * std::sin(0.05 * i + event);
+  }
+  return points;
+}
+
+int track_points(const long long event){
+  return 1 + event * 37 % 300;
+}
+
+void remove_store(const std::string& path){
+  std::remove(path.c_str());
+  std::remove((path + ".idx").c_str());
+}
+
+// every track of the events in [first, last) of one store equal in the other
+bool same_tracks(TrackReader& a, TrackReader& b, const long long first, const long long last){
+  std::vector<double> points_a, points_b;
+  for(long long event = first; event < last; event++){
+    if(!a.read(event, points_a) || !b.read(event, points_b) || points_a != points_b){
+      return false;
+    }
+  }
+  return true;
+}
+
+int main(){
+  const long long n_tracks = 200;
+
+  for(const int stride:{1, 10}){
+    const std::string path = "test_track_store_stride" + std::to_string(stride) + ".trk";
+    {
+      TrackWriter writer(path, quantum, stride, 4096);
+      check(writer.is_open(), "writer opens " + path);
+      for(long long event = 0; event < n_tracks; event++){
+        const std::vector<double> points = spiral_track(2 * event, track_points(event));
+        writer.write(2 * event, points.data(), points.size() / 2);
+      }
+    }
+    TrackReader reader(path);
+    check(reader.is_open() && reader.size() == n_tracks, "reader finds every track of " + path);
+    check(reader.stride == stride && reader.quantum == quantum, "reader reads the header of " + path);
+    double worst = 0;
+    bool kept = true;
+    std::vector<double> read;
+    for(long long event = 0; event < n_tracks; event++){
+      const int n = track_points(event);
+      const std::vector<double> points = spiral_track(2 * event, n);
+      if(!reader.read(2 * event, read)){
+        kept = false;
+        continue;
+      }
+      // every stride-th point and the last
+      std::vector<int> expected;
+      for(int i = 0; i < n; i += stride){
+        expected.push_back(i);
+      }
+      if(expected.back() != n - 1){
+        expected.push_back(n - 1);
+      }
+      if(read.size() != 2 * expected.size()){
+        kept = false;
+        continue;
+      }
+      for(std::size_t i = 0; i < expected.size(); i++){
+        worst = std::max(worst, std::fabs(read[2 * i] - points[2 * expected[i]]));
+        worst = std::max(worst, std::fabs(read[2 * i + 1] - points[2 * expected[i] + 1]));
+      }
+    }
+    check(kept, "every stride-th point and the last are kept, " + path);
+    check_near(worst, 0, quantum / 2 * (1 + 1e-9), "points within half a quantum, " + path + ", m");
+    check(!reader.read(1, read), "an event never written is not found");
+    remove_store(path);
+  }
+
+  // a store written in one go, for the stores below to equal
+  {
+    TrackWriter single("test_track_store_single.trk", quantum, 3, 4096);
+    for(long long event = 0; event < n_tracks; event++){
+      const std::vector<double> points = spiral_track(event, track_points(event));
+      single.write(event, points.data(), points.size() / 2);
+    }
+  }
+  TrackReader single("test_track_store_single.trk");
+
+  // a store cut back to a flushed chunk and continued equals one written in one go, whatever
+  // followed the chunk before
+  {
+    TrackWriter first("test_track_store_resumed.trk", quantum, 3, 4096);
+    for(long long event = 0; event < n_tracks; event++){
+      const long long shape = event < n_tracks / 2 ? event : event + 1;
+      const std::vector<double> points = spiral_track(shape, track_points(shape));
+      first.write(event, points.data(), points.size() / 2);
+      if(event == n_tracks / 2 - 1){
+        first.flush();
+      }
+    }
+  }
+  {
+    TrackWriter resumed("test_track_store_resumed.trk", quantum, 3, 4096, n_tracks / 2);
+    check(resumed.is_open(), "a store resumes");
+    for(long long event = n_tracks / 2; event < n_tracks; event++){
+      const std::vector<double> points = spiral_track(event, track_points(event));
+      resumed.write(event, points.data(), points.size() / 2);
+    }
+  }
+  {
+    TrackWriter other_stride("test_track_store_resumed.trk", quantum, 4, 4096, n_tracks / 2);
+    check(!other_stride.is_open(), "a store of another stride does not resume");
+  }
+  TrackReader resumed("test_track_store_resumed.trk");
+  check(resumed.size() == n_tracks && same_tracks(single, resumed, 0, n_tracks), "resumed store equals a single store");
+
+  // two shards merged track by track, as spectrometer_kinetic_hist merges them
+  {
+    TrackWriter shard0("test_track_store_shard0.trk", quantum, 3, 4096);
+    TrackWriter shard1("test_track_store_shard1.trk", quantum, 3, 4096);
+    for(long long event = 0; event < n_tracks; event++){
+      const std::vector<double> points = spiral_track(event, track_points(event));
+      (event < n_tracks / 2 ? shard0 : shard1).write(event, points.data(), points.size() / 2);
+    }
+  }
+  {
+    TrackWriter merged("test_track_store_merged.trk", quantum, 3, 4096);
+    TrackIndexEntry entry;
+    std::vector<unsigned char> bytes;
+    for(const char* shard:{"test_track_store_shard0.trk", "test_track_store_shard1.trk"}){
+      TrackReader reader(shard);
+      for(long long position = 0; position < reader.size(); position++){
+        check(reader.read_at(position, entry, bytes), "read_at " + std::to_string(position) + " of " + shard);
+        merged.append(entry, bytes);
+      }
+    }
+  }
+  TrackReader merged("test_track_store_merged.trk");
+  check(merged.size() == n_tracks && same_tracks(single, merged, 0, n_tracks), "merged shards equal a single store");
+
+  for(const char* path:{"test_track_store_single.trk", "test_track_store_resumed.trk", "test_track_store_shard0.trk", "test_track_store_shard1.trk", "test_track_store_merged.trk"}){
+    remove_store(path);
+  }
+  return check_status();
+}
@@ -0,0 +1,485 @@
+#ifndef RUNGE_TRACKER_BATCH_RK4_H
+#define RUNGE_TRACKER_BATCH_RK4_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define RUNGE_BATCH_GATHERS
+#include <cpuid.h>
+#include <immintrin.h>
+// the stages are compiled into each instruction set's step
+#define RUNGE_BATCH_STAGES __attribute__((always_inline)) inline
+#else
+#define RUNGE_BATCH_STAGES inline
+#endif
+
+#include "independent_lanes.h"
+#include "magnetic_field_grid.h"
+#include "obstacle_grid.h"
+
+// electron handed to the batch
+struct BatchParticle {
+  long long event;
+  double x, y; // m
+  double px, py; // eV/c
+  double mass; // eV
+};
+
+// electron leaving the batch
+struct BatchResult {
+  long long event;
+  double e_E;
+  double e_KE;
+  int anihilation_type;
+  int obstacle; // index in the ObstacleGrid of what stopped the electron, -1 for none
+  double tau; // proper time at the end, m
+  int steps;
+};
+
+// Same RK4 as BeamRK4::step_RK4 for a whole batch of planar electrons at once, operation for
+// operation, so the electrons come out bit for bit as from BeamRK4 as long as the compiler fuses
+// no multiply-adds in either (the CMake build turns that off; clang, and so ROOT, fuses by default).
+// State is kept as structure of arrays; the stages, and the screening of which electrons may
+// have ended, are lane loops marked independent so the compiler vectorises them, and the field
+// lookup uses AVX2 / AVX-512 gathers when the processor running it has them.
+// A step, the stage loops and the gathers, is compiled for each of those instruction sets
+// whatever the target of the build, and the widest the processor has is picked when the batch
+// is made, so a default build or ROOT runs it too.
+// Terminated lanes are refilled from the source, and once it runs dry the survivors are
+// compacted to the front so the loops only cover live electrons.
+class BatchRK4 {
+  public:
+    // the batch is padded to the widest gather, so any of them can step it
+    static const int lanes = 8;
+    enum class Gathers {None, AVX2, AVX512};
+    // the widest gathers this processor has
+    static Gathers available_gathers();
+
+    // widest_gathers narrows the vector step below what the processor has, e.g. to compare them
+    BatchRK4(const MagneticFieldGrid* magnetic_field, const double charge, const double dtau, const double tau_final, const double edge_margin, const int width = 256,
+             const Gathers widest_gathers = Gathers::AVX512);
+    ~BatchRK4();
+    BatchRK4(const BatchRK4&) = delete;
+    BatchRK4& operator=(const BatchRK4&) = delete;
+
+    void set_obstacles(const ObstacleGrid* obstacles);
+    void set_keep_orbits(const bool keep_orbits);
+
+    // next_particle(BatchParticle&) returns false once the source is exhausted,
+    // retire(const BatchResult&, const std::vector<double>& orbit) gets every finished electron,
+    // orbit holding x, y pairs in metres when orbits are kept
+    template <class Source, class Sink>
+    void run(Source next_particle, Sink retire);
+
+    long long steps = 0; // electron steps taken, summed over lanes
+    const Gathers gathers; // of the field lookup
+
+  private:
+    template <Gathers G>
+    RUNGE_BATCH_STAGES void lookup_field(const double* x, const double* y, double* b, const int n) const;
+    void step(const int n);
+    template <Gathers G>
+    RUNGE_BATCH_STAGES void step_stages(const int n);
+#if defined(RUNGE_BATCH_GATHERS)
+    __attribute__((target("avx2,fma"))) void lookup_field_avx2(const double* x, const double* y, double* b, const int n) const;
+    __attribute__((target("avx512f,avx2,fma"))) void lookup_field_avx512(const double* x, const double* y, double* b, const int n) const;
+    __attribute__((target("avx2,fma"))) void step_avx2(const int n);
+    __attribute__((target("avx512f,avx2,fma"))) void step_avx512(const int n);
+#endif
+    bool is_anihilated(const int lane, int& anihilation_type, int& obstacle);
+    void load(const int lane, const BatchParticle& particle);
+    void move(const int from, const int to);
+    BatchResult result(const int lane) const;
+
+    const MagneticFieldGrid* magnetic_field;
+    const double charge;
+    const double dtau;
+    const double tau_final;
+    const double edge_margin;
+    const int width;
+    bool keep_orbits = false;
+    const ObstacleGrid* obstacles = nullptr;
+
+    // per lane state and stage scratch, width doubles each
+    double* memory;
+    double *x, *y, *px, *py, *mass, *previous_x, *previous_y;
+    double *h, *k, *kp, *stage_x, *stage_y, *stage_px, *stage_py, *b;
+    double *sum_x, *sum_y, *sum_px, *sum_py;
+    std::vector<long long> event;
+    std::vector<double> tau; // proper time, m
+    std::vector<int> step_count;
+    std::vector<int> flying; // 1 where the last step surely did not end the electron, see step_stages
+    std::vector<std::vector<double>> orbits;
+};
+
+inline BatchRK4::BatchRK4(const MagneticFieldGrid* magnetic_field, const double charge, const double dtau, const double tau_final, const double edge_margin, const int width, const Gathers widest_gathers)
+: gathers(std::min(widest_gathers, available_gathers())), magnetic_field(magnetic_field), charge(charge), dtau(dtau), tau_final(tau_final), edge_margin(edge_margin), width((width + lanes - 1) / lanes * lanes),
+  event(this->width), tau(this->width), step_count(this->width), flying(this->width), orbits(this->width){
+  const int n_arrays = 19;
+  memory = static_cast<double*>(std::aligned_alloc(64, sizeof(double) * n_arrays * this->width));
+  double** arrays[n_arrays] = {&x, &y, &px, &py, &mass, &previous_x, &previous_y, &h, &k, &kp, &stage_x, &stage_y, &stage_px, &stage_py, &b, &sum_x, &sum_y, &sum_px, &sum_py};
+  for(int i = 0; i < n_arrays; i++){
+    *arrays[i] = memory + i * this->width;
+  }
+  // lanes past the live ones are still computed, so keep them finite and inside the map
+  std::fill(memory, memory + n_arrays * this->width, 0.0);
+  std::fill(x, x + this->width, magnetic_field->x_min);
+  std::fill(y, y + this->width, magnetic_field->y_min);
+  std::fill(mass, mass + this->width, 1.0);
+}
+
+// from cpuid and the registers the system saves, so nothing needs a runtime library
+inline BatchRK4::Gathers BatchRK4::available_gathers(){
+#if defined(RUNGE_BATCH_GATHERS)
+  unsigned int eax, ebx, ecx, edx;
+  if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_OSXSAVE)){
+    return Gathers::None;
+  }
+  const bool fma = ecx & bit_FMA;
+  unsigned int xcr0, xcr0_high;
+  __asm__("xgetbv" : "=a"(xcr0), "=d"(xcr0_high) : "c"(0));
+  if(!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)){
+    return Gathers::None;
+  }
+  const bool ymm_saved = (xcr0 & 0x6) == 0x6, zmm_saved = (xcr0 & 0xe6) == 0xe6;
+  if(zmm_saved && (ebx & bit_AVX512F) && (ebx & bit_AVX2) && fma){
+    return Gathers::AVX512;
+  }
+  if(ymm_saved && (ebx & bit_AVX2) && fma){
+    return Gathers::AVX2;
+  }
+#endif
+  return Gathers::None;
+}
+
+inline BatchRK4::~BatchRK4(){
+  std::free(memory);
+}
+
+inline void BatchRK4::set_obstacles(const ObstacleGrid* obstacles){
+  this->obstacles = obstacles;
+}
+
+inline void BatchRK4::set_keep_orbits(const bool keep_orbits){
+  this->keep_orbits = keep_orbits;
+}
+
+template <BatchRK4::Gathers G>
+RUNGE_BATCH_STAGES void BatchRK4::lookup_field(const double* x, const double* y, double* b, const int n) const {
+#if defined(RUNGE_BATCH_GATHERS)
+  // a smoothed map is a bicubic spline, evaluated lane by lane
+  if(magnetic_field->spline.empty()){
+    if(G == Gathers::AVX512){
+      lookup_field_avx512(x, y, b, n);
+      return;
+    }
+    if(G == Gathers::AVX2){
+      lookup_field_avx2(x, y, b, n);
+      return;
+    }
+  }
+#endif
+  for(int i = 0; i < n; i++){
+    b[i] = magnetic_field->field(x[i], y[i]);
+  }
+}
+
+#if defined(RUNGE_BATCH_GATHERS)
+__attribute__((target("avx512f,avx2,fma"))) inline void BatchRK4::lookup_field_avx512(const double* x, const double* y, double* b, const int n) const {
+  const MagneticFieldGrid& grid = *magnetic_field;
+  const __m512d x_min = _mm512_set1_pd(grid.x_min), x_max = _mm512_set1_pd(grid.x_max);
+  const __m512d y_min = _mm512_set1_pd(grid.y_min), y_max = _mm512_set1_pd(grid.y_max);
+  const __m512d inv_dx = _mm512_set1_pd(grid.inv_dx), inv_dy = _mm512_set1_pd(grid.inv_dy);
+  const __m512d half = _mm512_set1_pd(0.5), zero = _mm512_setzero_pd();
+  const __m512d u_max = _mm512_set1_pd(grid.nx), v_max = _mm512_set1_pd(grid.ny);
+  const __m256i stride = _mm256_set1_epi32(grid.stride), one = _mm256_set1_epi32(1);
+  for(int i = 0; i < n; i += 8){
+    const __m512d xv = _mm512_load_pd(x + i);
+    const __m512d yv = _mm512_load_pd(y + i);
+    const __mmask8 inside = _mm512_cmp_pd_mask(x_min, xv, _CMP_LE_OQ) & _mm512_cmp_pd_mask(xv, x_max, _CMP_LT_OQ)
+                          & _mm512_cmp_pd_mask(y_min, yv, _CMP_LE_OQ) & _mm512_cmp_pd_mask(yv, y_max, _CMP_LT_OQ);
+    const __m512d u = _mm512_min_pd(_mm512_max_pd(_mm512_add_pd(_mm512_mul_pd(_mm512_sub_pd(xv, x_min), inv_dx), half), zero), u_max);
+    const __m512d v = _mm512_min_pd(_mm512_max_pd(_mm512_add_pd(_mm512_mul_pd(_mm512_sub_pd(yv, y_min), inv_dy), half), zero), v_max);
+    const __m256i iu = _mm512_cvttpd_epi32(u);
+    const __m256i iv = _mm512_cvttpd_epi32(v);
+    const __m512d t = _mm512_sub_pd(u, _mm512_cvtepi32_pd(iu));
+    const __m512d s = _mm512_sub_pd(v, _mm512_cvtepi32_pd(iv));
+    const __m256i node = _mm256_add_epi32(_mm256_mullo_epi32(iv, stride), iu);
+    const __m256i node_up = _mm256_add_epi32(node, stride);
+    const __m512d q00 = _mm512_i32gather_pd(node, grid.values, 8);
+    const __m512d q10 = _mm512_i32gather_pd(_mm256_add_epi32(node, one), grid.values, 8);
+    const __m512d q01 = _mm512_i32gather_pd(node_up, grid.values, 8);
+    const __m512d q11 = _mm512_i32gather_pd(_mm256_add_epi32(node_up, one), grid.values, 8);
+    const __m512d bottom = _mm512_add_pd(q00, _mm512_mul_pd(_mm512_sub_pd(q10, q00), t));
+    const __m512d top = _mm512_add_pd(q01, _mm512_mul_pd(_mm512_sub_pd(q11, q01), t));
+    _mm512_store_pd(b + i, _mm512_maskz_mov_pd(inside, _mm512_add_pd(bottom, _mm512_mul_pd(_mm512_sub_pd(top, bottom), s))));
+  }
+}
+
+__attribute__((target("avx2,fma"))) inline void BatchRK4::lookup_field_avx2(const double* x, const double* y, double* b, const int n) const {
+  const MagneticFieldGrid& grid = *magnetic_field;
+  const __m256d x_min = _mm256_set1_pd(grid.x_min), x_max = _mm256_set1_pd(grid.x_max);
+  const __m256d y_min = _mm256_set1_pd(grid.y_min), y_max = _mm256_set1_pd(grid.y_max);
+  const __m256d inv_dx = _mm256_set1_pd(grid.inv_dx), inv_dy = _mm256_set1_pd(grid.inv_dy);
+  const __m256d half = _mm256_set1_pd(0.5), zero = _mm256_setzero_pd();
+  const __m256d u_max = _mm256_set1_pd(grid.nx), v_max = _mm256_set1_pd(grid.ny);
+  const __m128i stride = _mm_set1_epi32(grid.stride), one = _mm_set1_epi32(1);
+  for(int i = 0; i < n; i += 4){
+    const __m256d xv = _mm256_load_pd(x + i);
+    const __m256d yv = _mm256_load_pd(y + i);
+    const __m256d inside = _mm256_and_pd(_mm256_and_pd(_mm256_cmp_pd(x_min, xv, _CMP_LE_OQ), _mm256_cmp_pd(xv, x_max, _CMP_LT_OQ)),
+                                         _mm256_and_pd(_mm256_cmp_pd(y_min, yv, _CMP_LE_OQ), _mm256_cmp_pd(yv, y_max, _CMP_LT_OQ)));
+    const __m256d u = _mm256_min_pd(_mm256_max_pd(_mm256_add_pd(_mm256_mul_pd(_mm256_sub_pd(xv, x_min), inv_dx), half), zero), u_max);
+    const __m256d v = _mm256_min_pd(_mm256_max_pd(_mm256_add_pd(_mm256_mul_pd(_mm256_sub_pd(yv, y_min), inv_dy), half), zero), v_max);
+    const __m128i iu = _mm256_cvttpd_epi32(u);
+    const __m128i iv = _mm256_cvttpd_epi32(v);
+    const __m256d t = _mm256_sub_pd(u, _mm256_cvtepi32_pd(iu));
+    const __m256d s = _mm256_sub_pd(v, _mm256_cvtepi32_pd(iv));
+    const __m128i node = _mm_add_epi32(_mm_mullo_epi32(iv, stride), iu);
+    const __m128i node_up = _mm_add_epi32(node, stride);
+    const __m256d q00 = _mm256_i32gather_pd(grid.values, node, 8);
+    const __m256d q10 = _mm256_i32gather_pd(grid.values, _mm_add_epi32(node, one), 8);
+    const __m256d q01 = _mm256_i32gather_pd(grid.values, node_up, 8);
+    const __m256d q11 = _mm256_i32gather_pd(grid.values, _mm_add_epi32(node_up, one), 8);
+    const __m256d bottom = _mm256_add_pd(q00, _mm256_mul_pd(_mm256_sub_pd(q10, q00), t));
+    const __m256d top = _mm256_add_pd(q01, _mm256_mul_pd(_mm256_sub_pd(q11, q01), t));
+    _mm256_store_pd(b + i, _mm256_and_pd(inside, _mm256_add_pd(bottom, _mm256_mul_pd(_mm256_sub_pd(top, bottom), s))));
+  }
+}
+#endif
+
+inline void BatchRK4::step(const int n){
+#if defined(RUNGE_BATCH_GATHERS)
+  if(gathers == Gathers::AVX512){
+    step_avx512(n);
+    return;
+  }
+  if(gathers == Gathers::AVX2){
+    step_avx2(n);
+    return;
+  }
+#endif
+  step_stages<Gathers::None>(n);
+}
+
+#if defined(RUNGE_BATCH_GATHERS)
+__attribute__((target("avx2,fma"))) inline void BatchRK4::step_avx2(const int n){
+  step_stages<Gathers::AVX2>(n);
+}
+
+__attribute__((target("avx512f,avx2,fma"))) inline void BatchRK4::step_avx512(const int n){
+  step_stages<Gathers::AVX512>(n);
+}
+#endif
+
+template <BatchRK4::Gathers G>
+RUNGE_BATCH_STAGES void BatchRK4::step_stages(const int n){
+  // held in locals the pointers are not loaded again after every store
+  double* const x = this->x;
+  double* const y = this->y;
+  double* const px = this->px;
+  double* const py = this->py;
+  const double* const mass = this->mass;
+  double* const tau = this->tau.data();
+  int* const step_count = this->step_count.data();
+  int* const flying = this->flying.data();
+  double* const h = this->h;
+  double* const k = this->k;
+  double* const kp = this->kp;
+  double* const stage_x = this->stage_x;
+  double* const stage_y = this->stage_y;
+  double* const stage_px = this->stage_px;
+  double* const stage_py = this->stage_py;
+  const double* const b = this->b;
+  double* const sum_x = this->sum_x;
+  double* const sum_y = this->sum_y;
+  double* const sum_px = this->sum_px;
+  double* const sum_py = this->sum_py;
+  const double charge = this->charge, dtau = this->dtau, tau_final = this->tau_final;
+
+  double* const previous_x = this->previous_x;
+  double* const previous_y = this->previous_y;
+  std::copy(x, x + n, previous_x);
+  std::copy(y, y + n, previous_y);
+  RUNGE_INDEPENDENT_LANES
+  for(int i = 0; i < n; i++){
+    // the last step lands on tau_final, as in BeamRK4::step_RK4
+    h[i] = tau_final - tau[i] < dtau * (1 + 1e-6) ? tau_final - tau[i] : dtau;
+    k[i] = h[i] / mass[i];
+    kp[i] = charge / mass[i] * h[i];
+  }
+
+  // stage 1 at the current state
+  lookup_field<G>(x, y, this->b, n);
+  RUNGE_INDEPENDENT_LANES
+  for(int i = 0; i < n; i++){
+    const double dx = px[i] * k[i], dy = py[i] * k[i];
+    const double dpx = py[i] * b[i] * kp[i], dpy = -px[i] * b[i] * kp[i];
+    sum_x[i] = dx; sum_y[i] = dy; sum_px[i] = dpx; sum_py[i] = dpy;
+    stage_x[i] = x[i] + dx / 2; stage_y[i] = y[i] + dy / 2;
+    stage_px[i] = px[i] + dpx / 2; stage_py[i] = py[i] + dpy / 2;
+  }
+
+  // stages 2 and 3 at the half step
+  for(int half_stage = 0; half_stage < 2; half_stage++){
+    const double next_fraction = half_stage == 0 ? 0.5 : 1.0;
+    lookup_field<G>(stage_x, stage_y, this->b, n);
+    RUNGE_INDEPENDENT_LANES
+    for(int i = 0; i < n; i++){
+      const double dx = stage_px[i] * k[i], dy = stage_py[i] * k[i];
+      const double dpx = stage_py[i] * b[i] * kp[i], dpy = -stage_px[i] * b[i] * kp[i];
+      sum_x[i] += 2 * dx; sum_y[i] += 2 * dy; sum_px[i] += 2 * dpx; sum_py[i] += 2 * dpy;
+      stage_x[i] = x[i] + dx * next_fraction; stage_y[i] = y[i] + dy * next_fraction;
+      stage_px[i] = px[i] + dpx * next_fraction; stage_py[i] = py[i] + dpy * next_fraction;
+    }
+  }
+
+  // stage 4 at the full step
+  lookup_field<G>(stage_x, stage_y, this->b, n);
+  RUNGE_INDEPENDENT_LANES
+  for(int i = 0; i < n; i++){
+    const double dx = stage_px[i] * k[i], dy = stage_py[i] * k[i];
+    const double dpx = stage_py[i] * b[i] * kp[i], dpy = -stage_px[i] * b[i] * kp[i];
+    x[i] += (sum_x[i] + dx) / 6; y[i] += (sum_y[i] + dy) / 6;
+    px[i] += (sum_px[i] + dpx) / 6; py[i] += (sum_py[i] + dpy) / 6;
+    tau[i] = h[i] == dtau ? tau[i] + dtau : tau_final;
+    step_count[i]++;
+  }
+
+  // the lanes is_anihilated would let go on, by its tests without their branches; only the
+  // others are settled one by one
+  const double x_min = magnetic_field->x_min, x_max = magnetic_field->x_max, y_min = magnetic_field->y_min, y_max = magnetic_field->y_max;
+  const double edge_margin = this->edge_margin;
+  RUNGE_INDEPENDENT_LANES
+  for(int i = 0; i < n; i++){
+    const bool inside = (x_min < x[i] - edge_margin) & (x[i] + edge_margin < x_max) & (y_min < y[i] - edge_margin) & (y[i] + edge_margin < y_max);
+    flying[i] = (tau[i] < tau_final) & inside;
+  }
+  if(obstacles != nullptr){
+    obstacles->clear_steps(previous_x, previous_y, x, y, flying, n);
+  }
+}
+
+// same rules as BeamRK4::is_anihilated, including the swept obstacle test
+inline bool BatchRK4::is_anihilated(const int lane, int& anihilation_type, int& obstacle){
+  anihilation_type = 0;
+  obstacle = -1;
+  ObstacleHit hit;
+  if(obstacles != nullptr && obstacles->first_hit(previous_x[lane], previous_y[lane], x[lane], y[lane], hit)){
+    x[lane] = hit.x;
+    y[lane] = hit.y;
+    if(keep_orbits){
+      orbits[lane].end()[-2] = hit.x;
+      orbits[lane].end()[-1] = hit.y;
+    }
+    anihilation_type = hit.anihilation_type;
+    obstacle = hit.obstacle;
+    return true;
+  }
+  if(tau[lane] >= tau_final){
+    return true;
+  }
+  if(x[lane] - edge_margin <= magnetic_field->x_min || magnetic_field->x_max <= x[lane] + edge_margin || y[lane] - edge_margin <= magnetic_field->y_min || magnetic_field->y_max <= y[lane] + edge_margin){
+    return true;
+  }
+  return false;
+}
+
+inline void BatchRK4::load(const int lane, const BatchParticle& particle){
+  event[lane] = particle.event;
+  x[lane] = previous_x[lane] = particle.x;
+  y[lane] = previous_y[lane] = particle.y;
+  px[lane] = particle.px;
+  py[lane] = particle.py;
+  mass[lane] = particle.mass;
+  tau[lane] = 0;
+  step_count[lane] = 0;
+  if(keep_orbits){
+    orbits[lane].clear();
+    orbits[lane].push_back(particle.x);
+    orbits[lane].push_back(particle.y);
+  }
+}
+
+inline void BatchRK4::move(const int from, const int to){
+  event[to] = event[from];
+  x[to] = x[from];
+  y[to] = y[from];
+  previous_x[to] = previous_x[from];
+  previous_y[to] = previous_y[from];
+  px[to] = px[from];
+  py[to] = py[from];
+  mass[to] = mass[from];
+  tau[to] = tau[from];
+  step_count[to] = step_count[from];
+  flying[to] = flying[from];
+  orbits[to].swap(orbits[from]);
+}
+
+inline BatchResult BatchRK4::result(const int lane) const {
+  const double p2 = px[lane] * px[lane] + py[lane] * py[lane];
+  const double energy = std::sqrt(p2 + mass[lane] * mass[lane]);
+  return {event[lane], energy, p2 / (energy + mass[lane]), 0, -1, tau[lane], step_count[lane]};
+}
+
+template <class Source, class Sink>
+void BatchRK4::run(Source next_particle, Sink retire){
+  bool source_done = false;
+  BatchParticle particle;
+  int n_active = 0;
+
+  // a lane is settled once it holds an electron that is still flying
+  auto settle = [&](const int lane){
+    int anihilation_type, obstacle;
+    while(is_anihilated(lane, anihilation_type, obstacle)){
+      BatchResult finished = result(lane);
+      finished.anihilation_type = anihilation_type;
+      finished.obstacle = obstacle;
+      retire(static_cast<const BatchResult&>(finished), static_cast<const std::vector<double>&>(orbits[lane]));
+      if(!source_done && next_particle(particle)){
+        load(lane, particle);
+      }else{
+        source_done = true;
+        return false;
+      }
+    }
+    return true;
+  };
+
+  while(n_active < width && !source_done){
+    if(next_particle(particle)){
+      load(n_active, particle);
+      if(settle(n_active)){
+        n_active++;
+      }
+    }else{
+      source_done = true;
+    }
+  }
+
+  while(n_active > 0){
+    step((n_active + lanes - 1) / lanes * lanes);
+    steps += n_active;
+    if(keep_orbits){
+      for(int lane = 0; lane < n_active; lane++){
+        orbits[lane].push_back(x[lane]);
+        orbits[lane].push_back(y[lane]);
+      }
+    }
+    for(int lane = 0; lane < n_active; lane++){
+      if(!flying[lane] && !settle(lane)){
+        // nothing left to refill with: pull the last live lane into the hole
+        n_active--;
+        if(lane != n_active){
+          move(n_active, lane);
+          lane--;
+        }
+      }
+    }
+  }
+}
+
+#endif
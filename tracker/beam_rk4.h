@@ -0,0 +1,482 @@
+#ifndef RUNGE_TRACKER_BEAM_RK4_H
+#define RUNGE_TRACKER_BEAM_RK4_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "TMath.h"
+
+#include "field_grid_3d.h"
+#include "field_region_map.h"
+#include "magnetic_field_grid.h"
+#include "obstacle_grid.h"
+#include "space_vector.h"
+
+// One electron tracked through a field map, in the units of units.h: proper time and
+// lengths in metres, momenta and energies in eV, the field in c*eV/m. Every setup steps its
+// electrons with this class, so a fix to the integrators reaches all of them.
+//
+// BeamTracker<D> follows motion in D dimensions; TrackerSpace<D> supplies what depends on them,
+// the field map, the obstacles and p x B. BeamRK4 is the planar tracker and BeamRK4_3D the one
+// that leaves the plane. The state is x and p and nothing else: the mass and q/m are fixed when
+// the electron is made, so a stage of a step costs one field lookup and a few multiplications,
+// without a square root.
+
+const double edge_margin = 0.005; // m, electrons this close to the edge of the map are stopped
+const double rk45_tolerance = 1e-11; // per step error: metres for x, relative to |p| for p
+const double region_max_arc = TMath::Pi() / 8; // longest analytic arc, so orbits still draw as curves
+const double arc_collision_tolerance = 1e-5; // m, an analytic arc strays at most this far from the chords it is tested along
+
+enum class Integrator {
+  RK4, // fixed dtau
+  RK45, // Dormand-Prince with step size control
+  Boris // fixed dtau, |p| conserved
+};
+
+// the field, obstacles and geometry of D dimensional tracking, specialised for each D
+template <int D>
+struct TrackerSpace;
+
+// the plane z = 0 with the Bz of a MagneticFieldGrid
+template <>
+struct TrackerSpace<2> {
+  using Field = MagneticFieldGrid;
+  using Obstacles = ObstacleGrid;
+
+  // p x B at x
+  static SpaceVector<2> p_cross_b(const Field& field, const SpaceVector<2>& x, const SpaceVector<2>& p){
+    const double b = field.field(x[0], x[1]);
+    return {{p[1] * b, -p[0] * b}};
+  }
+
+  // p turned by the field at x as in a Boris push, half_turn = q h / (2 m)
+  static SpaceVector<2> boris_rotate(const Field& field, const SpaceVector<2>& x, const SpaceVector<2>& p, const double half_turn){
+    const double t = half_turn * field.field(x[0], x[1]); // tan of half the turn
+    const double s = 2 * t / (1 + t * t);
+    const double px_prime = p[0] + p[1] * t;
+    const double py_prime = p[1] - p[0] * t;
+    return {{p[0] + py_prime * s, p[1] - px_prime * s}};
+  }
+
+  // the first obstacle on the segment from x0 to x1, at x0 + t (x1 - x0)
+  static bool first_hit(const Obstacles& obstacles, const SpaceVector<2>& x0, const SpaceVector<2>& x1, double& t, int& anihilation_type, int& obstacle){
+    ObstacleHit hit;
+    if(!obstacles.first_hit(x0[0], x0[1], x1[0], x1[1], hit)){
+      return false;
+    }
+    t = hit.t;
+    anihilation_type = hit.anihilation_type;
+    obstacle = hit.obstacle;
+    return true;
+  }
+
+  // within margin of the edge of the map, or outside it
+  static bool is_at_edge(const Field& field, const SpaceVector<2>& x, const double margin){
+    return x[0] - margin <= field.x_min || field.x_max <= x[0] + margin || x[1] - margin <= field.y_min || field.y_max <= x[1] + margin;
+  }
+
+  // distance from x to the edge margin, m
+  static double clearance(const Field& field, const SpaceVector<2>& x, const double margin){
+    return std::min({x[0] - margin - field.x_min, field.x_max - margin - x[0], x[1] - margin - field.y_min, field.y_max - margin - x[1]});
+  }
+};
+
+// space with the B of a FieldGrid3D; the obstacles are boxes, see ObstacleGrid::add_box
+template <>
+struct TrackerSpace<3> {
+  using Field = FieldGrid3D;
+  using Obstacles = ObstacleGrid;
+
+  static SpaceVector<3> cross(const SpaceVector<3>& a, const SpaceVector<3>& b){
+    return {{a[1] * b[2] - a[2] * b[1], a[2] * b[0] - a[0] * b[2], a[0] * b[1] - a[1] * b[0]}};
+  }
+
+  static SpaceVector<3> p_cross_b(const Field& field, const SpaceVector<3>& x, const SpaceVector<3>& p){
+    return cross(p, field.field(x[0], x[1], x[2]));
+  }
+
+  // p' = p + p x t, then p + p' x s, with t = half_turn B and s = 2 t / (1 + t^2)
+  static SpaceVector<3> boris_rotate(const Field& field, const SpaceVector<3>& x, const SpaceVector<3>& p, const double half_turn){
+    const SpaceVector<3> t = field.field(x[0], x[1], x[2]) * half_turn;
+    const SpaceVector<3> s = t * (2 / (1 + t.mag2()));
+    return p + cross(p + cross(p, t), s);
+  }
+
+  static bool first_hit(const Obstacles& obstacles, const SpaceVector<3>& x0, const SpaceVector<3>& x1, double& t, int& anihilation_type, int& obstacle){
+    ObstacleHit hit;
+    if(!obstacles.first_hit(x0[0], x0[1], x0[2], x1[0], x1[1], x1[2], hit)){
+      return false;
+    }
+    t = hit.t;
+    anihilation_type = hit.anihilation_type;
+    obstacle = hit.obstacle;
+    return true;
+  }
+
+  static bool is_at_edge(const Field& field, const SpaceVector<3>& x, const double margin){
+    return x[0] - margin <= field.x_min || field.x_max <= x[0] + margin || x[1] - margin <= field.y_min || field.y_max <= x[1] + margin
+           || x[2] - margin <= field.z_min || field.z_max <= x[2] + margin;
+  }
+
+  static double clearance(const Field& field, const SpaceVector<3>& x, const double margin){
+    return std::min({x[0] - margin - field.x_min, field.x_max - margin - x[0], x[1] - margin - field.y_min, field.y_max - margin - x[1],
+                     x[2] - margin - field.z_min, field.z_max - margin - x[2]});
+  }
+};
+
+template <int D>
+class BeamTracker {
+  public:
+    using Vector = SpaceVector<D>;
+    using Space = TrackerSpace<D>;
+    using Field = typename Space::Field;
+    using Obstacles = typename Space::Obstacles;
+
+    BeamTracker(const Vector& initial_x, const Vector& initial_p, const double mass, const double charge, const Field* magnetic_field, const double dtau, const double tau_final);
+    void step();
+    void step_RK4();
+    void step_RK45();
+    void step_boris();
+    double energy() const; // eV
+    double kinetic_energy() const; // eV
+    double energy_drift() const;
+    void plot_orbit_point();
+    void set_integrator(const Integrator integrator, const double tolerance = rk45_tolerance);
+    // planar tracking only
+    void set_region_map(const FieldRegionMap* region_map);
+    void set_obstacles(const Obstacles* obstacles);
+    bool is_anihilated();
+
+    Vector x; // m
+    Vector p; // eV/c
+    Vector x_previous; // before the last step
+    Vector p_previous;
+
+    const double mass; // eV
+    const double charge;
+    const double charge_over_mass; // 1/eV
+    const double initial_kinetic_energy; // eV
+
+    const Field* magnetic_field;
+
+    const Obstacles* obstacles = nullptr;
+
+    std::vector<double> orbit; // D coordinates per point, m
+    int tau_index = 0; // steps taken
+    double tau = 0; // proper time, m
+    const double dtau;
+    const double tau_final;
+    int anihilation_type = 0;
+    int obstacle = -1; // index in obstacles of what stopped the electron
+    long long field_evaluations = 0; // field lookups
+
+    Integrator integrator = Integrator::RK4;
+    double tolerance = rk45_tolerance;
+    double dtau_next; // RK45 step size to try next
+
+    const FieldRegionMap* region_map = nullptr;
+    // when the last step was an analytic arc: the rotation of p per proper time, and over the step
+    double region_omega = 0, region_turn = 0;
+
+  private:
+    bool step_region();
+    bool arc_hit(double& turn);
+    // p x B at x; times q h / m it is the change of p over a step h
+    Vector force(const Vector& x, const Vector& p);
+    double clearance() const;
+};
+
+using BeamRK4 = BeamTracker<2>;
+using BeamRK4_3D = BeamTracker<3>;
+
+// kinetic energy of momentum p, without the cancellation of E - m
+inline double kinetic_energy_of(const double p2, const double mass){
+  return p2 / (std::sqrt(p2 + mass * mass) + mass);
+}
+
+template <int D>
+BeamTracker<D>::BeamTracker(const Vector& initial_x, const Vector& initial_p, const double mass, const double charge, const Field* magnetic_field, const double dtau, const double tau_final)
+: x(initial_x), p(initial_p), x_previous(initial_x), p_previous(initial_p), mass(mass), charge(charge), charge_over_mass(charge / mass), initial_kinetic_energy(kinetic_energy_of(initial_p.mag2(), mass)),
+  magnetic_field(magnetic_field), dtau(dtau), tau_final(tau_final), dtau_next(dtau){}
+
+template <int D>
+void BeamTracker<D>::plot_orbit_point(){
+  for(int axis = 0; axis < D; axis++){
+    orbit.push_back(x[axis]);
+  }
+}
+
+template <int D>
+typename BeamTracker<D>::Vector BeamTracker<D>::force(const Vector& x, const Vector& p){
+  field_evaluations++;
+  return Space::p_cross_b(*magnetic_field, x, p);
+}
+
+template <int D>
+double BeamTracker<D>::energy() const {
+  return std::sqrt(p.mag2() + mass * mass);
+}
+
+template <int D>
+double BeamTracker<D>::kinetic_energy() const {
+  return kinetic_energy_of(p.mag2(), mass);
+}
+
+template <int D>
+void BeamTracker<D>::set_integrator(const Integrator integrator, const double tolerance){
+  this->integrator = integrator;
+  this->tolerance = tolerance;
+}
+
+template <int D>
+void BeamTracker<D>::set_region_map(const FieldRegionMap* region_map){
+  static_assert(D == 2, "the field region map is planar");
+  this->region_map = region_map;
+}
+
+template <int D>
+void BeamTracker<D>::set_obstacles(const Obstacles* obstacles){
+  this->obstacles = obstacles;
+}
+
+// the whole last step is checked against the obstacles, and an electron that met one
+// is put back where it entered it
+template <int D>
+bool BeamTracker<D>::is_anihilated(){
+  double t, turn;
+  if(region_omega != 0){
+    if(obstacles != nullptr && arc_hit(turn)){
+      // back to where the arc entered the obstacle, with the momentum it had there
+      const double cos_turn = TMath::Cos(turn), sin_turn = TMath::Sin(turn);
+      const double one_minus_cos = 2 * TMath::Sin(turn / 2) * TMath::Sin(turn / 2);
+      const double px = p_previous[0], py = p_previous[1];
+      x[0] = x_previous[0] + (px * sin_turn + py * one_minus_cos) / (region_omega * mass);
+      x[1] = x_previous[1] + (py * sin_turn - px * one_minus_cos) / (region_omega * mass);
+      p[0] = px * cos_turn + py * sin_turn;
+      p[1] = -px * sin_turn + py * cos_turn;
+      if(!orbit.empty()){
+        for(int axis = 0; axis < D; axis++){
+          orbit.end()[axis - D] = x[axis];
+        }
+      }
+      return true;
+    }
+  }else if(obstacles != nullptr && Space::first_hit(*obstacles, x_previous, x, t, anihilation_type, obstacle)){
+    x = x_previous + (x - x_previous) * t;
+    if(!orbit.empty()){
+      for(int axis = 0; axis < D; axis++){
+        orbit.end()[axis - D] = x[axis];
+      }
+    }
+    return true;
+  }
+  if(tau >= tau_final){
+    return true;
+  }
+  return Space::is_at_edge(*magnetic_field, x, edge_margin);
+}
+
+// The analytic arc of the last step against the obstacles: it is cut into pieces short enough
+// that none bulges more than arc_collision_tolerance from its chord, and the chords are tested
+// in order. turn is how far p had turned where the first hit chord entered an obstacle
+template <int D>
+bool BeamTracker<D>::arc_hit(double& turn){
+  const double radius = p_previous.mag() / (TMath::Abs(region_omega) * mass);
+  const double total_turn = region_turn;
+  // the bulge of a piece turning by a is radius (1 - cos(a / 2))
+  const double piece_turn = 2 * TMath::ACos(std::max(1 - arc_collision_tolerance / radius, -1.0));
+  const int pieces = std::max(1, (int)std::ceil(TMath::Abs(total_turn) / piece_turn));
+  const double px = p_previous[0], py = p_previous[1];
+  Vector start = x_previous;
+  for(int piece = 1; piece <= pieces; piece++){
+    const double a = total_turn * piece / pieces;
+    const double one_minus_cos = 2 * TMath::Sin(a / 2) * TMath::Sin(a / 2);
+    Vector end = x_previous;
+    end[0] += (px * TMath::Sin(a) + py * one_minus_cos) / (region_omega * mass);
+    end[1] += (py * TMath::Sin(a) - px * one_minus_cos) / (region_omega * mass);
+    double t;
+    if(Space::first_hit(*obstacles, start, end, t, anihilation_type, obstacle)){
+      turn = total_turn * (piece - 1 + t) / pieces;
+      return true;
+    }
+    start = end;
+  }
+  return false;
+}
+
+// distance the electron can fly before it reaches the edge margin, m
+template <int D>
+double BeamTracker<D>::clearance() const {
+  return Space::clearance(*magnetic_field, x, edge_margin);
+}
+
+// Crosses field-free cells on a straight line and uniform cells on the exact circle, as far as the
+// square of same-field cells around the electron, the clearance and tau_final allow.
+// Returns false in the nonuniform fringe, or when the jump would not beat a regular step.
+// Planar tracking only, see step. An arc is tested against the obstacles in pieces, see arc_hit
+template <int D>
+bool BeamTracker<D>::step_region(){
+  const FieldRegionMap::Cell& cell = region_map->cell_at(x[0], x[1]);
+  if(cell.kind == FieldRegionMap::general || cell.reach == 0){
+    return false;
+  }
+  const double speed = p.mag() / mass; // |dx/dtau|
+  double h = std::min(std::min(cell.reach * region_map->cell_size(), clearance()) / speed, tau_final - tau);
+  const double omega = charge_over_mass * cell.value; // rotation of p per proper time
+  if(omega != 0){
+    h = std::min(h, region_max_arc / TMath::Abs(omega));
+  }
+  if(h <= dtau){
+    return false;
+  }
+
+  if(cell.kind == FieldRegionMap::zero || TMath::Abs(omega * h) < 1e-9){
+    x += p * (h / mass);
+  }else{
+    // dp/dtau = omega (p_y, -p_x): p turns clockwise by omega h
+    const double cos_turn = TMath::Cos(omega * h), sin_turn = TMath::Sin(omega * h);
+    const double one_minus_cos = 2 * TMath::Sin(omega * h / 2) * TMath::Sin(omega * h / 2);
+    const double px = p[0], py = p[1];
+    x[0] += (px * sin_turn + py * one_minus_cos) / (omega * mass);
+    x[1] += (py * sin_turn - px * one_minus_cos) / (omega * mass);
+    p[0] = px * cos_turn + py * sin_turn;
+    p[1] = -px * sin_turn + py * cos_turn;
+    region_omega = omega;
+    region_turn = omega * h;
+  }
+  tau_index++;
+  tau = h == tau_final - tau ? tau_final : tau + h;
+  return true;
+}
+
+template <int D>
+void BeamTracker<D>::step(){
+  x_previous = x;
+  p_previous = p;
+  region_omega = 0;
+  if constexpr(D == 2){
+    if(region_map != nullptr && step_region()){
+      return;
+    }
+  }
+  if(integrator == Integrator::RK45){
+    step_RK45();
+  }else if(integrator == Integrator::Boris){
+    step_boris();
+  }else{
+    step_RK4();
+  }
+}
+
+template <int D>
+void BeamTracker<D>::step_RK4(){
+  // the last step lands on tau_final instead of overshooting it, or leaving a sliver behind
+  const double h = tau_final - tau < dtau * (1 + 1e-6) ? tau_final - tau : dtau;
+  const double kx = h / mass, kp = charge_over_mass * h;
+
+  const Vector dx1 = p * kx;
+  const Vector dp1 = force(x, p) * kp;
+
+  const Vector p2 = p + dp1 / 2;
+  const Vector dx2 = p2 * kx;
+  const Vector dp2 = force(x + dx1 / 2, p2) * kp;
+
+  const Vector p3 = p + dp2 / 2;
+  const Vector dx3 = p3 * kx;
+  const Vector dp3 = force(x + dx2 / 2, p3) * kp;
+
+  const Vector p4 = p + dp3;
+  const Vector dx4 = p4 * kx;
+  const Vector dp4 = force(x + dx3, p4) * kp;
+
+  x += (dx1 + 2 * dx2 + 2 * dx3 + dx4) / 6;
+  p += (dp1 + 2 * dp2 + 2 * dp3 + dp4) / 6;
+
+  tau_index++;
+  tau = h == dtau ? tau + dtau : tau_final;
+}
+
+// relativistic Boris push for a magnetic field only: drift half a step, rotate p with the field at
+// the midpoint, drift the other half. The rotation keeps |p|, and with it the energy, exactly
+template <int D>
+void BeamTracker<D>::step_boris(){
+  const double h = tau_final - tau < dtau * (1 + 1e-6) ? tau_final - tau : dtau;
+
+  x += p * (h / 2 / mass);
+  p = Space::boris_rotate(*magnetic_field, x, p, charge_over_mass * h / 2);
+  field_evaluations++;
+  x += p * (h / 2 / mass);
+
+  tau_index++;
+  tau = h == dtau ? tau + dtau : tau_final;
+}
+
+// relative change of the kinetic energy since the start; a magnetic field cannot change it
+template <int D>
+double BeamTracker<D>::energy_drift() const {
+  return (kinetic_energy() - initial_kinetic_energy) / initial_kinetic_energy;
+}
+
+// Dormand-Prince 5(4): the 5th order solution is kept, the embedded 4th order one sizes the step.
+// Near the edge the step is kept within the clearance, but never below dtau
+template <int D>
+void BeamTracker<D>::step_RK45(){
+  const double momentum = p.mag();
+  const double h_clearance = std::max(clearance() / (momentum / mass), dtau);
+
+  while(true){
+    const double h = std::min({dtau_next, h_clearance, tau_final - tau});
+    const double kx = h / mass, kp = charge_over_mass * h;
+
+    const Vector dx1 = p * kx;
+    const Vector dp1 = force(x, p) * kp;
+
+    const Vector p2 = p + dp1 / 5;
+    const Vector dx2 = p2 * kx;
+    const Vector dp2 = force(x + dx1 / 5, p2) * kp;
+
+    const Vector p3 = p + dp1 * (3.0 / 40) + dp2 * (9.0 / 40);
+    const Vector dx3 = p3 * kx;
+    const Vector dp3 = force(x + dx1 * (3.0 / 40) + dx2 * (9.0 / 40), p3) * kp;
+
+    const Vector p4 = p + dp1 * (44.0 / 45) - dp2 * (56.0 / 15) + dp3 * (32.0 / 9);
+    const Vector dx4 = p4 * kx;
+    const Vector dp4 = force(x + dx1 * (44.0 / 45) - dx2 * (56.0 / 15) + dx3 * (32.0 / 9), p4) * kp;
+
+    const Vector p5 = p + dp1 * (19372.0 / 6561) - dp2 * (25360.0 / 2187) + dp3 * (64448.0 / 6561) - dp4 * (212.0 / 729);
+    const Vector dx5 = p5 * kx;
+    const Vector dp5 = force(x + dx1 * (19372.0 / 6561) - dx2 * (25360.0 / 2187) + dx3 * (64448.0 / 6561) - dx4 * (212.0 / 729), p5) * kp;
+
+    const Vector p6 = p + dp1 * (9017.0 / 3168) - dp2 * (355.0 / 33) + dp3 * (46732.0 / 5247) + dp4 * (49.0 / 176) - dp5 * (5103.0 / 18656);
+    const Vector dx6 = p6 * kx;
+    const Vector dp6 = force(x + dx1 * (9017.0 / 3168) - dx2 * (355.0 / 33) + dx3 * (46732.0 / 5247) + dx4 * (49.0 / 176) - dx5 * (5103.0 / 18656), p6) * kp;
+
+    const Vector x_next = x + dx1 * (35.0 / 384) + dx3 * (500.0 / 1113) + dx4 * (125.0 / 192) - dx5 * (2187.0 / 6784) + dx6 * (11.0 / 84);
+    const Vector p_next = p + dp1 * (35.0 / 384) + dp3 * (500.0 / 1113) + dp4 * (125.0 / 192) - dp5 * (2187.0 / 6784) + dp6 * (11.0 / 84);
+
+    const Vector dx7 = p_next * kx;
+    const Vector dp7 = force(x_next, p_next) * kp;
+
+    // difference between the 5th and the 4th order solutions
+    const Vector x_error = dx1 * (71.0 / 57600) - dx3 * (71.0 / 16695) + dx4 * (71.0 / 1920) - dx5 * (17253.0 / 339200) + dx6 * (22.0 / 525) - dx7 * (1.0 / 40);
+    const Vector p_error = dp1 * (71.0 / 57600) - dp3 * (71.0 / 16695) + dp4 * (71.0 / 1920) - dp5 * (17253.0 / 339200) + dp6 * (22.0 / 525) - dp7 * (1.0 / 40);
+    const double error = std::max(x_error.mag() / tolerance, p_error.mag() / (tolerance * momentum));
+
+    const double growth = error == 0 ? 5 : std::min(5.0, std::max(0.2, 0.9 * std::pow(error, -0.2)));
+    if(error <= 1 || h <= dtau){
+      x = x_next;
+      p = p_next;
+      tau_index++;
+      tau = h == tau_final - tau ? tau_final : tau + h;
+      // a step cut short by the clearance or tau_final that went well says nothing against the old guess
+      if(!(h < dtau_next && growth >= 1)){
+        dtau_next = h * growth;
+      }
+      return;
+    }
+    dtau_next = std::max(h * growth, dtau);
+  }
+}
+
+#endif
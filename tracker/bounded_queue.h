@@ -0,0 +1,162 @@
+#ifndef RUNGE_TRACKER_BOUNDED_QUEUE_H
+#define RUNGE_TRACKER_BOUNDED_QUEUE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <thread>
+
+// Bounded multi-producer multi-consumer queue without locks (D. Vyukov's array queue): every
+// cell carries a sequence number telling whether it is free for the push of a lap or holds the
+// value for the pop of that lap, so a push or pop is one compare-and-swap on its position and
+// one store, and producers and consumers only meet on the cells they share.
+//
+// A full queue holds the producers back in push, an empty one the consumer in pop: they spin a
+// little, then yield, then sleep in short naps, so a stalled side costs no CPU for long.
+// The time producers spent waiting is counted, as the measure of how often the consumer kept
+// them from working.
+//
+// In run_blocks the values are the indices of finished event blocks, not the events: the
+// records stay in the blocks, so the capacity only bounds how many finished blocks may wait
+// for the writer, and the memory the blocks hold is bounded by run_blocks' window of blocks in
+// flight.
+template <class T>
+class BoundedQueue {
+  public:
+    // capacity is rounded up to a power of two, at least 2
+    explicit BoundedQueue(const std::size_t capacity);
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    bool try_push(const T& value);
+    bool try_pop(T& value);
+    // wait while the queue is full
+    void push(const T& value);
+    // wait while the queue is empty
+    void pop(T& value);
+
+    // values in the queue; exact only while nobody pushes or pops
+    std::size_t depth() const;
+    std::size_t capacity() const;
+
+    std::atomic<long long> full_pushes{0}; // pushes that found the queue full
+    std::atomic<long long> full_wait_ns{0}; // and waited this long for room, ns
+
+  private:
+    struct Cell {
+      std::atomic<std::size_t> sequence;
+      T value;
+    };
+
+    const std::size_t mask;
+    const std::unique_ptr<Cell[]> cells;
+    alignas(64) std::atomic<std::size_t> push_position{0};
+    alignas(64) std::atomic<std::size_t> pop_position{0};
+};
+
+// rounds waited so far -> spin, yield, or nap
+inline void queue_backoff(int& rounds){
+  if(rounds < 64){
+    rounds++;
+  }else if(rounds < 128){
+    rounds++;
+    std::this_thread::yield();
+  }else{
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+  }
+}
+
+inline std::size_t queue_capacity(const std::size_t capacity){
+  std::size_t power = 2; // with one cell a push could not tell it full from empty
+  while(power < capacity){
+    power *= 2;
+  }
+  return power;
+}
+
+template <class T>
+BoundedQueue<T>::BoundedQueue(const std::size_t capacity)
+: mask(queue_capacity(capacity) - 1), cells(new Cell[mask + 1]){
+  for(std::size_t i = 0; i <= mask; i++){
+    cells[i].sequence.store(i, std::memory_order_relaxed);
+  }
+}
+
+template <class T>
+bool BoundedQueue<T>::try_push(const T& value){
+  std::size_t position = push_position.load(std::memory_order_relaxed);
+  while(true){
+    Cell& cell = cells[position & mask];
+    const std::size_t sequence = cell.sequence.load(std::memory_order_acquire);
+    const std::ptrdiff_t lap = (std::ptrdiff_t)sequence - (std::ptrdiff_t)position;
+    if(lap == 0){
+      if(push_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)){
+        cell.value = value;
+        cell.sequence.store(position + 1, std::memory_order_release);
+        return true;
+      }
+    }else if(lap < 0){
+      return false; // the cell still holds the value of the last lap
+    }else{
+      position = push_position.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+template <class T>
+bool BoundedQueue<T>::try_pop(T& value){
+  std::size_t position = pop_position.load(std::memory_order_relaxed);
+  while(true){
+    Cell& cell = cells[position & mask];
+    const std::size_t sequence = cell.sequence.load(std::memory_order_acquire);
+    const std::ptrdiff_t lap = (std::ptrdiff_t)sequence - (std::ptrdiff_t)(position + 1);
+    if(lap == 0){
+      if(pop_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)){
+        value = cell.value;
+        cell.sequence.store(position + mask + 1, std::memory_order_release);
+        return true;
+      }
+    }else if(lap < 0){
+      return false; // nothing pushed into the cell yet
+    }else{
+      position = pop_position.load(std::memory_order_relaxed);
+    }
+  }
+}
+
+template <class T>
+void BoundedQueue<T>::push(const T& value){
+  if(try_push(value)){
+    return;
+  }
+  const auto start = std::chrono::steady_clock::now();
+  int rounds = 0;
+  do{
+    queue_backoff(rounds);
+  }while(!try_push(value));
+  full_pushes++;
+  full_wait_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+template <class T>
+void BoundedQueue<T>::pop(T& value){
+  int rounds = 0;
+  while(!try_pop(value)){
+    queue_backoff(rounds);
+  }
+}
+
+template <class T>
+std::size_t BoundedQueue<T>::depth() const {
+  const std::size_t pushed = push_position.load(std::memory_order_relaxed);
+  const std::size_t popped = pop_position.load(std::memory_order_relaxed);
+  return pushed > popped ? pushed - popped : 0;
+}
+
+template <class T>
+std::size_t BoundedQueue<T>::capacity() const {
+  return mask + 1;
+}
+
+#endif
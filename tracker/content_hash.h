@@ -0,0 +1,34 @@
+#ifndef RUNGE_TRACKER_CONTENT_HASH_H
+#define RUNGE_TRACKER_CONTENT_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+// 64 bit FNV-1a (Fowler, Noll, Vo) over bytes, for naming results by what they were made from.
+// It is not cryptographic; two setups only collide by chance, about once in 2^64.
+const std::uint64_t fnv1a_offset = 0xcbf29ce484222325ULL;
+const std::uint64_t fnv1a_prime = 0x100000001b3ULL;
+
+// hash continues an earlier call, so several pieces hash as if they were one
+inline std::uint64_t fnv1a(const void* data, const std::size_t bytes, std::uint64_t hash = fnv1a_offset){
+  const unsigned char* byte = static_cast<const unsigned char*>(data);
+  for(std::size_t i = 0; i < bytes; i++){
+    hash = (hash ^ byte[i]) * fnv1a_prime;
+  }
+  return hash;
+}
+
+inline std::uint64_t fnv1a(const std::string& text, const std::uint64_t hash = fnv1a_offset){
+  return fnv1a(text.data(), text.size(), hash);
+}
+
+// 16 hex digits, e.g. for a directory name
+inline std::string hash_hex(const std::uint64_t hash){
+  char text[17];
+  std::snprintf(text, sizeof(text), "%016llx", (unsigned long long)hash);
+  return text;
+}
+
+#endif
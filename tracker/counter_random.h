@@ -0,0 +1,149 @@
+#ifndef RUNGE_TRACKER_COUNTER_RANDOM_H
+#define RUNGE_TRACKER_COUNTER_RANDOM_H
+
+#include <cmath>
+#include <cstdint>
+
+// Counter-based random numbers: Philox4x32-10 (Salmon et al., "Parallel random numbers:
+// as easy as 1, 2, 3", SC11) turns a 128 bit counter and a 64 bit key into 128 random bits
+// without any state carried from one call to the next. With the key taken from the seed and
+// the counter from (event, draw), every event has its own numbers: they do not depend on the
+// thread, the block or the order the events are generated in, and any single event can be
+// drawn again on its own.
+//
+// Counter words: event (low, high), draw, 0. Draw 0 is the nominal source, draw 1 picks
+// between the nominal and the importance source, and draws from 2 on are for CounterUniform,
+// except the last one, vertical_draw, which points sources out of the plane.
+
+const std::uint32_t vertical_draw = 0xFFFFFFFF;
+
+const std::uint32_t philox_multiplier[2] = {0xD2511F53, 0xCD9E8D57};
+const std::uint32_t philox_weyl[2] = {0x9E3779B9, 0xBB67AE85};
+
+// one Philox4x32-10 block, counter c replaced by the random words
+inline void philox4x32(std::uint32_t c[4], const std::uint32_t key[2]){
+  std::uint32_t k0 = key[0], k1 = key[1];
+  for(int round = 0; round < 10; round++){
+    const std::uint64_t product0 = (std::uint64_t)philox_multiplier[0] * c[0];
+    const std::uint64_t product1 = (std::uint64_t)philox_multiplier[1] * c[2];
+    const std::uint32_t c1 = c[1], c3 = c[3];
+    c[0] = (std::uint32_t)(product1 >> 32) ^ c1 ^ k0;
+    c[1] = (std::uint32_t)product1;
+    c[2] = (std::uint32_t)(product0 >> 32) ^ c3 ^ k1;
+    c[3] = (std::uint32_t)product0;
+    k0 += philox_weyl[0];
+    k1 += philox_weyl[1];
+  }
+}
+
+// 52 random bits as a double in (0, 1), never 0 or 1: with 53 the largest, 1 - 2^-54, rounds to 1
+inline double uniform_open(const std::uint32_t high, const std::uint32_t low){
+  const std::uint64_t bits = ((std::uint64_t)high << 20) | (low >> 12);
+  return (bits + 0.5) * 0x1.0p-52;
+}
+
+// Phi^-1(p) for 0 < p < 1, Wichura's AS 241 (PPND16), relative error about 1e-16.
+inline double normal_quantile(const double p){
+  const double q = p - 0.5;
+  if(std::fabs(q) <= 0.425){
+    const double r = 0.180625 - q * q;
+    return q * (((((((2509.0809287301226727 * r + 33430.575583588128105) * r + 67265.770927008700853) * r
+                     + 45921.953931549871457) * r + 13731.693765509461125) * r + 1971.5909503065514427) * r
+                     + 133.14166789178437745) * r + 3.387132872796366608)
+             / (((((((5226.495278852545925 * r + 28729.085735721942674) * r + 39307.89580009271061) * r
+                     + 21213.794301586595867) * r + 5394.1960214247511077) * r + 687.1870074920579083) * r
+                     + 42.313330701600911252) * r + 1);
+  }
+  double r = std::sqrt(-std::log(q < 0 ? p : 1 - p));
+  double value;
+  if(r <= 5){
+    r -= 1.6;
+    value = (((((((7.7454501427834140764e-4 * r + 0.0227238449892691845833) * r + 0.24178072517745061177) * r
+                 + 1.27045825245236838258) * r + 3.64784832476320460504) * r + 5.7694972214606914055) * r
+                 + 4.6303378461565452959) * r + 1.42343711074968357734)
+          / (((((((1.05075007164441684324e-9 * r + 5.475938084995344946e-4) * r + 0.0151986665636164571966) * r
+                 + 0.14810397642748007459) * r + 0.68976733498510000455) * r + 1.6763848301838038494) * r
+                 + 2.05319162663775882187) * r + 1);
+  }else{
+    r -= 5;
+    value = (((((((2.01033439929228813265e-7 * r + 2.71155556874348757815e-5) * r + 0.0012426609473880784386) * r
+                 + 0.026532189526576123093) * r + 0.29656057182850489123) * r + 1.7848265399172913358) * r
+                 + 5.4637849111641143699) * r + 6.6579046435011037772)
+          / (((((((2.04426310338993978564e-15 * r + 1.4215117583164458887e-7) * r + 1.8463183175100546818e-5) * r
+                 + 7.868691311456132591e-4) * r + 0.0148753612908506148525) * r + 0.13692988092273580531) * r
+                 + 0.59983220655588793769) * r + 1);
+  }
+  return q < 0 ? -value : value;
+}
+
+// Nominal source for events first_event ... first_event + n - 1: momentum Gaussian(mean, sigma)
+// truncated at 0, angle uniform in [0, 2 pi). The momentum is drawn by inverting the truncated
+// CDF, so there is no rejection loop and every event costs the same; the events do not depend
+// on each other, so any block of them can be drawn on its own.
+// selectors, when given, gets a uniform (0, 1) per event for choosing a source.
+inline void sample_source(const std::uint32_t seed, const long long first_event, const int n, const double mean, const double sigma,
+                          double* momenta, double* angles, double* selectors = nullptr){
+  const std::uint32_t key[2] = {seed, 0};
+  const double below_zero = 0.5 * std::erfc(mean / (sigma * M_SQRT2)); // Phi(-mean / sigma)
+  for(int i = 0; i < n; i++){
+    const std::uint64_t event = first_event + i;
+    std::uint32_t c[4] = {(std::uint32_t)event, (std::uint32_t)(event >> 32), 0, 0};
+    philox4x32(c, key);
+    const double u = below_zero + (1 - below_zero) * uniform_open(c[0], c[1]);
+    momenta[i] = mean + sigma * normal_quantile(u);
+    angles[i] = 2 * M_PI * uniform_open(c[2], c[3]);
+  }
+  if(selectors == nullptr){
+    return;
+  }
+  for(int i = 0; i < n; i++){
+    const std::uint64_t event = first_event + i;
+    std::uint32_t c[4] = {(std::uint32_t)event, (std::uint32_t)(event >> 32), 1, 0};
+    philox4x32(c, key);
+    selectors[i] = uniform_open(c[0], c[1]);
+  }
+}
+
+// a uniform (0, 1) per event from one draw of its counter
+inline void sample_uniform(const std::uint32_t seed, const long long first_event, const int n, const std::uint32_t draw, double* uniforms){
+  const std::uint32_t key[2] = {seed, 0};
+  for(int i = 0; i < n; i++){
+    const std::uint64_t event = first_event + i;
+    std::uint32_t c[4] = {(std::uint32_t)event, (std::uint32_t)(event >> 32), draw, 0};
+    philox4x32(c, key);
+    uniforms[i] = uniform_open(c[0], c[1]);
+  }
+}
+
+// Open ended uniform (0, 1) draws of one event, for samplers that need a varying number of them
+class CounterUniform {
+  public:
+    CounterUniform(const std::uint32_t seed, const long long event);
+
+    double operator()();
+
+  private:
+    const std::uint32_t key[2];
+    const std::uint64_t event;
+    std::uint32_t draw = 2;
+    std::uint32_t words[4];
+    int used = 4; // words of the current block handed out
+};
+
+inline CounterUniform::CounterUniform(const std::uint32_t seed, const long long event)
+: key{seed, 0}, event(event){}
+
+inline double CounterUniform::operator()(){
+  if(used == 4){
+    words[0] = (std::uint32_t)event;
+    words[1] = (std::uint32_t)(event >> 32);
+    words[2] = draw++;
+    words[3] = 0;
+    philox4x32(words, key);
+    used = 0;
+  }
+  used += 2;
+  return uniform_open(words[used - 2], words[used - 1]);
+}
+
+#endif
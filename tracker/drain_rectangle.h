@@ -0,0 +1,29 @@
+#ifndef RUNGE_TRACKER_DRAIN_RECTANGLE_H
+#define RUNGE_TRACKER_DRAIN_RECTANGLE_H
+
+#include "TBox.h"
+
+// A collimator jaw or a detector: electrons entering it stop there with its anihilation_type.
+// Coordinates in metres; the box drawn on the canvases is in length_unit.
+// The tracker sees it through an ObstacleGrid, see add_rectangle
+class DrainRectangle{
+  public:
+    DrainRectangle(const double x1, const double x2, const double y1, const double y2, const double length_unit, const int anihilation_type)
+      : x1(x1), x2(x2), y1(y1), y2(y2), length_unit(length_unit), anihilation_type(anihilation_type){
+        tbox = new TBox(x1 / length_unit, y1 / length_unit, x2 / length_unit, y2 / length_unit);
+        tbox->SetFillStyle(3001);
+        tbox->SetFillColor(kRed);
+      }
+    ~DrainRectangle(){
+      delete tbox;
+    }
+    DrainRectangle(const DrainRectangle&) = delete;
+    DrainRectangle& operator=(const DrainRectangle&) = delete;
+
+    const double x1, x2, y1, y2;
+    double length_unit;
+    TBox* tbox;
+    const int anihilation_type;
+};
+
+#endif
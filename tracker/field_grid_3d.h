@@ -0,0 +1,205 @@
+#ifndef RUNGE_TRACKER_FIELD_GRID_3D_H
+#define RUNGE_TRACKER_FIELD_GRID_3D_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "TAxis.h"
+#include "TH3D.h"
+
+#include "content_hash.h"
+#include "magnetic_field_grid.h"
+#include "space_vector.h"
+
+// Bx, By and Bz sampled at the bin centres of a 3D map with one replicated node on every side, as
+// MagneticFieldGrid does in the plane, and interpolated trilinearly. Lengths are in metres and
+// values are already multiplied by the field unit.
+//
+// The nodes are stored in bricks of brick_cells^3 cells. A brick holds all (brick_cells + 1)^3
+// nodes of its cells, the three components of a node side by side, so the eight corners of any
+// cell are 24 doubles within one brick, and a track stays in a few kilobytes of the map for many
+// steps instead of striding across whole planes of it. The nodes on the faces between bricks are
+// stored twice; with 8^3 cells per brick that is 42 % more memory.
+class FieldGrid3D {
+  public:
+    // Bx, By and Bz with the same binning
+    FieldGrid3D(const TH3D* field_x, const TH3D* field_y, const TH3D* field_z, const double length_unit, const double magnetic_field_unit);
+    // the field around the midplane of a magnet symmetric about z = 0, from the map of Bz in that
+    // plane, to second order in z: Bx = z dBz/dx, By = z dBz/dy, Bz = Bz(0) - z^2 / 2 laplacian Bz(0).
+    // It is free of divergence and curl to that order. nz bins over [z_min, z_max]; with nz odd a
+    // node lies in the midplane, where the planar field is reproduced
+    FieldGrid3D(const MagneticFieldGrid& midplane, const double z_min, const double z_max, const int nz);
+
+    bool is_inside(const double x, const double y, const double z) const;
+    // 0 outside the map, as MagneticFieldGrid::field
+    SpaceVector<3> field(const double x, const double y, const double z) const;
+    // FNV-1a of the extent and the nodes
+    std::uint64_t content_hash() const;
+
+    int nx, ny, nz; // bins
+    double x_min, x_max, y_min, y_max, z_min, z_max; // m
+    double dx, dy, dz; // m
+    double inv_dx, inv_dy, inv_dz; // 1/m
+
+    static const int brick_shift = 3;
+    static const int brick_cells = 1 << brick_shift; // each way
+    static const int brick_nodes = brick_cells + 1; // each way
+    static const int brick_size = 3 * brick_nodes * brick_nodes * brick_nodes; // doubles
+
+  private:
+    void set_spacing();
+    // the bricks from node(i, j, k, b), i, j, k from 0 to nx + 1, ny + 1, nz + 1
+    template <class Node>
+    void fill(const Node& node);
+
+    int bricks_x, bricks_y, bricks_z;
+    std::vector<double> bricks; // brick (a, b, c) at brick_size * ((c * bricks_y + b) * bricks_x + a)
+};
+
+inline void FieldGrid3D::set_spacing(){
+  dx = (x_max - x_min) / nx;
+  dy = (y_max - y_min) / ny;
+  dz = (z_max - z_min) / nz;
+  inv_dx = 1 / dx;
+  inv_dy = 1 / dy;
+  inv_dz = 1 / dz;
+  // cells between the nx + 2 nodes of an axis
+  bricks_x = (nx + brick_cells) / brick_cells;
+  bricks_y = (ny + brick_cells) / brick_cells;
+  bricks_z = (nz + brick_cells) / brick_cells;
+}
+
+template <class Node>
+void FieldGrid3D::fill(const Node& node){
+  bricks.assign((std::size_t)brick_size * bricks_x * bricks_y * bricks_z, 0);
+  double* brick_node = bricks.data();
+  for(int c = 0; c < bricks_z; c++){
+    for(int b = 0; b < bricks_y; b++){
+      for(int a = 0; a < bricks_x; a++){
+        // the last bricks reach past the map; their spare nodes repeat the edge
+        for(int k = 0; k < brick_nodes; k++){
+          for(int j = 0; j < brick_nodes; j++){
+            for(int i = 0; i < brick_nodes; i++){
+              node(std::min(a * brick_cells + i, nx + 1), std::min(b * brick_cells + j, ny + 1), std::min(c * brick_cells + k, nz + 1), brick_node);
+              brick_node += 3;
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+inline FieldGrid3D::FieldGrid3D(const TH3D* field_x, const TH3D* field_y, const TH3D* field_z, const double length_unit, const double magnetic_field_unit){
+  const TAxis* x_axis = field_z->GetXaxis();
+  const TAxis* y_axis = field_z->GetYaxis();
+  const TAxis* z_axis = field_z->GetZaxis();
+  nx = x_axis->GetNbins();
+  ny = y_axis->GetNbins();
+  nz = z_axis->GetNbins();
+  x_min = x_axis->GetXmin() * length_unit;
+  x_max = x_axis->GetXmax() * length_unit;
+  y_min = y_axis->GetXmin() * length_unit;
+  y_max = y_axis->GetXmax() * length_unit;
+  z_min = z_axis->GetXmin() * length_unit;
+  z_max = z_axis->GetXmax() * length_unit;
+  set_spacing();
+
+  fill([&](const int i, const int j, const int k, double* b){
+    const int bin_x = std::min(std::max(i, 1), nx);
+    const int bin_y = std::min(std::max(j, 1), ny);
+    const int bin_z = std::min(std::max(k, 1), nz);
+    b[0] = field_x->GetBinContent(bin_x, bin_y, bin_z) * magnetic_field_unit;
+    b[1] = field_y->GetBinContent(bin_x, bin_y, bin_z) * magnetic_field_unit;
+    b[2] = field_z->GetBinContent(bin_x, bin_y, bin_z) * magnetic_field_unit;
+  });
+}
+
+inline FieldGrid3D::FieldGrid3D(const MagneticFieldGrid& midplane, const double z_min, const double z_max, const int nz)
+: nx(midplane.nx), ny(midplane.ny), nz(nz), x_min(midplane.x_min), x_max(midplane.x_max), y_min(midplane.y_min), y_max(midplane.y_max), z_min(z_min), z_max(z_max){
+  set_spacing();
+
+  // Bz(0) and its derivatives at the bin centres; field() so a smoothed map is expanded smoothed.
+  // Central differences inside, one-sided ones at the edges of the map
+  std::vector<double> bz(nx * ny), gradient_x(nx * ny), gradient_y(nx * ny), laplacian(nx * ny);
+  for(int j = 0; j < ny; j++){
+    for(int i = 0; i < nx; i++){
+      bz[j * nx + i] = midplane.field(x_min + (i + 0.5) * dx, y_min + (j + 0.5) * dy);
+    }
+  }
+  auto derivatives = [](const double* f, const int n, const int stride, const int i, const double spacing, double& first, double& second){
+    if(n < 3){
+      first = n == 2 ? (f[stride] - f[0]) / spacing : 0;
+      second = 0;
+      return;
+    }
+    const int centre = std::min(std::max(i, 1), n - 2); // the three bins the differences are taken over
+    const double below = f[(centre - 1) * stride], middle = f[centre * stride], above = f[(centre + 1) * stride];
+    second = (above - 2 * middle + below) / (spacing * spacing);
+    first = (above - below) / (2 * spacing) + (i - centre) * spacing * second;
+  };
+  for(int j = 0; j < ny; j++){
+    for(int i = 0; i < nx; i++){
+      double second_x, second_y;
+      derivatives(&bz[j * nx], nx, 1, i, dx, gradient_x[j * nx + i], second_x);
+      derivatives(&bz[i], ny, nx, j, dy, gradient_y[j * nx + i], second_y);
+      laplacian[j * nx + i] = second_x + second_y;
+    }
+  }
+
+  fill([&](const int i, const int j, const int k, double* b){
+    const int bin = (std::min(std::max(j, 1), ny) - 1) * nx + std::min(std::max(i, 1), nx) - 1;
+    const double z = this->z_min + (std::min(std::max(k, 1), nz) - 0.5) * dz;
+    b[0] = z * gradient_x[bin];
+    b[1] = z * gradient_y[bin];
+    b[2] = bz[bin] - z * z / 2 * laplacian[bin];
+  });
+}
+
+inline bool FieldGrid3D::is_inside(const double x, const double y, const double z) const {
+  return x_min <= x && x < x_max && y_min <= y && y < y_max && z_min <= z && z < z_max;
+}
+
+inline SpaceVector<3> FieldGrid3D::field(const double x, const double y, const double z) const {
+  if(!is_inside(x, y, z)){
+    return {{0, 0, 0}};
+  }
+  // node i sits at the centre of bin i, so the padded node coordinate is half a bin ahead
+  const double u = (x - x_min) * inv_dx + 0.5;
+  const double v = (y - y_min) * inv_dy + 0.5;
+  const double w = (z - z_min) * inv_dz + 0.5;
+  const int i = static_cast<int>(u);
+  const int j = static_cast<int>(v);
+  const int k = static_cast<int>(w);
+  const double t = u - i;
+  const double s = v - j;
+  const double r = w - k;
+
+  const int mask = brick_cells - 1;
+  const int stride_y = 3 * brick_nodes, stride_z = 3 * brick_nodes * brick_nodes;
+  const double* corner = bricks.data() + (std::size_t)brick_size * (((k >> brick_shift) * bricks_y + (j >> brick_shift)) * bricks_x + (i >> brick_shift))
+                         + (k & mask) * stride_z + (j & mask) * stride_y + 3 * (i & mask);
+  SpaceVector<3> b;
+  for(int axis = 0; axis < 3; axis++){
+    const double* node = corner + axis;
+    const double bottom_front = node[0] + (node[3] - node[0]) * t;
+    const double bottom_back = node[stride_y] + (node[stride_y + 3] - node[stride_y]) * t;
+    const double top_front = node[stride_z] + (node[stride_z + 3] - node[stride_z]) * t;
+    const double top_back = node[stride_z + stride_y] + (node[stride_z + stride_y + 3] - node[stride_z + stride_y]) * t;
+    const double bottom = bottom_front + (bottom_back - bottom_front) * s;
+    const double top = top_front + (top_back - top_front) * s;
+    b[axis] = bottom + (top - bottom) * r;
+  }
+  return b;
+}
+
+inline std::uint64_t FieldGrid3D::content_hash() const {
+  const int bins[3] = {nx, ny, nz};
+  const double extent[6] = {x_min, x_max, y_min, y_max, z_min, z_max};
+  std::uint64_t hash = fnv1a(bins, sizeof(bins));
+  hash = fnv1a(extent, sizeof(extent), hash);
+  return fnv1a(bricks.data(), sizeof(double) * bricks.size(), hash);
+}
+
+#endif
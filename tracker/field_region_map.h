@@ -0,0 +1,121 @@
+#ifndef RUNGE_TRACKER_FIELD_REGION_MAP_H
+#define RUNGE_TRACKER_FIELD_REGION_MAP_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "magnetic_field_grid.h"
+
+// Classification of the bilinear cells of a MagneticFieldGrid (the squares between four nodes)
+// into field-free, near-uniform and general cells. Each cell also knows how many cells around it
+// are certainly of the same kind with the same field, so a tracker can cross that square
+// analytically instead of integrating it.
+class FieldRegionMap {
+  public:
+    enum Kind : unsigned char {
+      zero, // |B| below the tolerance at all four nodes
+      uniform, // the four nodes agree within the tolerance
+      general
+    };
+
+    struct Cell {
+      Kind kind;
+      int reach; // the square of cells this far around holds the same field, cells
+      double value; // mean field of the cell, c*eV/m
+    };
+
+    // tolerance is relative to the largest |B| of the map
+    FieldRegionMap(const MagneticFieldGrid* magnetic_field, const double tolerance);
+
+    const Cell& cell_at(const double x, const double y) const;
+    double cell_size() const;
+
+    const MagneticFieldGrid* magnetic_field;
+    int nx, ny; // cells, one more than the bins each way
+    std::vector<Cell> cells;
+};
+
+inline FieldRegionMap::FieldRegionMap(const MagneticFieldGrid* magnetic_field, const double tolerance)
+: magnetic_field(magnetic_field), nx(magnetic_field->nx + 1), ny(magnetic_field->ny + 1), cells(nx * ny){
+  const int stride = magnetic_field->stride;
+  const double* values = magnetic_field->values;
+  double largest = 0;
+  for(int node = 0; node < stride * (magnetic_field->ny + 2); node++){
+    largest = std::max(largest, std::fabs(values[node]));
+  }
+  const double absolute_tolerance = tolerance * largest;
+
+  // cells with the same label hold the same field to within the tolerance:
+  // 0 for field-free, odd for uniform, a cell of its own for general
+  std::vector<long long> labels(nx * ny);
+  for(int j = 0; j < ny; j++){
+    for(int i = 0; i < nx; i++){
+      const double* node = values + j * stride + i;
+      const double corners[4] = {node[0], node[1], node[stride], node[stride + 1]};
+      const double low = *std::min_element(corners, corners + 4);
+      const double high = *std::max_element(corners, corners + 4);
+      Cell& cell = cells[j * nx + i];
+      cell.value = (corners[0] + corners[1] + corners[2] + corners[3]) / 4;
+      cell.reach = 0;
+      if(absolute_tolerance > 0 && std::max(std::fabs(low), std::fabs(high)) <= absolute_tolerance){
+        cell.kind = zero;
+        cell.value = 0;
+        labels[j * nx + i] = 0;
+      }else if(absolute_tolerance > 0 && high - low <= absolute_tolerance){
+        cell.kind = uniform;
+        labels[j * nx + i] = 1 + 2 * std::llround(cell.value / absolute_tolerance);
+      }else{
+        cell.kind = general;
+        labels[j * nx + i] = -2 - 2 * (long long)(j * nx + i); // even and negative, unlike the others
+      }
+    }
+  }
+
+  // chessboard distance to the nearest cell touching another label or the border of the map
+  const int far = nx + ny;
+  std::vector<int> distance(nx * ny, far);
+  for(int j = 0; j < ny; j++){
+    for(int i = 0; i < nx; i++){
+      if(cells[j * nx + i].kind == general || i == 0 || j == 0 || i == nx - 1 || j == ny - 1){
+        distance[j * nx + i] = 0;
+        continue;
+      }
+      for(int dj = -1; dj <= 1; dj++){
+        for(int di = -1; di <= 1; di++){
+          if(labels[(j + dj) * nx + i + di] != labels[j * nx + i]){
+            distance[j * nx + i] = 0;
+          }
+        }
+      }
+    }
+  }
+  for(int j = 1; j < ny; j++){
+    for(int i = 1; i < nx - 1; i++){
+      int& d = distance[j * nx + i];
+      d = std::min({d, distance[(j - 1) * nx + i - 1] + 1, distance[(j - 1) * nx + i] + 1, distance[(j - 1) * nx + i + 1] + 1, distance[j * nx + i - 1] + 1});
+    }
+  }
+  for(int j = ny - 2; j >= 0; j--){
+    for(int i = nx - 2; i >= 1; i--){
+      int& d = distance[j * nx + i];
+      d = std::min({d, distance[(j + 1) * nx + i - 1] + 1, distance[(j + 1) * nx + i] + 1, distance[(j + 1) * nx + i + 1] + 1, distance[j * nx + i + 1] + 1});
+    }
+  }
+  for(int cell = 0; cell < nx * ny; cell++){
+    cells[cell].reach = distance[cell];
+  }
+}
+
+inline const FieldRegionMap::Cell& FieldRegionMap::cell_at(const double x, const double y) const {
+  // same cell the bilinear lookup of MagneticFieldGrid::field uses
+  const double u = std::min(std::max((x - magnetic_field->x_min) * magnetic_field->inv_dx + 0.5, 0.0), (double)(nx - 1));
+  const double v = std::min(std::max((y - magnetic_field->y_min) * magnetic_field->inv_dy + 0.5, 0.0), (double)(ny - 1));
+  return cells[static_cast<int>(v) * nx + static_cast<int>(u)];
+}
+
+inline double FieldRegionMap::cell_size() const {
+  return std::min(magnetic_field->dx, magnetic_field->dy);
+}
+
+#endif
@@ -0,0 +1,151 @@
+#ifndef RUNGE_TRACKER_IMPORTANCE_SOURCE_H
+#define RUNGE_TRACKER_IMPORTANCE_SOURCE_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Counts of source events and of those that reached the detector, over cells of
+// (momentum, emission angle). Filled from a pilot run with the nominal source.
+class AcceptanceMap {
+  public:
+    AcceptanceMap(const double momentum_max, const int n_momentum, const int n_angle);
+
+    // -1 beyond momentum_max
+    int cell(const double momentum, const double angle) const;
+    void fill(const double momentum, const double angle, const bool detected);
+
+    const double momentum_max; // eV/c
+    const int n_momentum, n_angle; // angle cells cover [0, 2 pi)
+    std::vector<long long> events, detected; // cell (i, j) at j * n_momentum + i, j for the angle
+};
+
+// Nominal source p: momentum Gaussian truncated at 0, angle uniform.
+// The proposal q = (1 - fraction) p + fraction p restricted to A, where A is the cells with
+// a detected pilot event, grown by margin cells each way so the coarse map does not cut
+// into the acceptance. An event then weighs p / q = 1 / ((1 - fraction) + fraction [in A] / P(A)),
+// with P(A) computed exactly from p, so weighted histograms are unbiased everywhere,
+// including outside A, where the nominal part of q still samples.
+class ImportanceSource {
+  public:
+    ImportanceSource(const AcceptanceMap& acceptance_map, const double momentum_mean, const double momentum_sigma, const double fraction, const int margin);
+
+    bool in_region(const double momentum, const double angle) const;
+    double weight(const double momentum, const double angle) const;
+    // p restricted to A, uniform() drawing from (0, 1)
+    template <class Uniform>
+    void sample_region(Uniform& uniform, double& momentum, double& angle) const;
+
+    const double momentum_mean, momentum_sigma; // eV/c
+    const double fraction;
+    double region_probability = 0; // P(A) under p
+    int region_cells = 0;
+
+  private:
+    double momentum_probability(const double low, const double high) const;
+
+    const AcceptanceMap& acceptance_map;
+    std::vector<bool> region;
+    std::vector<int> cells; // of A, in order
+    std::vector<double> cumulative; // P of the cells of A up to each one, over P(A)
+};
+
+inline AcceptanceMap::AcceptanceMap(const double momentum_max, const int n_momentum, const int n_angle)
+: momentum_max(momentum_max), n_momentum(n_momentum), n_angle(n_angle), events(n_momentum * n_angle), detected(n_momentum * n_angle){}
+
+inline int AcceptanceMap::cell(const double momentum, const double angle) const {
+  if(momentum < 0 || momentum >= momentum_max){
+    return -1;
+  }
+  const double turn = 2 * M_PI;
+  const double wrapped = angle - turn * std::floor(angle / turn);
+  const int i = momentum / momentum_max * n_momentum;
+  const int j = std::min(static_cast<int>(wrapped / turn * n_angle), n_angle - 1);
+  return j * n_momentum + i;
+}
+
+inline void AcceptanceMap::fill(const double momentum, const double angle, const bool detected){
+  const int cell = this->cell(momentum, angle);
+  if(cell < 0){
+    return;
+  }
+  events[cell]++;
+  if(detected){
+    this->detected[cell]++;
+  }
+}
+
+inline ImportanceSource::ImportanceSource(const AcceptanceMap& acceptance_map, const double momentum_mean, const double momentum_sigma, const double fraction, const int margin)
+: momentum_mean(momentum_mean), momentum_sigma(momentum_sigma), fraction(fraction), acceptance_map(acceptance_map), region(acceptance_map.events.size()){
+  const int n_momentum = acceptance_map.n_momentum, n_angle = acceptance_map.n_angle;
+  for(int j = 0; j < n_angle; j++){
+    for(int i = 0; i < n_momentum; i++){
+      if(acceptance_map.detected[j * n_momentum + i] == 0){
+        continue;
+      }
+      // the angle wraps around, the momentum does not
+      for(int dj = -margin; dj <= margin; dj++){
+        for(int di = std::max(-margin, -i); di <= std::min(margin, n_momentum - 1 - i); di++){
+          region[((j + dj + n_angle) % n_angle) * n_momentum + i + di] = true;
+        }
+      }
+    }
+  }
+
+  const double momentum_step = acceptance_map.momentum_max / n_momentum;
+  for(int cell = 0; cell < (int)region.size(); cell++){
+    if(!region[cell]){
+      continue;
+    }
+    const int i = cell % n_momentum;
+    region_probability += momentum_probability(i * momentum_step, (i + 1) * momentum_step) / n_angle;
+    cells.push_back(cell);
+    cumulative.push_back(region_probability);
+  }
+  for(auto& probability:cumulative){
+    probability /= region_probability;
+  }
+  region_cells = cells.size();
+}
+
+// P(low <= momentum < high) under the truncated Gaussian
+inline double ImportanceSource::momentum_probability(const double low, const double high) const {
+  auto normal_cdf = [&](const double momentum){
+    return 0.5 * std::erfc(-(momentum - momentum_mean) / (momentum_sigma * M_SQRT2));
+  };
+  return (normal_cdf(high) - normal_cdf(std::max(low, 0.0))) / (1 - normal_cdf(0));
+}
+
+inline bool ImportanceSource::in_region(const double momentum, const double angle) const {
+  const int cell = acceptance_map.cell(momentum, angle);
+  return cell >= 0 && region[cell];
+}
+
+inline double ImportanceSource::weight(const double momentum, const double angle) const {
+  if(region_cells == 0){
+    return 1;
+  }
+  return 1 / ((1 - fraction) + (in_region(momentum, angle) ? fraction / region_probability : 0));
+}
+
+template <class Uniform>
+void ImportanceSource::sample_region(Uniform& uniform, double& momentum, double& angle) const {
+  const int index = std::min(static_cast<int>(std::lower_bound(cumulative.begin(), cumulative.end(), uniform()) - cumulative.begin()), region_cells - 1);
+  const int i = cells[index] % acceptance_map.n_momentum, j = cells[index] / acceptance_map.n_momentum;
+
+  // the Gaussian inside one momentum cell, by rejection against its largest value there
+  const double momentum_step = acceptance_map.momentum_max / acceptance_map.n_momentum;
+  const double low = i * momentum_step, high = low + momentum_step;
+  const double closest = std::min(std::max(momentum_mean, low), high);
+  auto log_density = [&](const double momentum){
+    const double z = (momentum - momentum_mean) / momentum_sigma;
+    return -z * z / 2;
+  };
+  do{
+    momentum = low + uniform() * momentum_step;
+  }while(std::log(uniform()) > log_density(momentum) - log_density(closest) || momentum <= 0);
+
+  angle = (j + uniform()) * 2 * M_PI / acceptance_map.n_angle;
+}
+
+#endif
@@ -0,0 +1,16 @@
+#ifndef RUNGE_TRACKER_INDEPENDENT_LANES_H
+#define RUNGE_TRACKER_INDEPENDENT_LANES_H
+
+// Put before a loop over electrons whose iterations are independent and whose arrays never
+// overlap. Said so, the compiler vectorises the loop as it is, instead of first checking every
+// pair of arrays for overlap, which it gives up on beyond a handful of arrays, or not at all
+// where one array is read at computed indices.
+#if defined(__clang__)
+#define RUNGE_INDEPENDENT_LANES _Pragma("clang loop vectorize(assume_safety)")
+#elif defined(__GNUC__)
+#define RUNGE_INDEPENDENT_LANES _Pragma("GCC ivdep")
+#else
+#define RUNGE_INDEPENDENT_LANES
+#endif
+
+#endif
@@ -0,0 +1,386 @@
+#ifndef RUNGE_TRACKER_MAGNETIC_FIELD_GRID_H
+#define RUNGE_TRACKER_MAGNETIC_FIELD_GRID_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "TAxis.h"
+#include "TH2D.h"
+
+#include "content_hash.h"
+#include "smoothing_spline.h"
+
+// Bz sampled at the bin centres of a TH2D, stored row-major (x fastest) with one replicated
+// node on every side, so the bilinear lookup needs no bin search and no edge clamping.
+// Lengths are in metres and values are already multiplied by the field unit.
+// The lookup reproduces TH2::Interpolate, including its constant half bin at the edges.
+//
+// A grid can be saved with write_cache and opened from the cache instead of the histogram.
+// The cache is mapped read-only, so opening it costs a few page table entries and every process
+// on a machine shares one copy of it in the page cache.
+//
+// A noisy measured map can be smoothed: the field then comes from a smoothing bicubic spline
+// with continuous first derivatives instead of the bilinear interpolation.
+class MagneticFieldGrid {
+  public:
+    MagneticFieldGrid(const TH2D* histogram, const double length_unit, const double magnetic_field_unit);
+    // the grid of a cache written by write_cache; check is_open
+    MagneticFieldGrid(const std::string& cache_path);
+    // other with every value multiplied by scale
+    MagneticFieldGrid(const MagneticFieldGrid& other, const double scale);
+    ~MagneticFieldGrid();
+    MagneticFieldGrid(const MagneticFieldGrid&) = delete;
+    MagneticFieldGrid& operator=(const MagneticFieldGrid&) = delete;
+
+    bool is_open() const;
+    double field(const double x, const double y) const;
+    bool is_inside(const double x, const double y) const;
+    // fits a smoothing spline to the bin centres, see smoothing_spline, and uses it from then on;
+    // the nodes take the smoothed values, so bilinear users of values see the same smoothed map
+    void smooth(const double smoothing);
+    // the cache of this grid; source_path is the file it was made from, so stale caches are noticed
+    bool write_cache(const std::string& cache_path, const std::string& source_path) const;
+    // whether the cache was made from source_path as it is now
+    bool is_current(const std::string& source_path) const;
+    // FNV-1a of the extent and the nodes, the same for a map from its histogram or its cache;
+    // smooth changes it
+    std::uint64_t content_hash() const;
+
+    int nx, ny; // bins
+    double x_min, x_max, y_min, y_max; // m
+    double dx, dy; // m
+    double inv_dx, inv_dy; // 1/m
+    int stride; // nx + 2 nodes per row
+    double length_unit, magnetic_field_unit; // of the histogram the grid was made from
+    const double* values = nullptr; // (nx + 2) * (ny + 2) nodes, c*eV/m
+    // c[4 a + b] of Bz = sum c t^a s^b between four bin centres, t and s from 0 to 1;
+    // (nx - 1) * (ny - 1) squares, row-major, empty while the field is bilinear
+    std::vector<double> spline;
+
+  private:
+    double spline_field(const double x, const double y) const;
+    void allocate();
+    void set_spacing();
+
+    double* memory = nullptr; // values of a grid not mapped from a cache
+    void* mapping = nullptr;
+    std::size_t mapping_bytes = 0;
+    std::int64_t source_bytes = -1, source_mtime = -1; // of the file a mapped cache was made from, ns
+};
+
+// Cache layout: the header, then the values as in memory at a multiple of 64 bytes. Everything is
+// native endian; the version changes with the layout. A spline from smooth is not cached; it is
+// fitted again from the cached nodes.
+struct MagneticFieldCacheHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t header_bytes;
+  std::int32_t nx, ny;
+  double x_min, x_max, y_min, y_max; // m
+  double length_unit, magnetic_field_unit;
+  std::int64_t source_bytes, source_mtime; // of the file the cache was made from, mtime in ns
+  std::uint64_t values_offset, file_bytes;
+};
+
+const char magnetic_field_cache_magic[8] = {'R', 'U', 'N', 'G', 'E', 'F', 'L', 'D'};
+const std::uint32_t magnetic_field_cache_version = 2;
+const std::size_t magnetic_field_cache_alignment = 64;
+
+inline std::size_t magnetic_field_aligned(const std::size_t bytes){
+  return (bytes + magnetic_field_cache_alignment - 1) / magnetic_field_cache_alignment * magnetic_field_cache_alignment;
+}
+
+// size and modification time of a file, false if it cannot be read
+inline bool magnetic_field_source_stat(const std::string& path, std::int64_t& bytes, std::int64_t& mtime){
+  struct stat status;
+  if(stat(path.c_str(), &status) != 0){
+    return false;
+  }
+  bytes = status.st_size;
+  mtime = (std::int64_t)status.st_mtim.tv_sec * 1000000000 + status.st_mtim.tv_nsec;
+  return true;
+}
+
+// whether a cache header of a file of file_bytes describes a grid that lies inside the file, so a
+// truncated or foreign cache is refused before anything reads its values
+inline bool magnetic_field_cache_valid(const MagneticFieldCacheHeader& header, const std::uint64_t file_bytes){
+  if(std::memcmp(header.magic, magnetic_field_cache_magic, sizeof(header.magic)) != 0 || header.version != magnetic_field_cache_version
+     || header.header_bytes != sizeof(header) || header.file_bytes != file_bytes){
+    return false;
+  }
+  // bounded so the node count cannot overflow
+  if(header.nx < 2 || header.ny < 2 || header.nx > (1 << 24) || header.ny > (1 << 24)
+     || !(header.x_min < header.x_max) || !(header.y_min < header.y_max)){
+    return false;
+  }
+  const std::uint64_t value_bytes = sizeof(double) * (std::uint64_t)(header.nx + 2) * (std::uint64_t)(header.ny + 2);
+  return header.values_offset >= sizeof(header) && header.values_offset % magnetic_field_cache_alignment == 0
+         && header.values_offset <= file_bytes && value_bytes <= file_bytes - header.values_offset;
+}
+
+inline void MagneticFieldGrid::set_spacing(){
+  dx = (x_max - x_min) / nx;
+  dy = (y_max - y_min) / ny;
+  inv_dx = 1 / dx;
+  inv_dy = 1 / dy;
+  stride = nx + 2;
+}
+
+// the values in a cache line aligned block
+inline void MagneticFieldGrid::allocate(){
+  memory = static_cast<double*>(std::aligned_alloc(magnetic_field_cache_alignment, magnetic_field_aligned(sizeof(double) * stride * (ny + 2))));
+  values = memory;
+}
+
+inline MagneticFieldGrid::MagneticFieldGrid(const TH2D* histogram, const double length_unit, const double magnetic_field_unit)
+: length_unit(length_unit), magnetic_field_unit(magnetic_field_unit){
+  const TAxis* x_axis = histogram->GetXaxis();
+  const TAxis* y_axis = histogram->GetYaxis();
+  nx = x_axis->GetNbins();
+  ny = y_axis->GetNbins();
+  x_min = x_axis->GetXmin() * length_unit;
+  x_max = x_axis->GetXmax() * length_unit;
+  y_min = y_axis->GetXmin() * length_unit;
+  y_max = y_axis->GetXmax() * length_unit;
+  set_spacing();
+
+  allocate();
+  for(int j = 0; j < ny + 2; j++){
+    const int bin_y = std::min(std::max(j, 1), ny);
+    for(int i = 0; i < stride; i++){
+      const int bin_x = std::min(std::max(i, 1), nx);
+      memory[j * stride + i] = histogram->GetBinContent(bin_x, bin_y) * magnetic_field_unit;
+    }
+  }
+}
+
+inline MagneticFieldGrid::MagneticFieldGrid(const std::string& cache_path){
+  const int descriptor = open(cache_path.c_str(), O_RDONLY);
+  if(descriptor < 0){
+    return;
+  }
+  struct stat status;
+  MagneticFieldCacheHeader header;
+  if(fstat(descriptor, &status) != 0 || pread(descriptor, &header, sizeof(header), 0) != (ssize_t)sizeof(header)
+     || !magnetic_field_cache_valid(header, status.st_size)){
+    close(descriptor);
+    return;
+  }
+  void* mapped = mmap(nullptr, header.file_bytes, PROT_READ, MAP_SHARED, descriptor, 0);
+  close(descriptor);
+  if(mapped == MAP_FAILED){
+    return;
+  }
+  mapping = mapped;
+  mapping_bytes = header.file_bytes;
+  nx = header.nx;
+  ny = header.ny;
+  x_min = header.x_min;
+  x_max = header.x_max;
+  y_min = header.y_min;
+  y_max = header.y_max;
+  length_unit = header.length_unit;
+  magnetic_field_unit = header.magnetic_field_unit;
+  source_bytes = header.source_bytes;
+  source_mtime = header.source_mtime;
+  set_spacing();
+  values = reinterpret_cast<const double*>(static_cast<const char*>(mapping) + header.values_offset);
+}
+
+inline MagneticFieldGrid::MagneticFieldGrid(const MagneticFieldGrid& other, const double scale)
+: nx(other.nx), ny(other.ny), x_min(other.x_min), x_max(other.x_max), y_min(other.y_min), y_max(other.y_max),
+  length_unit(other.length_unit), magnetic_field_unit(other.magnetic_field_unit * scale){
+  set_spacing();
+  allocate();
+  for(int node = 0; node < stride * (ny + 2); node++){
+    memory[node] = other.values[node] * scale;
+  }
+  spline = other.spline;
+  for(auto& coefficient:spline){
+    coefficient *= scale;
+  }
+}
+
+inline MagneticFieldGrid::~MagneticFieldGrid(){
+  if(mapping != nullptr){
+    munmap(mapping, mapping_bytes);
+  }
+  std::free(memory);
+}
+
+inline bool MagneticFieldGrid::is_open() const {
+  return values != nullptr;
+}
+
+inline bool MagneticFieldGrid::is_current(const std::string& source_path) const {
+  std::int64_t bytes, mtime;
+  return mapping != nullptr && magnetic_field_source_stat(source_path, bytes, mtime) && bytes == source_bytes && mtime == source_mtime;
+}
+
+inline std::uint64_t MagneticFieldGrid::content_hash() const {
+  const double extent[4] = {x_min, x_max, y_min, y_max};
+  const int bins[2] = {nx, ny};
+  std::uint64_t hash = fnv1a(bins, sizeof(bins));
+  hash = fnv1a(extent, sizeof(extent), hash);
+  return fnv1a(values, sizeof(double) * stride * (ny + 2), hash);
+}
+
+// written next to the cache and renamed over it, so a process opening the cache meanwhile
+// sees either the old file or the new one
+inline bool MagneticFieldGrid::write_cache(const std::string& cache_path, const std::string& source_path) const {
+  MagneticFieldCacheHeader header = {};
+  std::memcpy(header.magic, magnetic_field_cache_magic, sizeof(header.magic));
+  header.version = magnetic_field_cache_version;
+  header.header_bytes = sizeof(header);
+  header.nx = nx;
+  header.ny = ny;
+  header.x_min = x_min;
+  header.x_max = x_max;
+  header.y_min = y_min;
+  header.y_max = y_max;
+  header.length_unit = length_unit;
+  header.magnetic_field_unit = magnetic_field_unit;
+  if(!magnetic_field_source_stat(source_path, header.source_bytes, header.source_mtime)){
+    return false;
+  }
+  const std::size_t value_bytes = sizeof(double) * stride * (ny + 2);
+  header.values_offset = magnetic_field_aligned(sizeof(header));
+  header.file_bytes = header.values_offset + magnetic_field_aligned(value_bytes);
+
+  const std::string temporary_path = cache_path + "." + std::to_string(getpid());
+  std::FILE* cache = std::fopen(temporary_path.c_str(), "wb");
+  if(cache == nullptr){
+    return false;
+  }
+  const char padding[magnetic_field_cache_alignment] = {};
+  bool written = std::fwrite(&header, sizeof(header), 1, cache) == 1
+                 && std::fwrite(padding, 1, header.values_offset - sizeof(header), cache) == header.values_offset - sizeof(header)
+                 && std::fwrite(values, 1, value_bytes, cache) == value_bytes
+                 && std::fwrite(padding, 1, header.file_bytes - header.values_offset - value_bytes, cache) == header.file_bytes - header.values_offset - value_bytes;
+  written = std::fclose(cache) == 0 && written;
+  if(!written || std::rename(temporary_path.c_str(), cache_path.c_str()) != 0){
+    std::remove(temporary_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+inline bool MagneticFieldGrid::is_inside(const double x, const double y) const {
+  return x_min <= x && x < x_max && y_min <= y && y < y_max;
+}
+
+inline double MagneticFieldGrid::field(const double x, const double y) const {
+  if(!is_inside(x, y)){
+    return 0; // TH2::Interpolate refuses to extrapolate
+  }
+  if(!spline.empty()){
+    return spline_field(x, y);
+  }
+  // node i sits at the centre of bin i, so the padded node coordinate is half a bin ahead
+  const double u = (x - x_min) * inv_dx + 0.5;
+  const double v = (y - y_min) * inv_dy + 0.5;
+  const int i = static_cast<int>(u);
+  const int j = static_cast<int>(v);
+  const double t = u - i;
+  const double s = v - j;
+  const double* node = values + j * stride + i;
+  const double bottom = node[0] + (node[1] - node[0]) * t;
+  const double top = node[stride] + (node[stride + 1] - node[stride]) * t;
+  return bottom + (top - bottom) * s;
+}
+
+// the spline is held at its edge value beyond the outermost bin centres, like the bilinear map
+inline double MagneticFieldGrid::spline_field(const double x, const double y) const {
+  const double u = (x - x_min) * inv_dx - 0.5;
+  const double v = (y - y_min) * inv_dy - 0.5;
+  const double u_clamped = std::min(std::max(u, 0.0), (double)(nx - 1));
+  const double v_clamped = std::min(std::max(v, 0.0), (double)(ny - 1));
+  const int i = std::min(static_cast<int>(u_clamped), nx - 2);
+  const int j = std::min(static_cast<int>(v_clamped), ny - 2);
+  const double t = u_clamped - i;
+  const double s = v_clamped - j;
+  const double* c = spline.data() + 16 * (j * (nx - 1) + i);
+
+  double rows[4];
+  for(int a = 0; a < 4; a++){
+    rows[a] = ((c[4 * a + 3] * s + c[4 * a + 2]) * s + c[4 * a + 1]) * s + c[4 * a];
+  }
+  return ((rows[3] * t + rows[2]) * t + rows[1]) * t + rows[0];
+}
+
+inline void MagneticFieldGrid::smooth(const double smoothing){
+  if(nx < 2 || ny < 2){
+    return;
+  }
+  // bin centres, smoothed along x and then along y
+  std::vector<double> f(nx * ny);
+  for(int j = 0; j < ny; j++){
+    for(int i = 0; i < nx; i++){
+      f[j * nx + i] = values[(j + 1) * stride + i + 1];
+    }
+  }
+  for(int j = 0; j < ny; j++){
+    smoothing_spline(&f[j * nx], nx, 1, smoothing);
+  }
+  for(int i = 0; i < nx; i++){
+    smoothing_spline(&f[i], ny, nx, smoothing);
+  }
+
+  // slopes per bin of the interpolating splines through the smoothed centres
+  std::vector<double> f_x(nx * ny), f_y(nx * ny), f_xy(nx * ny);
+  for(int j = 0; j < ny; j++){
+    spline_slopes(&f[j * nx], nx, 1, &f_x[j * nx], 1);
+  }
+  for(int i = 0; i < nx; i++){
+    spline_slopes(&f[i], ny, nx, &f_y[i], nx);
+    spline_slopes(&f_x[i], ny, nx, &f_xy[i], nx);
+  }
+
+  // bicubic Hermite squares: c = A F A^T with F the values and slopes at the corners
+  const double A[4][4] = {{1, 0, 0, 0}, {0, 0, 1, 0}, {-3, 3, -2, -1}, {2, -2, 1, 1}};
+  spline.assign(16 * (nx - 1) * (ny - 1), 0);
+  for(int j = 0; j < ny - 1; j++){
+    for(int i = 0; i < nx - 1; i++){
+      const int n00 = j * nx + i, n10 = n00 + 1, n01 = n00 + nx, n11 = n01 + 1;
+      const double F[4][4] = {{f[n00], f[n01], f_y[n00], f_y[n01]},
+                              {f[n10], f[n11], f_y[n10], f_y[n11]},
+                              {f_x[n00], f_x[n01], f_xy[n00], f_xy[n01]},
+                              {f_x[n10], f_x[n11], f_xy[n10], f_xy[n11]}};
+      double* c = spline.data() + 16 * (j * (nx - 1) + i);
+      for(int a = 0; a < 4; a++){
+        for(int b = 0; b < 4; b++){
+          double sum = 0;
+          for(int k = 0; k < 4; k++){
+            for(int l = 0; l < 4; l++){
+              sum += A[a][k] * F[k][l] * A[b][l];
+            }
+          }
+          c[4 * a + b] = sum;
+        }
+      }
+    }
+  }
+
+  // a mapped cache stays as it is; the smoothed nodes go to memory of our own
+  if(memory == nullptr){
+    allocate();
+  }
+  for(int j = 0; j < ny + 2; j++){
+    const int bin_y = std::min(std::max(j, 1), ny) - 1;
+    for(int i = 0; i < stride; i++){
+      const int bin_x = std::min(std::max(i, 1), nx) - 1;
+      memory[j * stride + i] = f[bin_y * nx + bin_x];
+    }
+  }
+}
+
+#endif
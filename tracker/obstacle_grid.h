@@ -0,0 +1,192 @@
+#ifndef RUNGE_TRACKER_OBSTACLE_GRID_H
+#define RUNGE_TRACKER_OBSTACLE_GRID_H
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include "independent_lanes.h"
+
+// where a step first touched an obstacle
+struct ObstacleHit {
+  double t; // fraction of the step, 0 when it started inside
+  double x, y, z; // m
+  int obstacle; // index in ObstacleGrid::rectangles
+  int anihilation_type;
+};
+
+// Axis-aligned drain rectangles binned into a uniform grid of cells over the field map.
+// A step is tested as the segment between its end points: only the cells the segment walks
+// through are visited, so the cost does not grow with the number of obstacles elsewhere,
+// and a long step cannot tunnel through a thin collimator jaw.
+// For tracking out of the plane a rectangle has a z range, see add_box; the cells are columns
+// over the plane, so a 3D step walks the same cells as its projection.
+class ObstacleGrid {
+  public:
+    struct Rectangle {
+      double x1, x2, y1, y2; // m
+      double z1, z2; // m, unbounded for add_rectangle
+      int anihilation_type;
+    };
+
+    ObstacleGrid(const double x_min, const double x_max, const double y_min, const double y_max, const int nx, const int ny);
+
+    // through all z
+    int add_rectangle(const double x1, const double x2, const double y1, const double y2, const int anihilation_type);
+    int add_box(const double x1, const double x2, const double y1, const double y2, const double z1, const double z2, const int anihilation_type);
+    // first obstacle met going from (x0, y0) to (x1, y1) in the plane z = 0
+    bool first_hit(const double x0, const double y0, const double x1, const double y1, ObstacleHit& hit) const;
+    // first obstacle met going from (x0, y0, z0) to (x1, y1, z1)
+    bool first_hit(const double x0, const double y0, const double z0, const double x1, const double y1, const double z1, ObstacleHit& hit) const;
+    // clear[i] stays 1 only where the step from (x0[i], y0[i]) to (x1[i], y1[i]) stays in one cell
+    // no obstacle overlaps, where first_hit returns false at once; one loop without branches over
+    // n steps, which the compiler vectorises
+    void clear_steps(const double* x0, const double* y0, const double* x1, const double* y1, int* clear, const int n) const;
+
+    std::vector<Rectangle> rectangles;
+
+  private:
+    static int cell(const double x, const double low, const double size, const int n);
+    int cell_x(const double x) const;
+    int cell_y(const double y) const;
+    bool segment_hit(const Rectangle& rectangle, const double x0, const double y0, const double z0, const double dx, const double dy, const double dz, double& t) const;
+
+    const double x_min, x_max, y_min, y_max;
+    const int nx, ny;
+    const double cell_dx, cell_dy;
+    std::vector<std::vector<int>> cells; // rectangles overlapping each cell
+    std::vector<int> occupied; // 1 where cells holds any, for clear_steps
+};
+
+inline ObstacleGrid::ObstacleGrid(const double x_min, const double x_max, const double y_min, const double y_max, const int nx, const int ny)
+: x_min(x_min), x_max(x_max), y_min(y_min), y_max(y_max), nx(nx), ny(ny), cell_dx((x_max - x_min) / nx), cell_dy((y_max - y_min) / ny), cells(nx * ny), occupied(nx * ny, 0){}
+
+// clamped before it is cut to an integer, which then is the floor, so neither floor nor a
+// position far off the grid stands in the way of a vectorised loop
+inline int ObstacleGrid::cell(const double x, const double low, const double size, const int n){
+  return static_cast<int>(std::min(std::max((x - low) / size, 0.0), n - 1.0));
+}
+
+inline int ObstacleGrid::cell_x(const double x) const {
+  return cell(x, x_min, cell_dx, nx);
+}
+
+inline int ObstacleGrid::cell_y(const double y) const {
+  return cell(y, y_min, cell_dy, ny);
+}
+
+inline int ObstacleGrid::add_rectangle(const double x1, const double x2, const double y1, const double y2, const int anihilation_type){
+  const double infinity = std::numeric_limits<double>::infinity();
+  return add_box(x1, x2, y1, y2, -infinity, infinity, anihilation_type);
+}
+
+inline int ObstacleGrid::add_box(const double x1, const double x2, const double y1, const double y2, const double z1, const double z2, const int anihilation_type){
+  const int index = rectangles.size();
+  rectangles.push_back({x1, x2, y1, y2, z1, z2, anihilation_type});
+  for(int j = cell_y(y1); j <= cell_y(y2); j++){
+    for(int i = cell_x(x1); i <= cell_x(x2); i++){
+      cells[j * nx + i].push_back(index);
+      occupied[j * nx + i] = 1;
+    }
+  }
+  return index;
+}
+
+// slab test of p0 + t d, t in [0, 1], against a closed box
+inline bool ObstacleGrid::segment_hit(const Rectangle& rectangle, const double x0, const double y0, const double z0, const double dx, const double dy, const double dz, double& t) const {
+  double t_enter = 0, t_exit = 1;
+  const double starts[3] = {x0, y0, z0}, directions[3] = {dx, dy, dz};
+  const double lows[3] = {rectangle.x1, rectangle.y1, rectangle.z1}, highs[3] = {rectangle.x2, rectangle.y2, rectangle.z2};
+  for(int axis = 0; axis < 3; axis++){
+    if(directions[axis] == 0){
+      if(starts[axis] < lows[axis] || highs[axis] < starts[axis]){
+        return false;
+      }
+      continue;
+    }
+    double t_low = (lows[axis] - starts[axis]) / directions[axis];
+    double t_high = (highs[axis] - starts[axis]) / directions[axis];
+    if(t_low > t_high){
+      std::swap(t_low, t_high);
+    }
+    t_enter = std::max(t_enter, t_low);
+    t_exit = std::min(t_exit, t_high);
+    if(t_enter > t_exit){
+      return false;
+    }
+  }
+  t = t_enter;
+  return true;
+}
+
+// the cells as cell_x and cell_y find them, from locals so the loop keeps them in registers
+inline void ObstacleGrid::clear_steps(const double* x0, const double* y0, const double* x1, const double* y1, int* clear, const int n) const {
+  const double x_low = x_min, y_low = y_min, dx = cell_dx, dy = cell_dy;
+  const int columns = nx, rows = ny;
+  const int* const cell_occupied = occupied.data();
+  RUNGE_INDEPENDENT_LANES
+  for(int i = 0; i < n; i++){
+    const int start = cell(y0[i], y_low, dy, rows) * columns + cell(x0[i], x_low, dx, columns);
+    const int end = cell(y1[i], y_low, dy, rows) * columns + cell(x1[i], x_low, dx, columns);
+    clear[i] &= (start == end) & (cell_occupied[start] == 0);
+  }
+}
+
+inline bool ObstacleGrid::first_hit(const double x0, const double y0, const double x1, const double y1, ObstacleHit& hit) const {
+  return first_hit(x0, y0, 0, x1, y1, 0, hit);
+}
+
+inline bool ObstacleGrid::first_hit(const double x0, const double y0, const double z0, const double x1, const double y1, const double z1, ObstacleHit& hit) const {
+  int i = cell_x(x0), j = cell_y(y0);
+  const int i_end = cell_x(x1), j_end = cell_y(y1);
+  // a step inside one empty cell, by far the usual case
+  if(i == i_end && j == j_end && cells[j * nx + i].empty()){
+    return false;
+  }
+
+  const double dx = x1 - x0, dy = y1 - y0, dz = z1 - z0;
+  double best_t = std::numeric_limits<double>::infinity();
+  int best = -1;
+
+  // walk the cells along the segment (Amanatides & Woo)
+  const int step_i = dx > 0 ? 1 : -1, step_j = dy > 0 ? 1 : -1;
+  const double infinity = std::numeric_limits<double>::infinity();
+  const double t_delta_x = dx != 0 ? cell_dx / std::fabs(dx) : infinity;
+  const double t_delta_y = dy != 0 ? cell_dy / std::fabs(dy) : infinity;
+  double t_max_x = dx != 0 ? (x_min + (i + (dx > 0 ? 1 : 0)) * cell_dx - x0) / dx : infinity;
+  double t_max_y = dy != 0 ? (y_min + (j + (dy > 0 ? 1 : 0)) * cell_dy - y0) / dy : infinity;
+
+  while(true){
+    for(int index:cells[j * nx + i]){
+      double t;
+      if(index != best && segment_hit(rectangles[index], x0, y0, z0, dx, dy, dz, t) && t < best_t){
+        best_t = t;
+        best = index;
+      }
+    }
+    // nothing in a later cell can be met before a hit already inside this one
+    const double t_cell_exit = std::min(t_max_x, t_max_y);
+    if((i == i_end && j == j_end) || best_t <= t_cell_exit){
+      break;
+    }
+    if(t_max_x < t_max_y){
+      i += step_i;
+      t_max_x += t_delta_x;
+    }else{
+      j += step_j;
+      t_max_y += t_delta_y;
+    }
+    if(i < 0 || nx <= i || j < 0 || ny <= j){
+      break;
+    }
+  }
+
+  if(best < 0){
+    return false;
+  }
+  hit = {best_t, x0 + best_t * dx, y0 + best_t * dy, z0 + best_t * dz, best, rectangles[best].anihilation_type};
+  return true;
+}
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef RUNGE_TRACKER_SMOOTHING_SPLINE_H
+#define RUNGE_TRACKER_SMOOTHING_SPLINE_H
+
+#include <cstddef>
+#include <vector>
+
+// Cubic splines through equally spaced samples, one unit apart. The samples are n values
+// step apart in memory, so rows and columns of a row-major map are handled alike.
+
+// Replaces the samples by the natural smoothing spline through them, the f minimising
+//   sum (y_i - f(i))^2 + smoothing * integral f''(u)^2 du
+// (Reinsch, Numer. Math. 10 (1967) 177). 0 keeps the samples; the spline then follows wiggles
+// longer than about smoothing^(1/4) samples and flattens shorter ones.
+inline void smoothing_spline(double* y, const int n, const std::size_t step, const double smoothing){
+  if(n < 3 || smoothing <= 0){
+    return;
+  }
+  // (R + smoothing Q^T Q) gamma = Q^T y, with gamma the second derivatives at the interior
+  // samples; the matrix is symmetric, positive definite and pentadiagonal
+  const int m = n - 2;
+  // diagonal, the two bands above it and the two below it, row by row
+  std::vector<double> diagonal(m, 2.0 / 3 + 6 * smoothing), upper1(m, 1.0 / 6 - 4 * smoothing), upper2(m, smoothing);
+  std::vector<double> lower1(upper1), lower2(upper2); // lower1[j] in column j - 1, lower2[j] in column j - 2
+  std::vector<double> gamma(m);
+  for(int j = 0; j < m; j++){
+    gamma[j] = y[j * step] - 2 * y[(j + 1) * step] + y[(j + 2) * step];
+  }
+  // the matrix is positive definite, so elimination needs no pivoting
+  for(int j = 0; j < m - 1; j++){
+    const double factor1 = lower1[j + 1] / diagonal[j];
+    diagonal[j + 1] -= factor1 * upper1[j];
+    upper1[j + 1] -= factor1 * upper2[j];
+    gamma[j + 1] -= factor1 * gamma[j];
+    if(j + 2 < m){
+      const double factor2 = lower2[j + 2] / diagonal[j];
+      lower1[j + 2] -= factor2 * upper1[j];
+      diagonal[j + 2] -= factor2 * upper2[j];
+      gamma[j + 2] -= factor2 * gamma[j];
+    }
+  }
+  for(int j = m - 1; j >= 0; j--){
+    if(j + 1 < m){
+      gamma[j] -= upper1[j] * gamma[j + 1];
+    }
+    if(j + 2 < m){
+      gamma[j] -= upper2[j] * gamma[j + 2];
+    }
+    gamma[j] /= diagonal[j];
+  }
+  // f = y - smoothing Q gamma
+  for(int i = 0; i < n; i++){
+    double q_gamma = 0;
+    if(i - 2 >= 0){
+      q_gamma += gamma[i - 2];
+    }
+    if(i - 1 >= 0 && i - 1 < m){
+      q_gamma -= 2 * gamma[i - 1];
+    }
+    if(i < m){
+      q_gamma += gamma[i];
+    }
+    y[i * step] -= smoothing * q_gamma;
+  }
+}
+
+// First derivatives at the samples of the natural cubic spline through them
+inline void spline_slopes(const double* y, const int n, const std::size_t step, double* slopes, const std::size_t slope_step){
+  if(n < 2){
+    for(int i = 0; i < n; i++){
+      slopes[i * slope_step] = 0;
+    }
+    return;
+  }
+  // M_{i-1} + 4 M_i + M_{i+1} = 6 (y_{i+1} - 2 y_i + y_{i-1}), M = 0 at both ends
+  std::vector<double> moments(n, 0), diagonal(n, 4);
+  for(int i = 1; i < n - 1; i++){
+    moments[i] = 6 * (y[(i + 1) * step] - 2 * y[i * step] + y[(i - 1) * step]);
+  }
+  for(int i = 2; i < n - 1; i++){
+    const double factor = 1 / diagonal[i - 1];
+    diagonal[i] -= factor;
+    moments[i] -= factor * moments[i - 1];
+  }
+  for(int i = n - 2; i >= 1; i--){
+    moments[i] = (moments[i] - (i + 1 < n - 1 ? moments[i + 1] : 0)) / diagonal[i];
+  }
+  for(int i = 0; i < n - 1; i++){
+    slopes[i * slope_step] = y[(i + 1) * step] - y[i * step] - (2 * moments[i] + moments[i + 1]) / 6;
+  }
+  slopes[(n - 1) * slope_step] = y[(n - 1) * step] - y[(n - 2) * step] + (moments[n - 2] + 2 * moments[n - 1]) / 6;
+}
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef RUNGE_TRACKER_SPACE_VECTOR_H
+#define RUNGE_TRACKER_SPACE_VECTOR_H
+
+#include <cmath>
+
+// A position (m) or momentum (eV/c) with just the D components the motion has: a plain array
+// of doubles, so the arithmetic of a step compiles to a few scalar or vector instructions and
+// nothing else. Time and energy are not carried; in a magnetic field the energy follows from
+// |p| and the mass, see BeamTracker.
+template <int D>
+struct SpaceVector {
+  double component[D];
+
+  double& operator[](const int axis){ return component[axis]; }
+  double operator[](const int axis) const { return component[axis]; }
+  double X() const { return component[0]; }
+  double Y() const { return component[1]; }
+  double Z() const { return component[2]; }
+
+  SpaceVector& operator+=(const SpaceVector& other){
+    for(int axis = 0; axis < D; axis++){
+      component[axis] += other.component[axis];
+    }
+    return *this;
+  }
+
+  // squared length
+  double mag2() const {
+    double sum = 0;
+    for(int axis = 0; axis < D; axis++){
+      sum += component[axis] * component[axis];
+    }
+    return sum;
+  }
+
+  double mag() const {
+    return std::sqrt(mag2());
+  }
+};
+
+template <int D>
+inline SpaceVector<D> operator+(SpaceVector<D> a, const SpaceVector<D>& b){
+  return a += b;
+}
+
+template <int D>
+inline SpaceVector<D> operator-(const SpaceVector<D>& a, const SpaceVector<D>& b){
+  SpaceVector<D> difference;
+  for(int axis = 0; axis < D; axis++){
+    difference[axis] = a[axis] - b[axis];
+  }
+  return difference;
+}
+
+template <int D>
+inline SpaceVector<D> operator*(const SpaceVector<D>& a, const double factor){
+  SpaceVector<D> product;
+  for(int axis = 0; axis < D; axis++){
+    product[axis] = a[axis] * factor;
+  }
+  return product;
+}
+
+template <int D>
+inline SpaceVector<D> operator*(const double factor, const SpaceVector<D>& a){
+  return a * factor;
+}
+
+template <int D>
+inline SpaceVector<D> operator/(const SpaceVector<D>& a, const double divisor){
+  SpaceVector<D> quotient;
+  for(int axis = 0; axis < D; axis++){
+    quotient[axis] = a[axis] / divisor;
+  }
+  return quotient;
+}
+
+#endif
@@ -0,0 +1,80 @@
+#ifndef RUNGE_TRACKER_TRACK_GRAPH_H
+#define RUNGE_TRACKER_TRACK_GRAPH_H
+
+#include <vector>
+
+#include "TCanvas.h"
+#include "TGraph.h"
+
+#include "units.h"
+
+// A track of x, y pairs in metres as a graph in cm for the canvases: every stride-th point, and
+// the last one so the track ends where the electron stopped
+inline TGraph* track_graph(const std::vector<double>& orbit, const int stride = 1){
+  const int n_points = orbit.size() / 2;
+  TGraph* graph = new TGraph();
+  for(int point = 0; point < n_points; point += stride){
+    graph->SetPoint(graph->GetN(), orbit[2 * point] / unit::c, orbit[2 * point + 1] / unit::c);
+  }
+  if(n_points > 0 && (n_points - 1) % stride != 0){
+    graph->SetPoint(graph->GetN(), orbit[2 * n_points - 2] / unit::c, orbit[2 * n_points - 1] / unit::c);
+  }
+  return graph;
+}
+
+// The track graphs of a canvas of all tracks and one of the detected ones. A canvas only paints
+// its graphs when it is saved, so they are kept until then and deleted with this; to keep that
+// bounded a canvas takes at most limit tracks, the first ones. density_rendering draws them all
+class TrackGraphs {
+  public:
+    TrackGraphs(TCanvas* all, TCanvas* detected, const int limit);
+    ~TrackGraphs();
+    TrackGraphs(const TrackGraphs&) = delete;
+    TrackGraphs& operator=(const TrackGraphs&) = delete;
+
+    // leaves the canvas of all tracks the current pad
+    void draw(const std::vector<double>& orbit, const int stride, const bool detected);
+    bool is_full() const;
+
+  private:
+    TCanvas* const all;
+    TCanvas* const detected;
+    const int limit;
+    int n_all = 0, n_detected = 0; // tracks drawn on each canvas
+    std::vector<TGraph*> graphs;
+};
+
+inline TrackGraphs::TrackGraphs(TCanvas* all, TCanvas* detected, const int limit)
+: all(all), detected(detected), limit(limit){}
+
+inline TrackGraphs::~TrackGraphs(){
+  for(auto graph:graphs){
+    delete graph;
+  }
+}
+
+inline void TrackGraphs::draw(const std::vector<double>& orbit, const int stride, const bool is_detected){
+  const bool to_all = n_all < limit;
+  const bool to_detected = is_detected && n_detected < limit;
+  if(!to_all && !to_detected){
+    return;
+  }
+  TGraph* graph = track_graph(orbit, stride);
+  graphs.push_back(graph);
+  if(to_detected){
+    detected->cd();
+    graph->Draw("SAME");
+    n_detected++;
+  }
+  all->cd();
+  if(to_all){
+    graph->Draw("SAME");
+    n_all++;
+  }
+}
+
+inline bool TrackGraphs::is_full() const {
+  return n_all >= limit;
+}
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef RUNGE_TRACKER_TRACK_RASTER_H
+#define RUNGE_TRACKER_TRACK_RASTER_H
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+#include <vector>
+
+// Occupancy map of tracks: each pixel counts the tracks that passed through it.
+// Tracks are rasterized segment by segment, walking the pixels every segment crosses,
+// so the map does not depend on how finely a track was sampled, and its size does not
+// depend on how many tracks went into it. Maps over the same pixels add up, so every
+// thread can keep its own and they are summed at the end, or hand over the counts of
+// a part of the run with take.
+class TrackRaster {
+  public:
+    TrackRaster(const double x_min, const double x_max, const double y_min, const double y_max, const int nx, const int ny);
+
+    // points are x, y pairs in metres
+    void add_track(const double* points, const std::size_t n_points);
+    void add(const TrackRaster& other);
+    // moves the counts out as (pixel, count) pairs, leaving the map empty
+    void take(std::vector<std::pair<unsigned int, unsigned int>>& pixels);
+    void add(const std::vector<std::pair<unsigned int, unsigned int>>& pixels);
+
+    const double x_min, x_max, y_min, y_max; // m
+    const int nx, ny;
+    std::vector<unsigned int> counts; // row-major, pixel (i, j) at j * nx + i
+
+  private:
+    void mark(const int i, const int j);
+    void add_segment(const double x0, const double y0, const double x1, const double y1);
+
+    const double pixel_dx, pixel_dy;
+    std::vector<unsigned int> stamps; // last track that marked each pixel, counted from 1
+    unsigned int track = 0;
+};
+
+inline TrackRaster::TrackRaster(const double x_min, const double x_max, const double y_min, const double y_max, const int nx, const int ny)
+: x_min(x_min), x_max(x_max), y_min(y_min), y_max(y_max), nx(nx), ny(ny), counts(nx * ny), pixel_dx((x_max - x_min) / nx), pixel_dy((y_max - y_min) / ny), stamps(nx * ny){}
+
+inline void TrackRaster::mark(const int i, const int j){
+  if(i < 0 || nx <= i || j < 0 || ny <= j){
+    return;
+  }
+  // a track crossing a pixel several times counts once
+  if(stamps[j * nx + i] != track){
+    stamps[j * nx + i] = track;
+    counts[j * nx + i]++;
+  }
+}
+
+inline void TrackRaster::add_track(const double* points, const std::size_t n_points){
+  if(n_points == 0){
+    return;
+  }
+  track++;
+  if(n_points == 1){
+    add_segment(points[0], points[1], points[0], points[1]);
+  }
+  for(std::size_t point = 1; point < n_points; point++){
+    add_segment(points[2 * point - 2], points[2 * point - 1], points[2 * point], points[2 * point + 1]);
+  }
+}
+
+// pixels the segment crosses, walked as in Amanatides & Woo
+inline void TrackRaster::add_segment(const double x0, const double y0, const double x1, const double y1){
+  const double u0 = (x0 - x_min) / pixel_dx, v0 = (y0 - y_min) / pixel_dy;
+  const double du = (x1 - x0) / pixel_dx, dv = (y1 - y0) / pixel_dy;
+  int i = std::floor(u0), j = std::floor(v0);
+  const int i_end = std::floor(u0 + du), j_end = std::floor(v0 + dv);
+  const int step_i = du > 0 ? 1 : -1, step_j = dv > 0 ? 1 : -1;
+  const double infinity = std::numeric_limits<double>::infinity();
+  const double t_delta_u = du != 0 ? 1 / std::fabs(du) : infinity;
+  const double t_delta_v = dv != 0 ? 1 / std::fabs(dv) : infinity;
+  double t_max_u = du != 0 ? (i + (du > 0 ? 1 : 0) - u0) / du : infinity;
+  double t_max_v = dv != 0 ? (j + (dv > 0 ? 1 : 0) - v0) / dv : infinity;
+
+  mark(i, j);
+  for(int n = std::abs(i_end - i) + std::abs(j_end - j); n > 0; n--){
+    if(t_max_u < t_max_v){
+      i += step_i;
+      t_max_u += t_delta_u;
+    }else{
+      j += step_j;
+      t_max_v += t_delta_v;
+    }
+    mark(i, j);
+  }
+}
+
+inline void TrackRaster::add(const TrackRaster& other){
+  for(std::size_t pixel = 0; pixel < counts.size(); pixel++){
+    counts[pixel] += other.counts[pixel];
+  }
+}
+
+inline void TrackRaster::take(std::vector<std::pair<unsigned int, unsigned int>>& pixels){
+  pixels.clear();
+  for(std::size_t pixel = 0; pixel < counts.size(); pixel++){
+    if(counts[pixel] != 0){
+      pixels.emplace_back(pixel, counts[pixel]);
+      counts[pixel] = 0;
+    }
+  }
+}
+
+inline void TrackRaster::add(const std::vector<std::pair<unsigned int, unsigned int>>& pixels){
+  for(auto& pixel:pixels){
+    counts[pixel.first] += pixel.second;
+  }
+}
+
+#endif
@@ -0,0 +1,337 @@
+#ifndef RUNGE_TRACKER_TRACK_STORE_H
+#define RUNGE_TRACKER_TRACK_STORE_H
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <sys/types.h>
+#include <unistd.h>
+#include <vector>
+
+// Streaming store for electron tracks, written next to beta_file.root.
+//
+// <path>      header {"RUNGETRK", uint32 version, uint32 stride, double quantum (m)},
+//             then chunks {uint32 bytes, uint32 tracks, tracks...}
+// <path>.idx  one TrackIndexEntry per track, in the order the tracks were written
+//
+// A track is varint(zigzag(event)), varint(points), then x, y of every point as
+// zigzag varints of the quantized coordinate, the first point absolute and the rest
+// as differences to the previous one. Only every stride-th point is kept, plus the last
+// one so the end of the track is exact to the quantum.
+// Events must be written in increasing order, so a single track is found by a binary
+// search of the index without reading the rest of either file.
+// After a flush both files end on a whole chunk, so a store can be cut back to the
+// first n tracks and continued from there.
+
+struct TrackIndexEntry {
+  std::int64_t event;
+  std::uint64_t offset; // of the track in <path>, bytes
+  std::uint32_t points;
+  std::uint32_t bytes;
+};
+static_assert(sizeof(TrackIndexEntry) == 24, "TrackIndexEntry is stored as it is");
+
+const char track_store_magic[8] = {'R', 'U', 'N', 'G', 'E', 'T', 'R', 'K'};
+const std::uint32_t track_store_version = 1;
+const long track_store_header_bytes = 24;
+
+class TrackWriter {
+  public:
+    // with resume_tracks >= 0, the existing store at path is kept up to that many tracks and continued
+    TrackWriter(const std::string& path, const double quantum, const int stride, const std::size_t chunk_bytes = 1 << 20, const long long resume_tracks = -1);
+    ~TrackWriter();
+    TrackWriter(const TrackWriter&) = delete;
+    TrackWriter& operator=(const TrackWriter&) = delete;
+
+    bool is_open() const;
+    // points are x, y pairs in metres
+    void write(const long long event, const double* points, const std::size_t n_points);
+    // a track as stored by another store with the same quantum and stride, see TrackReader::read_at
+    void append(const TrackIndexEntry& entry, const std::vector<unsigned char>& bytes);
+    void flush();
+
+    const double quantum; // m
+    const int stride;
+
+  private:
+    bool resume(const long long n_tracks);
+    void put_varint(std::uint64_t value);
+    void put_signed(const std::int64_t value);
+
+    std::FILE* data = nullptr;
+    std::FILE* index = nullptr;
+    const std::size_t chunk_bytes;
+    std::vector<unsigned char> chunk;
+    std::vector<TrackIndexEntry> chunk_entries;
+    std::uint64_t chunk_offset; // where the pending chunk will start in <path>
+};
+
+class TrackReader {
+  public:
+    TrackReader(const std::string& path);
+    ~TrackReader();
+    TrackReader(const TrackReader&) = delete;
+    TrackReader& operator=(const TrackReader&) = delete;
+
+    bool is_open() const;
+    long long size() const; // tracks in the store
+    // the track of event as x, y pairs in metres, false if it was not stored
+    bool read(const long long event, std::vector<double>& points);
+    // the position-th track in the store, still encoded
+    bool read_at(const long long position, TrackIndexEntry& entry, std::vector<unsigned char>& bytes);
+
+    double quantum = 0; // m
+    int stride = 0;
+
+  private:
+    bool entry_at(const long long position, TrackIndexEntry& entry);
+
+    std::FILE* data = nullptr;
+    std::FILE* index = nullptr;
+    long long n_tracks = 0;
+    std::vector<unsigned char> buffer;
+};
+
+inline std::uint64_t zigzag(const std::int64_t value){
+  return ((std::uint64_t)value << 1) ^ (std::uint64_t)(value >> 63);
+}
+
+inline std::int64_t unzigzag(const std::uint64_t value){
+  return (std::int64_t)(value >> 1) ^ -(std::int64_t)(value & 1);
+}
+
+inline TrackWriter::TrackWriter(const std::string& path, const double quantum, const int stride, const std::size_t chunk_bytes, const long long resume_tracks)
+: quantum(quantum), stride(stride < 1 ? 1 : stride), chunk_bytes(chunk_bytes), chunk_offset(track_store_header_bytes){
+  chunk.reserve(chunk_bytes + 8);
+  const char* mode = resume_tracks >= 0 ? "r+b" : "wb";
+  data = std::fopen(path.c_str(), mode);
+  index = std::fopen((path + ".idx").c_str(), mode);
+  if(!is_open()){
+    return;
+  }
+  if(resume_tracks >= 0){
+    if(!resume(resume_tracks)){
+      std::fclose(data);
+      data = nullptr;
+    }
+    return;
+  }
+  const std::uint32_t header[2] = {track_store_version, (std::uint32_t)this->stride};
+  std::fwrite(track_store_magic, 1, sizeof(track_store_magic), data);
+  std::fwrite(header, sizeof(header), 1, data);
+  std::fwrite(&quantum, sizeof(quantum), 1, data);
+}
+
+// cuts both files back to the first n_tracks tracks, if the store was written with the same settings
+inline bool TrackWriter::resume(const long long n_tracks){
+  char magic[sizeof(track_store_magic)];
+  std::uint32_t header[2];
+  double stored_quantum;
+  if(std::fread(magic, 1, sizeof(magic), data) != sizeof(magic) || std::memcmp(magic, track_store_magic, sizeof(magic)) != 0
+     || std::fread(header, sizeof(header), 1, data) != 1 || header[0] != track_store_version || header[1] != (std::uint32_t)stride
+     || std::fread(&stored_quantum, sizeof(stored_quantum), 1, data) != 1 || stored_quantum != quantum){
+    return false;
+  }
+  if(n_tracks > 0){
+    TrackIndexEntry last;
+    if(fseeko(index, (off_t)(n_tracks - 1) * sizeof(TrackIndexEntry), SEEK_SET) != 0 || std::fread(&last, sizeof(last), 1, index) != 1){
+      return false;
+    }
+    chunk_offset = last.offset + last.bytes;
+  }
+  std::fflush(data);
+  std::fflush(index);
+  if(ftruncate(fileno(data), (off_t)chunk_offset) != 0 || ftruncate(fileno(index), (off_t)n_tracks * sizeof(TrackIndexEntry)) != 0){
+    return false;
+  }
+  return fseeko(data, 0, SEEK_END) == 0 && fseeko(index, 0, SEEK_END) == 0;
+}
+
+inline TrackWriter::~TrackWriter(){
+  if(is_open()){
+    flush();
+  }
+  if(data != nullptr){
+    std::fclose(data);
+  }
+  if(index != nullptr){
+    std::fclose(index);
+  }
+}
+
+inline bool TrackWriter::is_open() const {
+  return data != nullptr && index != nullptr;
+}
+
+inline void TrackWriter::put_varint(std::uint64_t value){
+  while(value >= 0x80){
+    chunk.push_back((unsigned char)(value | 0x80));
+    value >>= 7;
+  }
+  chunk.push_back((unsigned char)value);
+}
+
+inline void TrackWriter::put_signed(const std::int64_t value){
+  put_varint(zigzag(value));
+}
+
+inline void TrackWriter::write(const long long event, const double* points, const std::size_t n_points){
+  if(n_points == 0){
+    return;
+  }
+  // the chunk header is filled in by flush
+  if(chunk.empty()){
+    chunk.resize(8);
+  }
+  const std::size_t start = chunk.size();
+  const std::size_t n_kept = (n_points - 1) / stride + 1 + ((n_points - 1) % stride != 0);
+  put_signed(event);
+  put_varint(n_kept);
+
+  std::int64_t last_x = 0, last_y = 0;
+  auto put_point = [&](const std::size_t point){
+    const std::int64_t x = std::llround(points[2 * point] / quantum);
+    const std::int64_t y = std::llround(points[2 * point + 1] / quantum);
+    put_signed(x - last_x);
+    put_signed(y - last_y);
+    last_x = x;
+    last_y = y;
+  };
+  for(std::size_t point = 0; point < n_points; point += stride){
+    put_point(point);
+  }
+  // the last point is always kept
+  if((n_points - 1) % stride != 0){
+    put_point(n_points - 1);
+  }
+  chunk_entries.push_back({(std::int64_t)event, chunk_offset + start, (std::uint32_t)n_kept, (std::uint32_t)(chunk.size() - start)});
+
+  if(chunk.size() >= chunk_bytes){
+    flush();
+  }
+}
+
+inline void TrackWriter::append(const TrackIndexEntry& entry, const std::vector<unsigned char>& bytes){
+  if(chunk.empty()){
+    chunk.resize(8);
+  }
+  chunk_entries.push_back({entry.event, chunk_offset + chunk.size(), entry.points, entry.bytes});
+  chunk.insert(chunk.end(), bytes.begin(), bytes.end());
+  if(chunk.size() >= chunk_bytes){
+    flush();
+  }
+}
+
+// writes the pending chunk and its index entries
+inline void TrackWriter::flush(){
+  if(chunk_entries.empty()){
+    return;
+  }
+  const std::uint32_t header[2] = {(std::uint32_t)(chunk.size() - 8), (std::uint32_t)chunk_entries.size()};
+  std::memcpy(chunk.data(), header, sizeof(header));
+  std::fwrite(chunk.data(), 1, chunk.size(), data);
+  std::fwrite(chunk_entries.data(), sizeof(TrackIndexEntry), chunk_entries.size(), index);
+  std::fflush(data);
+  std::fflush(index);
+  chunk_offset += chunk.size();
+  chunk.clear();
+  chunk_entries.clear();
+}
+
+inline TrackReader::TrackReader(const std::string& path){
+  data = std::fopen(path.c_str(), "rb");
+  index = std::fopen((path + ".idx").c_str(), "rb");
+  char magic[sizeof(track_store_magic)];
+  std::uint32_t header[2];
+  if(!is_open() || std::fread(magic, 1, sizeof(magic), data) != sizeof(magic) || std::memcmp(magic, track_store_magic, sizeof(magic)) != 0
+     || std::fread(header, sizeof(header), 1, data) != 1 || header[0] != track_store_version || std::fread(&quantum, sizeof(quantum), 1, data) != 1){
+    if(data != nullptr){
+      std::fclose(data);
+      data = nullptr;
+    }
+    return;
+  }
+  stride = header[1];
+  fseeko(index, 0, SEEK_END);
+  n_tracks = ftello(index) / (off_t)sizeof(TrackIndexEntry);
+}
+
+inline TrackReader::~TrackReader(){
+  if(data != nullptr){
+    std::fclose(data);
+  }
+  if(index != nullptr){
+    std::fclose(index);
+  }
+}
+
+inline bool TrackReader::is_open() const {
+  return data != nullptr && index != nullptr;
+}
+
+inline long long TrackReader::size() const {
+  return n_tracks;
+}
+
+inline bool TrackReader::entry_at(const long long position, TrackIndexEntry& entry){
+  return fseeko(index, (off_t)position * sizeof(TrackIndexEntry), SEEK_SET) == 0 && std::fread(&entry, sizeof(entry), 1, index) == 1;
+}
+
+inline bool TrackReader::read_at(const long long position, TrackIndexEntry& entry, std::vector<unsigned char>& bytes){
+  if(!is_open() || position < 0 || position >= n_tracks || !entry_at(position, entry)){
+    return false;
+  }
+  bytes.resize(entry.bytes);
+  return fseeko(data, (off_t)entry.offset, SEEK_SET) == 0 && std::fread(bytes.data(), 1, entry.bytes, data) == entry.bytes;
+}
+
+inline bool TrackReader::read(const long long event, std::vector<double>& points){
+  points.clear();
+  if(!is_open()){
+    return false;
+  }
+  // binary search over the index entries on disk
+  long long low = 0, high = n_tracks;
+  TrackIndexEntry entry;
+  while(low < high){
+    const long long middle = low + (high - low) / 2;
+    if(!entry_at(middle, entry)){
+      return false;
+    }
+    if(entry.event < event){
+      low = middle + 1;
+    }else{
+      high = middle;
+    }
+  }
+  if(!read_at(low, entry, buffer) || entry.event != event){
+    return false;
+  }
+  const unsigned char* byte = buffer.data();
+  const unsigned char* end = byte + buffer.size();
+  auto get_varint = [&](){
+    std::uint64_t value = 0;
+    for(int shift = 0; byte < end; shift += 7){
+      value |= (std::uint64_t)(*byte & 0x7f) << shift;
+      if((*byte++ & 0x80) == 0){
+        break;
+      }
+    }
+    return value;
+  };
+  get_varint(); // event
+  const std::uint64_t n_points = get_varint();
+  points.reserve(2 * n_points);
+  std::int64_t x = 0, y = 0;
+  for(std::uint64_t point = 0; point < n_points; point++){
+    x += unzigzag(get_varint());
+    y += unzigzag(get_varint());
+    points.push_back(x * quantum);
+    points.push_back(y * quantum);
+  }
+  return true;
+}
+
+#endif
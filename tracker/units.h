@@ -0,0 +1,24 @@
+#ifndef RUNGE_TRACKER_UNITS_H
+#define RUNGE_TRACKER_UNITS_H
+
+// Units of the trackers, see memo.txt: lengths and proper time in m, energies and momenta in eV,
+// charges in e and the magnetic field in c*eV/m
+
+const double c = 300 * 1000 * 1000; // m/s
+const double Tesla = c; // eV/m
+const double second = c; // m
+
+namespace unit {
+  const double n = 0.001 * 0.001 * 0.001;
+  const double micro = 0.001 * 0.001;
+  const double m = 0.001;
+  const double c = 0.01;
+  const double k = 1000;
+  const double M = 1000 * 1000;
+  const double G = 1000 * 1000 * 1000;
+}
+
+const double mass_e = 511 * unit::k; // eV
+const double charge_e = -1; // e = 1
+
+#endif